@@ -0,0 +1,129 @@
+#include "cloud.pb.h"
+#include "cloudlab/network/connection.hh"
+
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <thread>
+
+using namespace cloudlab;
+
+// Sends a PUT with a value of state.range(0) bytes over one end of a
+// socketpair and receives it on the other end, i.e., framing, serialization
+// and the system calls of a round trip without the network. With
+// state.range(1) set, messages above the threshold are compressed.
+static void BM_ConnectionSendReceive(benchmark::State& state) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    state.SkipWithError("socketpair failed");
+    return;
+  }
+  Connection sender{fds[0]};
+  Connection receiver{fds[1]};
+  sender.set_compression(state.range(1) != 0);
+
+  cloud::CloudMessage request{};
+  request.set_type(cloud::CloudMessage_Type_REQUEST);
+  request.set_operation(cloud::CloudMessage_Operation_PUT);
+  auto* kvp = request.add_kvp();
+  kvp->set_key("key");
+  kvp->set_value(std::string(static_cast<size_t>(state.range(0)), 'x'));
+
+  cloud::CloudMessage received{};
+  for (auto _ : state) {
+    if (!sender.send(request) || !receiver.receive(received)) {
+      state.SkipWithError("send or receive failed");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<int64_t>(request.ByteSizeLong()));
+}
+BENCHMARK(BM_ConnectionSendReceive)
+    ->ArgsProduct({benchmark::CreateRange(16, 64 << 10, 16), {0, 1}});
+
+/**
+ * Listens on TCP loopback or a Unix domain socket and echoes every message
+ * of the first connection it accepts until that connection is closed.
+ */
+class EchoServer {
+ public:
+  explicit EchoServer(bool uds) {
+    if (uds) {
+      auto path = fmt::format("/tmp/cloudlab-bench-{}.sock", getpid());
+      unlink(path.c_str());
+      address = fmt::format("unix:{}", path);
+      sockaddr_un un{};
+      auto length = SocketAddress{address}.unix_address(un);
+      listener = socket(AF_UNIX, SOCK_STREAM, 0);
+      bind(listener, reinterpret_cast<sockaddr*>(&un), length);
+    } else {
+      sockaddr_in in{};
+      in.sin_family = AF_INET;
+      in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      listener = socket(AF_INET, SOCK_STREAM, 0);
+      bind(listener, reinterpret_cast<sockaddr*>(&in), sizeof(in));
+      socklen_t length = sizeof(in);
+      getsockname(listener, reinterpret_cast<sockaddr*>(&in), &length);
+      address = fmt::format("127.0.0.1:{}", ntohs(in.sin_port));
+    }
+    listen(listener, 1);
+    thread = std::thread([this]() {
+      Connection con{accept(listener, nullptr, nullptr)};
+      cloud::CloudMessage msg{};
+      while (con.receive(msg) && con.send(msg)) {
+      }
+    });
+  }
+
+  ~EchoServer() {
+    thread.join();
+    close(listener);
+    if (address.starts_with(unix_address_prefix)) {
+      unlink(SocketAddress{address}.get_path().c_str());
+    }
+  }
+
+  std::string address;
+
+ private:
+  int listener{-1};
+  std::thread thread;
+};
+
+// Round trips of a PUT with a value of state.range(0) bytes to an echo
+// server on the same host, over TCP loopback (state.range(1) = 0) or a Unix
+// domain socket (1).
+static void BM_ConnectionRoundTrip(benchmark::State& state) {
+  EchoServer server{state.range(1) != 0};
+  state.SetLabel(state.range(1) ? "uds" : "tcp");
+
+  cloud::CloudMessage request{};
+  request.set_type(cloud::CloudMessage_Type_REQUEST);
+  request.set_operation(cloud::CloudMessage_Operation_PUT);
+  auto* kvp = request.add_kvp();
+  kvp->set_key("key");
+  kvp->set_value(std::string(static_cast<size_t>(state.range(0)), 'x'));
+
+  {
+    Connection con{server.address};
+    cloud::CloudMessage response{};
+    for (auto _ : state) {
+      if (con.connect_failed || !con.send(request) || !con.receive(response)) {
+        state.SkipWithError("round trip failed");
+        break;
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * 2 *
+                          static_cast<int64_t>(request.ByteSizeLong()));
+}
+BENCHMARK(BM_ConnectionRoundTrip)
+    ->ArgsProduct({{16, 4096, 64 << 10}, {0, 1}})
+    ->UseRealTime();
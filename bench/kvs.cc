@@ -0,0 +1,73 @@
+#include "cloudlab/kvs.hh"
+
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+
+#include <random>
+
+using namespace cloudlab;
+
+static std::unique_ptr<KVS> kvs{};
+
+// state.range(0) keys with 100 byte values
+static void SetupKVS(const benchmark::State& state) {
+  auto path = fmt::format("/tmp/cloudlab-bench-kvs-{}", state.range(0));
+  std::filesystem::remove_all(path);
+  kvs = std::make_unique<KVS>(path, true, std::make_shared<StorageProfile>());
+  for (auto i = 0; i < state.range(0); i++) {
+    kvs->put(fmt::format("key{}", i), std::string(100, 'x'));
+  }
+}
+
+static void TeardownKVS(const benchmark::State&) {
+  kvs.reset();
+}
+
+// Uniform GETs of existing keys.
+static void BM_KVSGet(benchmark::State& state) {
+  std::mt19937_64 rng{static_cast<uint64_t>(state.thread_index())};
+  std::uniform_int_distribution<int64_t> uniform{0, state.range(0) - 1};
+  std::string value;
+  for (auto _ : state) {
+    auto found = kvs->get(fmt::format("key{}", uniform(rng)), value);
+    benchmark::DoNotOptimize(found);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_KVSGet)
+    ->Arg(100000)
+    ->ThreadRange(1, 4)
+    ->Setup(SetupKVS)
+    ->Teardown(TeardownKVS);
+
+// Buffered PUTs that overwrite existing keys.
+static void BM_KVSPut(benchmark::State& state) {
+  std::string value(100, 'x');
+  uint64_t i = 0;
+  for (auto _ : state) {
+    auto ok = kvs->put(fmt::format("key{}", i++ % state.range(0)), value);
+    benchmark::DoNotOptimize(ok);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_KVSPut)
+    ->Arg(100000)
+    ->ThreadRange(1, 4)
+    ->Setup(SetupKVS)
+    ->Teardown(TeardownKVS);
+
+// Scans of all state.range(0) keys, e.g., during a redistribution.
+static void BM_KVSGetAll(benchmark::State& state) {
+  std::vector<std::pair<std::string, std::string>> buffer;
+  for (auto _ : state) {
+    buffer.clear();
+    auto ok = kvs->get_all(buffer);
+    benchmark::DoNotOptimize(ok);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_KVSGetAll)
+    ->RangeMultiplier(10)
+    ->Range(100, 100000)
+    ->Setup(SetupKVS)
+    ->Teardown(TeardownKVS);
@@ -0,0 +1,48 @@
+#include "cloudlab/kvs.hh"
+
+#include "workload.hh"
+
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+
+using namespace cloudlab;
+
+const auto num_keys = 100000;
+
+static std::unique_ptr<KVS> kvs{};
+
+// state.range(0) is the cache size in KiB (0 = plain rocksdb reads)
+static void SetupKVS(const benchmark::State& state) {
+  auto path = fmt::format("/tmp/cloudlab-bench-cache-{}", state.range(0));
+  std::filesystem::remove_all(path);
+  StorageConfig config{};
+  config.value_cache_size = static_cast<size_t>(state.range(0)) * 1024;
+  kvs = std::make_unique<KVS>(path, true,
+                              std::make_shared<StorageProfile>(config));
+  for (auto i = 0; i < num_keys; i++) {
+    kvs->put(fmt::format("key{}", i), std::string(100, 'x'));
+  }
+}
+
+static void TeardownKVS(const benchmark::State&) {
+  kvs.reset();
+}
+
+// Zipfian GETs against rocksdb with and without the value cache in front.
+static void BM_KVSGetZipfian(benchmark::State& state) {
+  ZipfianGenerator zipf{num_keys, 0.99,
+                        static_cast<uint64_t>(state.thread_index())};
+  std::string value;
+  for (auto _ : state) {
+    auto found = kvs->get(fmt::format("key{}", zipf.next()), value);
+    benchmark::DoNotOptimize(found);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_KVSGetZipfian)
+    ->Arg(0)
+    ->Arg(1024)
+    ->Arg(4096)
+    ->ThreadRange(1, 4)
+    ->Setup(SetupKVS)
+    ->Teardown(TeardownKVS);
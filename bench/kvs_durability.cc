@@ -0,0 +1,42 @@
+#include "cloudlab/kvs.hh"
+
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+
+using namespace cloudlab;
+
+static std::unique_ptr<KVS> kvs{};
+
+static void SetupKVS(const benchmark::State& state) {
+  auto path = fmt::format("/tmp/cloudlab-bench-durability-{}", state.range(0));
+  std::filesystem::remove_all(path);
+  kvs = std::make_unique<KVS>(path, true, std::make_shared<StorageProfile>());
+}
+
+static void TeardownKVS(const benchmark::State&) {
+  kvs.reset();
+}
+
+// PUTs of 100 byte values with each durability level. With multiple threads,
+// group commit shares one WAL sync between concurrent writers.
+static void BM_KVSPutDurability(benchmark::State& state) {
+  auto durability = static_cast<Durability>(state.range(0));
+  state.SetLabel(durability_name(durability));
+
+  std::string value(100, 'x');
+  uint64_t i = 0;
+  for (auto _ : state) {
+    auto ok = kvs->put(
+        fmt::format("key{}-{}", state.thread_index(), i++ % 100000), value,
+        durability);
+    benchmark::DoNotOptimize(ok);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_KVSPutDurability)
+    ->DenseRange(static_cast<int>(Durability::SYNC),
+                 static_cast<int>(Durability::ASYNC))
+    ->ThreadRange(1, 8)
+    ->UseRealTime()
+    ->Setup(SetupKVS)
+    ->Teardown(TeardownKVS);
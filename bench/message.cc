@@ -0,0 +1,81 @@
+#include "cloud.pb.h"
+#include "cloudlab/network/wire.hh"
+
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+
+using namespace cloudlab;
+
+// A response of a multi-key GET (or a redistribution) with state.range(0)
+// key-value pairs of 100 byte values.
+static auto make_message(int64_t pairs) -> cloud::CloudMessage {
+  cloud::CloudMessage msg{};
+  msg.set_type(cloud::CloudMessage_Type_RESPONSE);
+  msg.set_operation(cloud::CloudMessage_Operation_GET);
+  msg.set_success(true);
+  for (int64_t i = 0; i < pairs; i++) {
+    auto* kvp = msg.add_kvp();
+    kvp->set_key(fmt::format("key{}", i));
+    kvp->set_value(std::string(100, 'x'));
+  }
+  return msg;
+}
+
+static void BM_MessageEncode(benchmark::State& state) {
+  auto msg = make_message(state.range(0));
+  std::string buffer;
+  for (auto _ : state) {
+    buffer.clear();
+    msg.SerializeToString(&buffer);
+    benchmark::DoNotOptimize(buffer.data());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<int64_t>(buffer.size()));
+}
+BENCHMARK(BM_MessageEncode)->RangeMultiplier(10)->Range(1, 10000);
+
+static void BM_MessageDecode(benchmark::State& state) {
+  auto buffer = make_message(state.range(0)).SerializeAsString();
+  cloud::CloudMessage msg{};
+  for (auto _ : state) {
+    auto ok = msg.ParseFromString(buffer);
+    benchmark::DoNotOptimize(ok);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<int64_t>(buffer.size()));
+}
+BENCHMARK(BM_MessageDecode)->RangeMultiplier(10)->Range(1, 10000);
+
+// The same messages in the compact format.
+static void BM_CompactEncode(benchmark::State& state) {
+  auto msg = make_message(state.range(0));
+  std::vector<uint8_t> buffer(compact_size(msg));
+  for (auto _ : state) {
+    auto size = encode_compact(msg, buffer.data());
+    benchmark::DoNotOptimize(size);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<int64_t>(buffer.size()));
+}
+BENCHMARK(BM_CompactEncode)->RangeMultiplier(10)->Range(1, 10000);
+
+// Decodes in place and visits every key-value pair.
+static void BM_CompactDecode(benchmark::State& state) {
+  auto msg = make_message(state.range(0));
+  std::string buffer(compact_size(msg), '\0');
+  encode_compact(msg, reinterpret_cast<uint8_t*>(buffer.data()));
+  CompactMessage compact{};
+  CompactKeyValue kvp{};
+  for (auto _ : state) {
+    auto ok = compact.parse(buffer);
+    while (compact.next(kvp)) benchmark::DoNotOptimize(kvp.value.data());
+    benchmark::DoNotOptimize(ok);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<int64_t>(buffer.size()));
+}
+BENCHMARK(BM_CompactDecode)->RangeMultiplier(10)->Range(1, 10000);
@@ -0,0 +1,48 @@
+#include "cloudlab/network/routing.hh"
+
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+
+using namespace cloudlab;
+
+// Maps keys of state.range(0) bytes to partitions.
+static void BM_RoutingGetPartition(benchmark::State& state) {
+  Routing routing{"127.0.0.1:40000"};
+  std::vector<std::string> keys;
+  for (auto i = 0; i < 1024; i++) {
+    auto key = fmt::format("key{}", i);
+    key.resize(static_cast<size_t>(state.range(0)), 'k');
+    keys.emplace_back(std::move(key));
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    auto partition = routing.get_partition(keys[i++ % keys.size()]);
+    benchmark::DoNotOptimize(partition);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RoutingGetPartition)->RangeMultiplier(4)->Range(8, 512);
+
+// Looks up the peer of a key in a fully populated routing table with
+// state.range(0) peers per partition.
+static void BM_RoutingFindPeer(benchmark::State& state) {
+  Routing routing{"127.0.0.1:40000"};
+  routing.set_partitions_to_cluster_size();
+  for (uint32_t partition = 0; partition < cluster_partitions; partition++) {
+    for (auto peer = 0; peer < state.range(0); peer++) {
+      routing.add_peer(partition,
+                       SocketAddress{fmt::format("127.0.0.1:{}", 41000 + peer)});
+    }
+  }
+  std::vector<std::string> keys;
+  for (auto i = 0; i < 1024; i++) keys.emplace_back(fmt::format("key{}", i));
+
+  size_t i = 0;
+  for (auto _ : state) {
+    auto peer = routing.find_peer(keys[i++ % keys.size()]);
+    benchmark::DoNotOptimize(peer);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RoutingFindPeer)->Arg(1)->Arg(3);
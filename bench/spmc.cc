@@ -0,0 +1,48 @@
+#include "cloudlab/spmc.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <thread>
+
+using namespace cloudlab;
+
+// Produces and consumes on the same thread, i.e., the uncontended cost of a
+// handover.
+static void BM_SPMCProduceConsume(benchmark::State& state) {
+  SPMCQueue<int> queue{};
+  int i = 0;
+  for (auto _ : state) {
+    queue.produce(i++);
+    auto val = queue.consume();
+    benchmark::DoNotOptimize(val);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SPMCProduceConsume);
+
+// One producer hands items to state.range(0) consumer threads, the way the
+// server distributes connections onto its workers. The queue is bounded s.t.
+// the producer cannot run ahead of the consumers.
+static void BM_SPMCHandover(benchmark::State& state) {
+  const auto consumers = static_cast<size_t>(state.range(0));
+  SPMCQueue<int> queue{1024};
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < consumers; i++) {
+    threads.emplace_back([&queue]() {
+      // -1 stops the consumer
+      while (queue.consume() != -1) {
+      }
+    });
+  }
+
+  int i = 0;
+  for (auto _ : state) {
+    while (!queue.try_produce(i & 0xffff)) std::this_thread::yield();
+    i++;
+  }
+
+  for (size_t j = 0; j < consumers; j++) queue.produce(-1);
+  for (auto& thread : threads) thread.join();
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SPMCHandover)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
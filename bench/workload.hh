@@ -0,0 +1,55 @@
+#ifndef CLOUDLAB_BENCH_WORKLOAD_HH
+#define CLOUDLAB_BENCH_WORKLOAD_HH
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+
+namespace cloudlab {
+
+/**
+ * Generates integers in [0, n) following a Zipfian distribution, as in YCSB
+ * (Gray et al., "Quickly Generating Billion-Record Synthetic Databases").
+ * Item 0 is the most popular one.
+ */
+class ZipfianGenerator {
+ public:
+  explicit ZipfianGenerator(uint64_t n, double theta = 0.99,
+                            uint64_t seed = 42)
+      : n{n}, theta{theta}, rng{seed} {
+    zetan = zeta(n);
+    alpha = 1.0 / (1.0 - theta);
+    eta = (1.0 - std::pow(2.0 / static_cast<double>(n), 1.0 - theta)) /
+          (1.0 - zeta(2) / zetan);
+  }
+
+  auto next() -> uint64_t {
+    auto u = dist(rng);
+    auto uz = u * zetan;
+    if (uz < 1.0) return 0;
+    if (uz < 1.0 + std::pow(0.5, theta)) return 1;
+    return static_cast<uint64_t>(static_cast<double>(n) *
+                                 std::pow(eta * u - eta + 1.0, alpha)) %
+           n;
+  }
+
+ private:
+  auto zeta(uint64_t count) const -> double {
+    double sum = 0;
+    for (uint64_t i = 1; i <= count; i++) {
+      sum += 1.0 / std::pow(static_cast<double>(i), theta);
+    }
+    return sum;
+  }
+
+  const uint64_t n;
+  const double theta;
+  double zetan, alpha, eta;
+
+  std::mt19937_64 rng;
+  std::uniform_real_distribution<double> dist{0.0, 1.0};
+};
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_BENCH_WORKLOAD_HH
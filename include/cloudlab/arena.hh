@@ -0,0 +1,40 @@
+#ifndef CLOUDLAB_ARENA_HH
+#define CLOUDLAB_ARENA_HH
+
+#include <google/protobuf/arena.h>
+
+#include <cstdint>
+
+namespace cloudlab {
+
+// first block of every thread's arena, allocated once and reused after each
+// reset, large enough for the messages of a typical request
+const auto arena_initial_block_size = 64 * 1024;
+
+/**
+ * Arena of the calling thread that handlers create the messages of a request
+ * on, s.t. building a message with many key-value pairs does not allocate
+ * and free every field on the heap. Server workers reset the arena after
+ * every request, i.e., messages created on it must not outlive the request.
+ */
+auto request_arena() -> google::protobuf::Arena&;
+
+/**
+ * Frees all messages on the arena of the calling thread.
+ *
+ * @return  the number of bytes that were in use
+ */
+auto reset_request_arena() -> uint64_t;
+
+/**
+ * Creates a message on the arena of the calling thread. The arena owns the
+ * message, it is destroyed by the next reset.
+ */
+template <typename T>
+auto arena_message() -> T& {
+  return *google::protobuf::Arena::CreateMessage<T>(&request_arena());
+}
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_ARENA_HH
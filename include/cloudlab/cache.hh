@@ -0,0 +1,90 @@
+#ifndef CLOUDLAB_CACHE_HH
+#define CLOUDLAB_CACHE_HH
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cloudlab {
+
+/**
+ * A memory-bounded value cache that sits in front of rocksdb. The key space is
+ * split into shards (one per core) that each run S3-FIFO eviction: new keys
+ * enter a small FIFO queue and are only promoted to the main FIFO queue if
+ * they were read again before being evicted, so one-hit wonders do not push
+ * out the working set.
+ */
+class ValueCache {
+ public:
+  /**
+   * @param capacity    Upper bound for the bytes of cached keys and values
+   * @param num_shards  Number of independently locked shards, 0 means one per
+   *                    hardware thread
+   */
+  explicit ValueCache(size_t capacity, size_t num_shards = 0);
+
+  auto get(const std::string& key, std::string& value) -> bool;
+
+  auto insert(const std::string& key, const std::string& value) -> void;
+
+  auto erase(const std::string& key) -> void;
+
+  auto clear() -> void;
+
+ private:
+  class Shard {
+   public:
+    explicit Shard(size_t capacity) : capacity{capacity} {
+    }
+
+    auto get(const std::string& key, std::string& value) -> bool;
+
+    auto insert(const std::string& key, const std::string& value) -> void;
+
+    auto erase(const std::string& key) -> void;
+
+    auto clear() -> void;
+
+   private:
+    struct Entry {
+      std::string key;
+      std::string value;
+      uint8_t freq{0};
+      bool main{false};
+    };
+
+    using Queue = std::list<Entry>;
+
+    auto evict() -> void;
+
+    auto remember(const std::string& key) -> void;
+
+    const size_t capacity;
+    size_t small_size{0};
+    size_t main_size{0};
+
+    // new entries are pushed to the front, eviction happens at the back
+    Queue small{};
+    Queue main{};
+    std::unordered_map<std::string, Queue::iterator> index{};
+
+    // keys recently evicted from the small queue (ghost queue)
+    std::list<std::string> ghost{};
+    std::unordered_map<std::string, std::list<std::string>::iterator>
+        ghost_index{};
+
+    std::mutex mtx{};
+  };
+
+  auto shard(const std::string& key) -> Shard&;
+
+  std::vector<std::unique_ptr<Shard>> shards{};
+};
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_CACHE_HH
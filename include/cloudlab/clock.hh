@@ -0,0 +1,70 @@
+#ifndef CLOUDLAB_CLOCK_HH
+#define CLOUDLAB_CLOCK_HH
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace cloudlab {
+
+// how far timestamps that clients supply may be ahead of the local time (ms),
+// s.t. a bogus timestamp cannot advance the clocks of the cluster for good
+const auto max_clock_offset_ms = 1000;
+
+/**
+ * Wall-clock time in milliseconds since epoch, the time base of expiry times
+ * and request deadlines.
+ */
+inline auto now_ms() -> uint64_t {
+  using namespace std::chrono;
+  return duration_cast<milliseconds>(system_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * Hybrid logical clock. Timestamps are the physical time in milliseconds since
+ * epoch in the upper 48 bits and a logical counter in the lower 16 bits. They
+ * stay close to the physical time but, unlike it, never go backwards and
+ * respect causality across peers: a timestamp handed out after a remote
+ * timestamp was observed is always greater than that timestamp.
+ */
+class HybridLogicalClock {
+ public:
+  /**
+   * Timestamp of a local event, e.g., a write. Strictly greater than all
+   * timestamps handed out or observed before.
+   */
+  auto now() -> uint64_t;
+
+  /**
+   * Observes the timestamp of a remote event s.t. all later local events are
+   * ordered after it.
+   */
+  auto update(uint64_t remote) -> void;
+
+  [[nodiscard]] auto current() const -> uint64_t {
+    return last.load();
+  }
+
+  /**
+   * Physical part of a timestamp in milliseconds since epoch.
+   */
+  static auto physical_ms(uint64_t timestamp) -> uint64_t {
+    return timestamp >> 16;
+  }
+
+  /**
+   * Whether a timestamp supplied by a client may be observed, i.e., is at
+   * most max_clock_offset_ms ahead of the local time.
+   */
+  static auto is_plausible(uint64_t timestamp) -> bool {
+    return physical_ms(timestamp) <= now_ms() + max_clock_offset_ms;
+  }
+
+ private:
+  std::atomic<uint64_t> last{0};
+};
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_CLOCK_HH
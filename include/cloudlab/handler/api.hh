@@ -2,6 +2,7 @@
 #define CLOUDLAB_API_HH
 
 #include "cloudlab/handler/handler.hh"
+#include "cloudlab/metrics.hh"
 #include "cloudlab/network/routing.hh"
 
 namespace cloudlab {
@@ -12,6 +13,9 @@ namespace cloudlab {
  * In cloudlab we will simply forward all requests to the P2P port ... in
  * the "real" world different authentication protocols and messages may be used
  * on those ports.
+ *
+ * Requests are forwarded by a coroutine, so the server's event loop keeps
+ * many of them in flight while they wait for the backend.
  */
 class APIHandler : public ServerHandler {
  public:
@@ -20,8 +24,16 @@ class APIHandler : public ServerHandler {
 
   auto handle_connection(Connection& con) -> void override;
 
+  auto handle_connection_async(Connection& con) -> Task<> override;
+
+  [[nodiscard]] auto is_async(const Connection& con) const -> bool override {
+    return true;
+  }
+
  private:
   Routing& routing;
+
+  OperationMetrics operations{"api"};
 };
 
 }  // namespace cloudlab
@@ -2,6 +2,7 @@
 #define CLOUDLAB_HANDLER_HH
 
 #include "cloudlab/network/connection.hh"
+#include "cloudlab/task.hh"
 
 namespace cloudlab {
 
@@ -20,6 +21,30 @@ class ServerHandler {
    * @param con     The connection
    */
   virtual auto handle_connection(Connection& con) -> void = 0;
+
+  /**
+   * Coroutine variant of handle_connection for handlers that mostly wait for
+   * other servers. Servers run it on their libevent loop instead of a
+   * worker if is_async() is true for the request, s.t. a request that waits
+   * for async_receive does not occupy a thread. It must not block and must
+   * not use the request arena of the thread (see arena.hh), requests of
+   * other connections run on the same thread meanwhile.
+   *
+   * @param con     The connection, valid until the task is done
+   */
+  virtual auto handle_connection_async(Connection& con) -> Task<> {
+    handle_connection(con);
+    co_return;
+  }
+
+  /**
+   * @param con     The connection, its next message arrived completely
+   * @return        true if handle_connection_async handles the next message
+   *                on the event loop, false if a worker handles it
+   */
+  [[nodiscard]] virtual auto is_async(const Connection& con) const -> bool {
+    return false;
+  }
 };
 
 }  // namespace cloudlab
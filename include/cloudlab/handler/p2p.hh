@@ -3,7 +3,17 @@
 
 #include "cloudlab/handler/handler.hh"
 #include "cloudlab/kvs.hh"
+#include "cloudlab/metrics.hh"
+#include "cloudlab/network/metadata.hh"
 #include "cloudlab/network/routing.hh"
+#include "cloudlab/partitions.hh"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_set>
 
 namespace cloudlab {
 
@@ -13,7 +23,13 @@ namespace cloudlab {
  */
 class P2PHandler : public ServerHandler {
  public:
-  explicit P2PHandler(Routing& routing);
+  /**
+   * @param routing  Routing information of this peer
+   * @param storage  Storage profile of all partitions stored on this peer
+   */
+  explicit P2PHandler(Routing& routing,
+                      std::shared_ptr<const StorageProfile> storage =
+                          std::make_shared<StorageProfile>());
 
   auto handle_connection(Connection& con) -> void override;
 
@@ -21,16 +37,80 @@ class P2PHandler : public ServerHandler {
   auto handle_put(Connection& con, const cloud::CloudMessage& msg) -> void;
   auto handle_get(Connection& con, const cloud::CloudMessage& msg) -> void;
   auto handle_delete(Connection& con, const cloud::CloudMessage& msg) -> void;
+  auto handle_read_modify_write(Connection& con, const cloud::CloudMessage& msg) -> void;
+  auto handle_txn_prepare(Connection& con, const cloud::CloudMessage& msg) -> void;
+  auto handle_txn_commit(Connection& con, const cloud::CloudMessage& msg) -> void;
+  auto handle_txn_abort(Connection& con, const cloud::CloudMessage& msg) -> void;
   auto handle_join_cluster(Connection& con, const cloud::CloudMessage& msg) -> void;
   auto handle_create_partitions(Connection& con, const cloud::CloudMessage& msg) -> void;
   auto handle_steal_partitions(Connection& con, const cloud::CloudMessage& msg) -> void;
   auto handle_drop_partitions(Connection& con, const cloud::CloudMessage& msg) -> void;
   auto handle_transfer_partition(Connection& con, const cloud::CloudMessage& msg) -> void;
+  auto handle_stats(Connection& con, const cloud::CloudMessage& msg) -> void;
+
+  /**
+   * Makes the router wait for the metadata batch with the given sequence
+   * number before it relies on response (see MetadataChannel).
+   */
+  auto add_barrier(cloud::CloudMessage& response, uint64_t sequence) -> void;
+
+  /**
+   * Exposes the sum of a rocksdb integer property over all partitions of this
+   * peer as a gauge.
+   */
+  auto register_rocksdb_property(const std::string& property) -> void;
+
+  /**
+   * Whether key is written by a prepared transaction. Other writes of key
+   * fail until the transaction committed or aborted. txn_mtx must be held,
+   * shared by plain writes from the check until their write is applied s.t.
+   * no transaction prepares the key in between.
+   */
+  auto is_locked(const std::string& key) -> bool;
+
+  /**
+   * Releases the locks of a prepared transaction. txn_mtx must be held.
+   */
+  auto release(uint64_t transaction_id) -> void;
+
+  // writes of a transaction that passed the prepare phase on this peer
+  struct PreparedTransaction {
+    // [partition ID -> writes]
+    std::unordered_map<uint32_t, std::vector<KVS::Write>> writes{};
+
+    // the partitions the writes go to, they do not finish to migrate out
+    // before the transaction committed or aborted
+    std::unordered_map<uint32_t, PartitionRegistry::WriteHandle> handles{};
+    Durability durability{Durability::BUFFERED};
+  };
 
-  // partitions stored on this peer: [partition ID -> KVS]
-  std::unordered_map<uint32_t, std::unique_ptr<KVS>> partitions{};
+  // prepared transactions whose coordinator did not decide yet and the keys
+  // they lock
+  std::unordered_map<uint64_t, PreparedTransaction> prepared{};
+  std::unordered_set<std::string> locked_keys{};
+
+  // transactions aborted before this peer prepared them, oldest first
+  std::unordered_set<uint64_t> aborted{};
+  std::deque<uint64_t> aborted_order{};
+
+  // shared by plain writes, exclusive for prepare, commit and abort
+  std::shared_mutex txn_mtx{};
+
+  // partitions stored on this peer
+  PartitionRegistry partitions{};
 
   Routing& routing;
+
+  // reports added and dropped partitions to the router
+  MetadataChannel metadata;
+
+  const std::shared_ptr<const StorageProfile> storage;
+
+  // versions the writes of all partitions on this peer
+  const std::shared_ptr<HybridLogicalClock> clock =
+      std::make_shared<HybridLogicalClock>();
+
+  OperationMetrics operations{"p2p"};
 };
 
 }  // namespace cloudlab
@@ -1,31 +1,112 @@
 #ifndef CLOUDLAB_ROUTER_HH
 #define CLOUDLAB_ROUTER_HH
 
+#include "cloudlab/clock.hh"
 #include "cloudlab/handler/handler.hh"
+#include "cloudlab/hedging.hh"
+#include "cloudlab/hotkeys.hh"
+#include "cloudlab/metrics.hh"
 #include "cloudlab/network/address.hh"
+#include "cloudlab/network/admission.hh"
+#include "cloudlab/network/decisions.hh"
 #include "cloudlab/network/routing.hh"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <unordered_map>
 #include <unordered_set>
 
 namespace cloudlab {
 
+// deadline of requests that do not set one, relative to their arrival (ms)
+const auto request_timeout_ms = 5000;
+
+// time the router waits for the metadata updates that a peer's response to a
+// partition change depends on, it continues with stale routing afterwards
+const auto metadata_timeout = std::chrono::seconds(2);
+
 /**
  * Handler for the routing tier. Forwards requests to the right peer and handles
  * joining / leaving peers.
+ *
+ * Key operations and transactions are forwarded by coroutines on the server's
+ * event loop, so requests that wait for their peers do not occupy a worker.
+ * Joins and partition changes wait for metadata that arrives on the same
+ * server (see await_metadata) and are handled by workers.
  */
 class RouterHandler : public ServerHandler {
  public:
-  explicit RouterHandler(Routing& routing) : routing{routing} {
+  explicit RouterHandler(Routing& routing, HedgingConfig hedging = {})
+      : hedging{hedging}, routing{routing} {
     routing.set_partitions_to_cluster_size();
   }
 
   auto handle_connection(Connection& con) -> void override;
 
+  auto handle_connection_async(Connection& con) -> Task<> override;
+
+  [[nodiscard]] auto is_async(const Connection& con) const -> bool override;
+
  private:
-  auto handle_key_operation(Connection& con, const cloud::CloudMessage& msg) -> void;
+  auto handle_key_operation(Connection& con, const cloud::CloudMessage& msg) -> Task<>;
+  auto handle_transaction(Connection& con, const cloud::CloudMessage& msg) -> Task<>;
   auto handle_join_cluster(Connection& con, const cloud::CloudMessage& msg) -> void;
   auto handle_partitions_added(Connection& con, const cloud::CloudMessage& msg) -> void;
   auto handle_partitions_removed(Connection& con, const cloud::CloudMessage& msg) -> void;
+  auto handle_partitions_changed(Connection& con, const cloud::CloudMessage& msg) -> void;
+  auto handle_stats(Connection& con, const cloud::CloudMessage& msg) -> void;
+
+  // connection to a peer and the message sent to it, which is reused for the
+  // response. Requests on the event loop cannot use the request arena (see
+  // arena.hh), so the request owns the message.
+  using PeerRequest = std::pair<std::unique_ptr<Connection>, std::unique_ptr<cloud::CloudMessage>>;
+
+  /**
+   * Receives the response to a GET that was sent to a peer at sent_at into
+   * the request's message. If the peer did not answer within the hedge delay
+   * and the budget allows it, the GET is also sent to the alternative peer;
+   * the first response wins and the other connection is reset.
+   *
+   * @return  false if no peer answered successfully before the deadline
+   */
+  auto receive_hedged(PeerRequest& request, const std::optional<SocketAddress>& alternative,
+                      std::chrono::steady_clock::time_point sent_at, uint64_t deadline) -> Task<bool>;
+
+  /**
+   * Waits until the metadata batches that response names as barriers were
+   * applied, at most metadata_timeout.
+   */
+  auto await_metadata(const cloud::CloudMessage& response) -> void;
+
+  /**
+   * @return  a connection to peer and a request with the operation and
+   *          options of msg, without keys
+   */
+  auto peer_request(const cloud::CloudMessage& msg, const SocketAddress& peer,
+                    uint64_t timestamp, uint64_t deadline) -> Task<PeerRequest>;
+
+  // a key of a request that its peer answered with NOT_OWNER
+  struct Redirect {
+    std::string key;
+    SocketAddress stale;
+
+    // the owner the peer named, empty if it did not know
+    std::string owner;
+  };
+
+  /**
+   * Sends keys that went to a peer that does not own their partition anymore
+   * once more: to the owner that peer named or, if it named none, to another
+   * peer of the partition. The results are added to response, keys without
+   * another owner fail.
+   */
+  auto redirect(const cloud::CloudMessage& msg, const std::vector<Redirect>& moved,
+                uint64_t timestamp, uint64_t deadline,
+                cloud::CloudMessage& response) -> Task<>;
 
   auto add_new_node(const SocketAddress& peer) -> void;
 
@@ -33,6 +114,38 @@ class RouterHandler : public ServerHandler {
 
   std::unordered_set<SocketAddress> nodes;
 
+  // highest sequence number of the PARTITIONS_CHANGED batches applied per
+  // peer, guarded by metadata_mtx
+  std::unordered_map<std::string, uint64_t> applied_sequences{};
+  std::mutex metadata_mtx{};
+  std::condition_variable metadata_applied{};
+
+  // values of the hottest keys, served without contacting the peer
+  HotKeyCache hot_keys{};
+
+  // observes the timestamps of the peers' writes s.t. snapshot reads assigned
+  // by the router see all writes it forwarded before
+  HybridLogicalClock clock{};
+
+  // duplicates slow GETs to a second peer of their partition
+  HedgingPolicy hedging;
+
+  OperationMetrics operations{"router"};
+  Counter& redirects = metrics().counter(
+      "cloudlab_router_redirects_total",
+      "Keys sent again because their peer did not own their partition anymore");
+  Histogram& redistributions = metrics().histogram(
+      "cloudlab_redistribution_duration_us",
+      "Time to redistribute the partitions after a peer joined in microseconds");
+
+  // IDs of the transactions coordinated by this router, randomly seeded s.t.
+  // a restarted router does not reuse IDs that peers still hold
+  std::atomic<uint64_t> next_transaction_id{
+      static_cast<uint64_t>(std::random_device{}()) << 32};
+
+  // resends the decisions of transactions that a participant missed
+  DecisionChannel decisions{};
+
   Routing& routing;
 };
 
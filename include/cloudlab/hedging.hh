@@ -0,0 +1,97 @@
+#ifndef CLOUDLAB_HEDGING_HH
+#define CLOUDLAB_HEDGING_HH
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace cloudlab {
+
+// number of recent GET latencies the hedge delay is computed from
+const auto hedge_window = 1024;
+
+// latencies recorded before hedging starts
+const auto hedge_min_samples = 64;
+
+/**
+ * Configuration of hedged GETs at the router.
+ */
+struct HedgingConfig {
+  bool enabled{false};
+
+  // a GET is hedged once it took longer than this percentile of recent GETs
+  double percentile{0.95};
+
+  // upper bound for hedged requests as a fraction of all GETs sent to peers
+  double budget{0.05};
+
+  // lower bound for the hedge delay s.t. fast peers are not hedged at all
+  std::chrono::microseconds min_delay{200};
+};
+
+/**
+ * Decides when a GET is duplicated to a second peer of its partition. The
+ * hedge delay follows a percentile of the latencies of recent GETs, and a
+ * token bucket that is refilled by every GET keeps hedged requests within the
+ * budget.
+ */
+class HedgingPolicy {
+ public:
+  explicit HedgingPolicy(HedgingConfig config = {});
+
+  [[nodiscard]] auto enabled() const -> bool {
+    return config.enabled;
+  }
+
+  /**
+   * Records the latency of a GET that was answered by a peer.
+   */
+  auto record(std::chrono::microseconds latency) -> void;
+
+  /**
+   * Time after which a GET is hedged, max() as long as too few latencies were
+   * recorded.
+   */
+  auto delay() -> std::chrono::microseconds;
+
+  /**
+   * Accounts a GET sent to a peer, which earns a fraction of a hedge.
+   */
+  auto request() -> void;
+
+  /**
+   * Takes a hedge from the budget.
+   *
+   * @return  false if the budget is exhausted
+   */
+  auto try_hedge() -> bool;
+
+  /**
+   * Accounts a hedged request that answered before the original one.
+   */
+  auto won() -> void;
+
+  auto hedges() -> uint64_t;
+
+  auto hedges_won() -> uint64_t;
+
+ private:
+  const HedgingConfig config;
+
+  std::array<uint32_t, hedge_window> latencies{};
+  size_t recorded{0};
+
+  // recomputed every hedge_window / 16 recorded latencies
+  std::chrono::microseconds current_delay{std::chrono::microseconds::max()};
+
+  double tokens{0};
+  uint64_t num_hedges{0};
+  uint64_t num_won{0};
+
+  std::mutex mtx{};
+};
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_HEDGING_HH
@@ -0,0 +1,131 @@
+#ifndef CLOUDLAB_HOTKEYS_HH
+#define CLOUDLAB_HOTKEYS_HH
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cloudlab {
+
+// number of keys tracked as hot and eligible for caching at the router
+const auto hot_key_count = 32;
+
+// minimum estimated number of reads before a key's value is cached
+const auto hot_key_min_count = 16;
+
+// upper bound for the bytes of cached values at the router
+const auto hot_key_cache_bytes = 1 << 20;
+
+/**
+ * Count-Min sketch that estimates how often a key was seen in constant space.
+ * Estimates never undercount, collisions may only make a key look hotter.
+ */
+class CountMinSketch {
+ public:
+  CountMinSketch(size_t width, size_t depth);
+
+  /**
+   * Counts one occurrence of key (conservative update).
+   *
+   * @return  the estimated count of key after the update
+   */
+  auto add(const std::string& key) -> uint32_t;
+
+  [[nodiscard]] auto estimate(const std::string& key) const -> uint32_t;
+
+  /**
+   * Halves all counters s.t. keys that were hot a while ago cool down again.
+   */
+  auto decay() -> void;
+
+ private:
+  [[nodiscard]] auto index(size_t row, size_t hash) const -> size_t;
+
+  const size_t width;
+  const size_t depth;
+  std::vector<uint32_t> counters;
+};
+
+/**
+ * Detects the hottest keys of the GET stream (Count-Min sketch plus top-K)
+ * and caches their values. Writes going through the router invalidate the
+ * cached values before they are forwarded and once they completed. A value
+ * read from a peer is only cached if no write to a key of the same stripe
+ * started or completed in the meantime.
+ */
+class HotKeyCache {
+ public:
+  explicit HotKeyCache(size_t top_k = hot_key_count,
+                       size_t capacity = hot_key_cache_bytes);
+
+  /**
+   * Records a read of key and updates the top-K set.
+   */
+  auto record(const std::string& key) -> void;
+
+  /**
+   * Looks up the cached value of key and accounts a hit or miss.
+   */
+  auto lookup(const std::string& key, std::string& value) -> bool;
+
+  /**
+   * Token to be passed to fill() for a value that is about to be read from a
+   * peer.
+   */
+  auto fill_token(const std::string& key) -> uint64_t;
+
+  /**
+   * Caches value if key is hot, i.e., in the top-K set and read at least
+   * hot_key_min_count times, and no write interfered since token was taken.
+   */
+  auto fill(const std::string& key, const std::string& value, uint64_t token)
+      -> void;
+
+  /**
+   * Drops the cached value of key. Must be called when a write to key is
+   * forwarded and again when it completed.
+   */
+  auto invalidate(const std::string& key) -> void;
+
+  /**
+   * The hot keys and their estimated access counts, hottest first.
+   */
+  auto top_keys() -> std::vector<std::pair<std::string, uint32_t>>;
+
+  auto hits() -> uint64_t;
+
+  auto misses() -> uint64_t;
+
+ private:
+  auto stripe(const std::string& key) const -> size_t;
+
+  auto evict(const std::string& key) -> void;
+
+  const size_t top_k;
+  const size_t capacity;
+
+  CountMinSketch sketch;
+
+  // the current top-K keys with their estimated counts
+  std::unordered_map<std::string, uint32_t> top{};
+
+  // cached values, only ever holds keys that are in the top-K set
+  std::unordered_map<std::string, std::string> values{};
+  size_t size{0};
+
+  // write sequence numbers, striped by key hash
+  std::array<uint64_t, 64> write_seq{};
+
+  uint64_t records{0};
+  uint64_t cache_hits{0};
+  uint64_t cache_misses{0};
+
+  std::mutex mtx{};
+};
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_HOTKEYS_HH
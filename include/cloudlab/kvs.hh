@@ -1,44 +1,240 @@
 #ifndef CLOUDLAB_KVS_HH
 #define CLOUDLAB_KVS_HH
 
+#include "cloudlab/cache.hh"
+#include "cloudlab/clock.hh"
+#include "cloudlab/storage.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
+#include <functional>
+#include <memory>
 #include <shared_mutex>
 #include <vector>
 
 namespace rocksdb {
 class DB;
+class Snapshot;
+struct WriteOptions;
 }
 
 namespace cloudlab {
 
 /**
  * The key-value store. We use rocksdb for the actual key-value operations.
+ * Optionally, values are cached in memory in front of rocksdb.
+ *
+ * Every write is versioned with a hybrid logical timestamp. Reads may ask for
+ * the state as of a timestamp, which is served from rocksdb snapshots that are
+ * kept for a short while.
  */
 class KVS {
  public:
-  KVS(const std::string& path, bool open = false)
-      : path{std::filesystem::path(path)}, kvs_open{open} {
+  /**
+   * A single write of a batch.
+   */
+  struct Write {
+    std::string key;
+    std::string value;
+    // time to live in seconds, 0 = never expires
+    uint64_t ttl{0};
+  };
+
+  /**
+   * Metadata of a value that was read.
+   */
+  struct ValueInfo {
+    // remaining time to live in seconds, 0 = no expiry
+    uint64_t ttl{0};
+    // timestamp of the write that stored the value
+    uint64_t version{0};
+    // the read failed because the requested timestamp is older than the
+    // oldest snapshot that is still kept
+    bool snapshot_too_old{false};
+  };
+
+  /**
+   * @param path     Path of the rocksdb database
+   * @param open     Open the database immediately instead of on first use
+   * @param storage  Storage profile shared by the partitions of a peer,
+   *                 rocksdb's defaults are used if there is none
+   * @param clock    Clock that versions writes, shared by the partitions of a
+   *                 peer s.t. reads at one timestamp are consistent across
+   *                 them
+   */
+  KVS(const std::string& path, bool open = false,
+      std::shared_ptr<const StorageProfile> storage = nullptr,
+      std::shared_ptr<HybridLogicalClock> clock = nullptr)
+      : path{std::filesystem::path(path)},
+        kvs_open{open},
+        storage{std::move(storage)},
+        clock{clock ? std::move(clock)
+                    : std::make_shared<HybridLogicalClock>()} {
+    if (this->storage && this->storage->get_config().value_cache_size > 0) {
+      cache = std::make_unique<ValueCache>(
+          this->storage->get_config().value_cache_size);
+    }
     if (open) kvs_open = this->open();
   }
 
   auto open() -> bool;
 
-  auto get(const std::string& key, std::string& result) -> bool;
+  /**
+   * Reads the value of key. Keys whose time to live passed are not found. If
+   * info is set, the time to live and version of the value are stored there.
+   * With a timestamp other than 0, key is read as of that timestamp, i.e.,
+   * all writes versioned up to timestamp are visible and none after it.
+   */
+  auto get(const std::string& key, std::string& result,
+           ValueInfo* info = nullptr, uint64_t timestamp = 0) -> bool;
 
-  auto get_all(std::vector<std::pair<std::string, std::string>>& buffer)
+  /**
+   * Reads all keys that did not expire yet. If ttls is set, the remaining time
+   * to live of every key (in seconds, 0 = no expiry) is stored there.
+   */
+  auto get_all(std::vector<std::pair<std::string, std::string>>& buffer,
+               std::vector<uint64_t>* ttls = nullptr) -> bool;
+
+  /**
+   * Stores value under key. With a ttl (in seconds) other than 0, the key
+   * expires after that time.
+   */
+  auto put(const std::string& key, const std::string& value,
+           Durability durability = Durability::BUFFERED, uint64_t ttl = 0)
       -> bool;
 
-  auto put(const std::string& key, const std::string& value) -> bool;
+  auto remove(const std::string& key,
+              Durability durability = Durability::BUFFERED) -> bool;
+
+  /**
+   * Applies all writes atomically, i.e., either all or none of them become
+   * visible.
+   */
+  auto write(const std::vector<Write>& writes,
+             Durability durability = Durability::BUFFERED) -> bool;
+
+  /**
+   * Atomically replaces the value of key with desired if it currently equals
+   * expected (a missing key equals the empty string). current is set to the
+   * value of key after the operation. With a ttl other than 0 the swapped
+   * value expires after ttl seconds, otherwise the expiry of key is kept.
+   *
+   * @return  true if the value was swapped
+   */
+  auto compare_and_swap(const std::string& key, const std::string& expected,
+                        const std::string& desired, std::string& current,
+                        Durability durability = Durability::BUFFERED,
+                        uint64_t ttl = 0) -> bool;
 
-  auto remove(const std::string& key) -> bool;
+  /**
+   * Atomically adds delta to the integer stored under key (a missing key
+   * counts as 0) and stores the sum in result.
+   *
+   * @return  false if the value of key is not an integer or the sum
+   *          overflows
+   */
+  auto increment(const std::string& key, int64_t delta, int64_t& result,
+                 Durability durability = Durability::BUFFERED) -> bool;
 
+  /**
+   * Atomically appends suffix to the value of key (a missing key counts as
+   * empty) and stores the new value in result.
+   */
+  auto append(const std::string& key, const std::string& suffix,
+              std::string& result,
+              Durability durability = Durability::BUFFERED) -> bool;
+
+  /**
+   * Closes and deletes the database. Later operations fail.
+   */
   auto clear() -> bool;
+
+  /**
+   * Reads an integer property of rocksdb, e.g., "rocksdb.estimate-num-keys".
+   *
+   * @return  false if the property is unknown or the KVS was not opened yet
+   */
+  auto get_property(const std::string& property, uint64_t& value) -> bool;
  ~KVS();
  private:
+  static auto write_options(Durability durability) -> rocksdb::WriteOptions;
+
+  /**
+   * Versions the next write. Keeps a snapshot of the state before the write
+   * for reads at older timestamps. The exclusive lock must be held.
+   */
+  auto next_version() -> uint64_t;
+
+  /**
+   * Snapshot to read at timestamp, nullptr to read the latest state. The
+   * shared lock must be held.
+   *
+   * @return  false if there is no snapshot that old anymore
+   */
+  auto snapshot_at(uint64_t timestamp, const rocksdb::Snapshot*& snapshot)
+      -> bool;
+
+  auto release_snapshots() -> void;
+
+  /**
+   * Read-modify-write of key while holding the exclusive lock. modify gets the
+   * current value (nullptr if key is missing) and returns false to leave key
+   * unchanged. The expiry of key is kept unless ttl is set.
+   */
+  auto update(
+      const std::string& key, Durability durability, uint64_t ttl,
+      const std::function<bool(const std::string*, std::string&)>& modify)
+      -> bool;
+
+  /**
+   * Called after a write returned from rocksdb and the exclusive lock was
+   * released. Waits for the group commit of seq or triggers a periodic flush
+   * for writes that bypassed the WAL.
+   */
+  auto after_write(Durability durability, uint64_t seq) -> bool;
+
   std::filesystem::path path;
   rocksdb::DB* db{};
   bool kvs_open;
 
+  std::shared_ptr<const StorageProfile> storage;
+
+  std::shared_ptr<HybridLogicalClock> clock;
+
+  // version of the latest write
+  uint64_t latest_version{0};
+
+  // a snapshot of the state before every recent write, oldest first
+  struct VersionedSnapshot {
+    // latest version contained in the snapshot
+    uint64_t version;
+    // time the snapshot was taken (ms since epoch)
+    uint64_t taken_at;
+    const rocksdb::Snapshot* snapshot;
+  };
+  std::deque<VersionedSnapshot> snapshots{};
+
+  // time of the latest read at a timestamp (ms since epoch), writes only take
+  // snapshots while there are such reads
+  std::atomic<uint64_t> last_snapshot_read{0};
+
+  // reads fill the cache while holding the shared lock, writes invalidate it
+  // while holding the exclusive lock
+  std::unique_ptr<ValueCache> cache{};
+
+  // group commit: writes are numbered, the first waiting writer becomes the
+  // leader and fsyncs the WAL once for everything written up to then
+  std::mutex commit_mtx{};
+  std::condition_variable commit_cond{};
+  uint64_t written{0};
+  uint64_t synced{0};
+  bool syncing{false};
+
+  // time of the last flush triggered by ASYNC writes (ms since epoch)
+  std::atomic<int64_t> last_flush{0};
+
   // we use a readers-writer lock s.t. multiple threads may read at the same
   // time while only one thread may modify data in the KVS
   std::shared_timed_mutex mtx{};
@@ -0,0 +1,204 @@
+#ifndef CLOUDLAB_METRICS_HH
+#define CLOUDLAB_METRICS_HH
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace cloudlab {
+
+// counters and histograms are split into this many cache line aligned shards,
+// every thread updates the shard it was assigned to on first use
+const auto metric_shards = 8;
+
+using Labels = std::vector<std::pair<std::string, std::string>>;
+
+/**
+ * Shard of the calling thread.
+ */
+auto metric_shard() -> size_t;
+
+/**
+ * A monotonically increasing counter. Updates are relaxed atomic additions to
+ * the shard of the calling thread, reads sum up all shards.
+ */
+class Counter {
+ public:
+  auto add(uint64_t n = 1) -> void {
+    shards[metric_shard()].value.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] auto value() const -> uint64_t;
+
+ private:
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> value{0};
+  };
+
+  std::array<Shard, metric_shards> shards{};
+};
+
+/**
+ * A histogram of non-negative integers (e.g., latencies in microseconds) with
+ * log-linear buckets in the style of HDR histograms: values below 16 are
+ * counted exactly, larger values in 16 buckets per power of two, s.t. every
+ * recorded value is known with a relative error of at most 1/16.
+ */
+class Histogram {
+ public:
+  static constexpr auto sub_bucket_bits = 4;
+  static constexpr auto sub_buckets = 1 << sub_bucket_bits;
+  static constexpr auto num_buckets = sub_buckets * (64 - sub_bucket_bits + 1);
+
+  Histogram() = default;
+  Histogram(const Histogram&) = delete;
+  Histogram& operator=(const Histogram&) = delete;
+  ~Histogram();
+
+  /**
+   * The shards of a histogram merged at one point in time.
+   */
+  struct Snapshot {
+    uint64_t count{0};
+    uint64_t sum{0};
+    uint64_t max{0};
+    std::vector<uint64_t> buckets = std::vector<uint64_t>(num_buckets);
+
+    /**
+     * Highest value of the bucket that holds the q-quantile, 0 <= q <= 1.
+     */
+    [[nodiscard]] auto percentile(double q) const -> uint64_t;
+  };
+
+  auto record(uint64_t value) -> void;
+
+  auto record(std::chrono::steady_clock::duration latency) -> void {
+    record(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(latency)
+            .count()));
+  }
+
+  [[nodiscard]] auto snapshot() const -> Snapshot;
+
+  static auto bucket(uint64_t value) -> size_t;
+
+  /**
+   * Highest value that is counted in bucket.
+   */
+  static auto highest_value(size_t bucket) -> uint64_t;
+
+ private:
+  struct alignas(64) Shard {
+    std::array<std::atomic<uint64_t>, num_buckets> buckets{};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+  };
+
+  // allocated lazily s.t. unused shards do not take memory
+  std::array<std::atomic<Shard*>, metric_shards> shards{};
+
+  auto shard() -> Shard&;
+};
+
+/**
+ * Named metrics of the process. Metrics are created (and looked up) under a
+ * lock, callers keep the returned references s.t. updates are lock-free.
+ * Metrics live as long as the process.
+ */
+class MetricsRegistry {
+ public:
+  auto counter(const std::string& name, const std::string& help,
+               const Labels& labels = {}) -> Counter&;
+
+  auto histogram(const std::string& name, const std::string& help,
+                 const Labels& labels = {}) -> Histogram&;
+
+  /**
+   * Registers a metric that is read by calling read. Registering the same
+   * name and labels again replaces the function.
+   */
+  auto gauge(const std::string& name, const std::string& help,
+             std::function<int64_t()> read, const Labels& labels = {})
+      -> void;
+
+  /**
+   * Current values of all metrics as "name{labels}" -> value pairs, the way
+   * STATS reports them. Histograms are reported as summaries: count, sum, max
+   * and the 50th, 90th, 99th and 99.9th percentiles.
+   */
+  auto samples() -> std::vector<std::pair<std::string, std::string>>;
+
+  /**
+   * All metrics in the Prometheus text exposition format.
+   */
+  auto prometheus() -> std::string;
+
+ private:
+  // monostate until the metric was created
+  using Metric = std::variant<std::monostate, std::unique_ptr<Counter>,
+                              std::unique_ptr<Histogram>,
+                              std::function<int64_t()>>;
+
+  struct Family {
+    // counter, summary or gauge
+    std::string type;
+    std::string help;
+    // [rendered labels -> metric]
+    std::map<std::string, Metric> metrics{};
+  };
+
+  auto find(const std::string& name, const std::string& type,
+            const std::string& help, const Labels& labels) -> Metric&;
+
+  /**
+   * Calls on_family for every family and on_sample for each of its samples,
+   * including the maximum of histograms if with_max is set. mtx must be held.
+   */
+  auto visit(const std::function<void(const std::string& name,
+                                      const Family& family)>& on_family,
+             const std::function<void(const std::string& sample,
+                                      const std::string& value)>& on_sample,
+             bool with_max) -> void;
+
+  std::map<std::string, Family> families{};
+  std::mutex mtx{};
+};
+
+/**
+ * The registry of the process.
+ */
+auto metrics() -> MetricsRegistry&;
+
+/**
+ * Latency histograms of the operations of a handler, one per operation,
+ * created on first use.
+ */
+class OperationMetrics {
+ public:
+  // operations are identified by their (small) number in cloud.proto
+  static constexpr auto max_operations = 64;
+
+  explicit OperationMetrics(std::string handler)
+      : handler{std::move(handler)} {
+  }
+
+  auto record(int operation, const std::string& name,
+              std::chrono::steady_clock::duration latency) -> void;
+
+ private:
+  const std::string handler;
+  std::array<std::atomic<Histogram*>, max_operations> histograms{};
+};
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_METRICS_HH
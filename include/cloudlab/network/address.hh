@@ -4,15 +4,25 @@
 #include <array>
 #include <string>
 
+#include <sys/socket.h>
+
+struct sockaddr_un;
+
 namespace cloudlab {
 
 enum class IPAddressType {
   V4,
-  V6
+  V6,
+  // Unix domain socket, for processes on the same host
+  UNIX
 };
 
+// prefix of Unix domain socket addresses, e.g., unix:/tmp/router.sock
+const auto unix_address_prefix = "unix:";
+
 /**
- * Representation of an IPv4 / IPv6 address plus port.
+ * Representation of an IPv4 / IPv6 address plus port, or of the path of a
+ * Unix domain socket.
  */
 class SocketAddress {
  public:
@@ -35,12 +45,28 @@ class SocketAddress {
     return port;
   }
 
+  [[nodiscard]] auto is_unix() const -> bool {
+    return type == IPAddressType::UNIX;
+  }
+
+  [[nodiscard]] auto get_path() const -> std::string const& {
+    return ip_address;
+  }
+
+  /**
+   * Fills address with the path of a Unix domain socket address.
+   *
+   * @return  the length of address to pass to bind() and connect()
+   */
+  auto unix_address(struct sockaddr_un& address) const -> socklen_t;
+
   auto string() const -> std::string;
 
  private:
   IPAddressType type;
+  // the path of Unix domain sockets
   std::string ip_address;
-  uint16_t port;
+  uint16_t port{0};
 };
 
 }  // namespace cloudlab
@@ -0,0 +1,94 @@
+#ifndef CLOUDLAB_ADMISSION_HH
+#define CLOUDLAB_ADMISSION_HH
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace cloudlab {
+
+/**
+ * Limits of a server. Every connection has at most one request in flight (its
+ * read events are disabled while a worker handles it), so at most
+ * queue_capacity + num_workers requests are in flight globally.
+ */
+struct AdmissionConfig {
+  // requests waiting for a worker, further requests are answered with BUSY
+  size_t queue_capacity{1024};
+
+  // open connections, further connections are closed right away
+  size_t max_connections{1024};
+
+  // queueing delay that is acceptable while the server is overloaded
+  std::chrono::microseconds target{5000};
+
+  // window in which the queueing delay must have dropped below target once,
+  // otherwise the server counts as overloaded
+  std::chrono::microseconds interval{100000};
+};
+
+/**
+ * Queue-time-based load shedding in the style of CoDel. As long as the
+ * queueing delay regularly drops below the target, only requests that waited
+ * longer than a full interval are shed. Once the minimum delay within an
+ * interval exceeds the target, a standing queue has formed and every request
+ * that waited longer than the target is shed until the queue drained, s.t.
+ * the remaining requests see a bounded delay.
+ */
+class LoadShedder {
+ public:
+  explicit LoadShedder(const AdmissionConfig& config)
+      : target{config.target}, interval{config.interval} {
+  }
+
+  /**
+   * Called when a worker dequeues a request that waited for sojourn.
+   *
+   * @return  true if the request should be shed
+   */
+  auto should_shed(std::chrono::steady_clock::duration sojourn,
+                   std::chrono::steady_clock::time_point now) -> bool;
+
+  [[nodiscard]] auto is_overloaded() const -> bool {
+    return overloaded.load();
+  }
+
+ private:
+  const std::chrono::steady_clock::duration target;
+  const std::chrono::steady_clock::duration interval;
+
+  std::chrono::steady_clock::time_point interval_end{};
+  std::chrono::steady_clock::duration min_sojourn{
+      std::chrono::steady_clock::duration::max()};
+  std::atomic<bool> overloaded{false};
+  std::mutex mtx{};
+};
+
+/**
+ * Counters of a server.
+ */
+struct ServerMetrics {
+  // requests waiting for a worker
+  std::atomic<uint64_t> queue_depth{0};
+  // requests handled by a worker right now
+  std::atomic<uint64_t> in_flight{0};
+  std::atomic<uint64_t> connections{0};
+  std::atomic<uint64_t> rejected_connections{0};
+  std::atomic<uint64_t> shed_queue_full{0};
+  std::atomic<uint64_t> shed_queue_time{0};
+};
+
+/**
+ * Makes the metrics of a server visible to STATS and the metrics endpoint of
+ * the process as gauges labeled with the server's name.
+ */
+auto register_server_metrics(const std::string& name,
+                             std::shared_ptr<const ServerMetrics> metrics)
+    -> void;
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_ADMISSION_HH
@@ -0,0 +1,67 @@
+#ifndef CLOUDLAB_COMPRESSION_HH
+#define CLOUDLAB_COMPRESSION_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace cloudlab {
+
+/**
+ * Frames of connections with compression enabled (see
+ * Connection::set_compression) carry two more flags in their length word:
+ * the sender accepts compressed frames, and the payload is compressed. A
+ * compressed payload is the size of the original payload (4 bytes, network
+ * byte order) followed by a zlib stream of it.
+ */
+const uint32_t compressed_frame = 0x40000000;
+
+const uint32_t accepts_compression = 0x20000000;
+
+/**
+ * Compression settings of the process, the same for all connections.
+ */
+struct CompressionConfig {
+  // payloads smaller than this are sent uncompressed, compressing them costs
+  // more latency than the saved bytes are worth
+  size_t threshold{4096};
+
+  // zlib compression level, 1 (fastest) to 9 (smallest)
+  int level{1};
+
+  // preset dictionary, e.g., typical keys and values of small-value
+  // workloads. Peers must use the same dictionary, zlib refuses to decompress
+  // streams compressed with a different one.
+  std::string dictionary{};
+
+  /**
+   * Reads the preset dictionary from a file, zlib uses at most its last
+   * 32 KiB.
+   */
+  auto load_dictionary(const std::string& path) -> void;
+};
+
+auto set_compression_config(CompressionConfig config) -> void;
+
+auto compression_config() -> const CompressionConfig&;
+
+/**
+ * Compresses size bytes at data into a payload of a compressed frame.
+ *
+ * @return  false if compression failed or did not make the payload smaller
+ */
+auto compress_payload(const uint8_t* data, size_t size, std::string& payload)
+    -> bool;
+
+/**
+ * Decompresses the payload of a compressed frame into message.
+ *
+ * @return  false if the payload is corrupt, exceeds max_message_size or was
+ *          compressed with an unknown dictionary
+ */
+auto decompress_payload(const uint8_t* data, size_t size, std::string& message)
+    -> bool;
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_COMPRESSION_HH
@@ -2,6 +2,12 @@
 #define CLOUDLAB_CONNECTION_HH
 
 #include "cloudlab/network/address.hh"
+#include "cloudlab/task.hh"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
 
 namespace cloud {
 class CloudMessage;
@@ -9,7 +15,28 @@ class CloudMessage;
 
 namespace cloudlab {
 
-const auto max_message_size = 4096;
+// upper bound for the size of a single message, STATS responses carry all
+// metrics of a process
+const auto max_message_size = 1 << 20;
+
+/**
+ * A request that a server read off a connection already, e.g., by the
+ * io_uring backend. The handler receives the frame and its responses are
+ * buffered until complete hands them back to the server.
+ */
+struct BufferedRequest {
+  uint64_t connection{};
+
+  // the whole frame, including its length word
+  std::string frame{};
+  bool received{false};
+
+  // frames to send, in order
+  std::vector<std::string> responses{};
+
+  void (*complete)(BufferedRequest* request, void* context){nullptr};
+  void* context{nullptr};
+};
 
 /**
  * Representation of a (TCP) network connection.
@@ -24,17 +51,136 @@ class Connection {
 
   explicit Connection(void* bev) : bev{bev} {};
 
+  explicit Connection(BufferedRequest* buffered) : buffered{buffered} {};
+
   ~Connection();
 
+  /**
+   * Connects to address without blocking the event loop of the calling
+   * thread, other coroutines run until the peer accepted the connection.
+   * Threads without an event loop wait with a blocking poll() instead.
+   *
+   * @param deadline  ms since epoch, 0 for none. Also bounds the sends and
+   *                  receives on the connection (see set_deadline).
+   * @return          the connection, with connect_failed set if the peer
+   *                  could not be reached in time
+   */
+  static auto async_connect(const SocketAddress& address, uint64_t deadline)
+      -> Task<std::unique_ptr<Connection>>;
+
   auto receive(cloud::CloudMessage& msg) const -> bool;
 
   auto send(const cloud::CloudMessage& msg) const -> bool;
 
+  /**
+   * Like receive, but waits for the peer on the event loop of the calling
+   * thread (see EventLoop) s.t. other coroutines run meanwhile. The
+   * connection must outlive the task.
+   */
+  auto async_receive(cloud::CloudMessage& msg) const -> Task<bool>;
+
+  /**
+   * Like send, but waits for a full socket buffer on the event loop of the
+   * calling thread.
+   */
+  auto async_send(const cloud::CloudMessage& msg) const -> Task<bool>;
+
+  /**
+   * Bounds blocking sends and receives by the time left until deadline (ms
+   * since epoch), s.t. an unresponsive peer cannot block the caller forever.
+   *
+   * @return  false if the deadline passed already
+   */
+  auto set_deadline(uint64_t deadline) const -> bool;
+
+  /**
+   * Parses the next message without consuming it. Only supported for
+   * connections accepted by a server and buffered requests.
+   */
+  auto peek(cloud::CloudMessage& msg) const -> bool;
+
+  /**
+   * Reads the operation of the next message without parsing or consuming
+   * it, e.g., to pick the thread that handles it. Supported like peek.
+   */
+  auto peek_operation(int& operation) const -> bool;
+
+  /**
+   * @return  true if the next message arrived completely s.t. receiving it
+   *          does not block, or if its length word is invalid
+   */
+  [[nodiscard]] auto has_message() const -> bool;
+
+  [[nodiscard]] auto get_fd() const -> int {
+    return fd;
+  }
+
+  /**
+   * Sends key operations in the compact binary format (see wire.hh) instead
+   * of protobuf, other messages are always sent as protobuf. Only enable it
+   * for peers that understand the format. A connection that received a
+   * compact message answers in the compact format as well.
+   */
+  auto set_compact(bool enabled) -> void {
+    compact = enabled;
+  }
+
+  [[nodiscard]] auto is_compact() const -> bool {
+    return compact;
+  }
+
+  /**
+   * Compresses messages that exceed the threshold of the compression config
+   * (see compression.hh) and tells the peer that compressed responses are
+   * welcome. A connection that received a message from such a peer
+   * compresses its answers as well.
+   */
+  auto set_compression(bool enabled) -> void {
+    compression = enabled;
+  }
+
+  [[nodiscard]] auto is_compressing() const -> bool {
+    return compression;
+  }
+
   bool connect_failed{false};
 
  private:
+  Connection() = default;
+
+  /**
+   * Creates the socket and starts to connect.
+   *
+   * @param nonblocking  return right away instead of waiting for the peer
+   * @return             false if the connect failed, true if it succeeded
+   *                     or is in progress
+   */
+  auto open(const SocketAddress& address, bool nonblocking) -> bool;
+
+  /**
+   * Serializes msg in the format of the connection into payload.
+   *
+   * @return  the length word of the frame, in network byte order
+   */
+  auto encode(const cloud::CloudMessage& msg, std::string& payload) const
+      -> uint32_t;
+
+  /**
+   * Parses the payload of a received frame.
+   */
+  auto decode(cloud::CloudMessage& msg, const uint8_t* payload, uint32_t size,
+              uint32_t flags) const -> bool;
+
+  auto async_read(void* buf, size_t size) const -> Task<bool>;
+
   int fd{-1};
   void* bev{nullptr};
+  BufferedRequest* buffered{nullptr};
+  mutable bool compact{false};
+  mutable bool compression{false};
+
+  // set by set_deadline, bounds the waits of async_send and async_receive
+  mutable uint64_t deadline{0};
 };
 
 }  // namespace cloudlab
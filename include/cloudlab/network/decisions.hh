@@ -0,0 +1,86 @@
+#ifndef CLOUDLAB_DECISIONS_HH
+#define CLOUDLAB_DECISIONS_HH
+
+#include "cloudlab/metrics.hh"
+#include "cloudlab/network/address.hh"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cloudlab {
+
+// pause before the first resend of a decision, doubled after every attempt
+const auto decision_retry_interval = std::chrono::milliseconds(100);
+
+// longest pause between two resends of a decision
+const auto decision_max_backoff = std::chrono::seconds(5);
+
+// time a participant has to answer a resent decision (ms)
+const auto decision_ack_timeout_ms = 2000;
+
+/**
+ * Delivers the COMMIT or ABORT decisions of two-phase commits that did not
+ * reach a participant. A participant keeps a prepared transaction and its
+ * locks until it learns the decision, so a background thread sends it again,
+ * with exponential backoff, until the participant answered.
+ *
+ * Any answer ends the resends: a participant that does not know the
+ * transaction (anymore) applied the decision already, e.g., when only its
+ * answer to an earlier attempt got lost.
+ */
+class DecisionChannel {
+ public:
+  DecisionChannel();
+
+  DecisionChannel(const DecisionChannel&) = delete;
+  DecisionChannel& operator=(const DecisionChannel&) = delete;
+
+  /**
+   * Stops the background thread, decisions that are still queued are lost.
+   */
+  ~DecisionChannel();
+
+  /**
+   * Queues the decision of transaction_id for peer.
+   *
+   * @param commit  true for TXN_COMMIT, false for TXN_ABORT
+   */
+  auto resend(const SocketAddress& peer, uint64_t transaction_id, bool commit)
+      -> void;
+
+ private:
+  struct Decision {
+    SocketAddress peer;
+    uint64_t transaction_id;
+    bool commit;
+    std::chrono::steady_clock::time_point due;
+    std::chrono::milliseconds backoff;
+  };
+
+  auto run() -> void;
+
+  /**
+   * @return  true if the participant answered
+   */
+  static auto deliver(const Decision& decision) -> bool;
+
+  // queued decisions, in no particular order
+  std::vector<Decision> pending{};
+
+  std::mutex mtx{};
+  std::condition_variable cond{};
+  bool stopped{false};
+
+  Counter& resends;
+  Counter& delivered;
+
+  std::thread worker{};
+};
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_DECISIONS_HH
@@ -0,0 +1,127 @@
+#ifndef CLOUDLAB_EVENT_LOOP_HH
+#define CLOUDLAB_EVENT_LOOP_HH
+
+#include "cloudlab/tracing.hh"
+
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+
+namespace cloudlab {
+
+/**
+ * The libevent loop of a server thread, on which coroutine handlers (see
+ * ServerHandler::handle_connection_async) wait for sockets instead of
+ * blocking the thread.
+ */
+class EventLoop {
+ public:
+  /**
+   * Awaits that a socket becomes readable or writable. Threads without an
+   * event loop, e.g., server workers, wait with a blocking poll() instead.
+   * Resumes with false if the deadline (ms since epoch, 0 for none) passed
+   * first.
+   */
+  class Readiness {
+   public:
+    Readiness(int fd, bool write, uint64_t deadline)
+        : fd{fd}, write{write}, deadline{deadline} {
+    }
+
+    [[nodiscard]] auto await_ready() const noexcept -> bool {
+      return false;
+    }
+
+    auto await_suspend(std::coroutine_handle<> handle) -> bool;
+
+    auto await_resume() -> bool;
+
+   private:
+    static auto resume(int fd, short events, void* arg) -> void;
+
+    int fd;
+    bool write;
+    uint64_t deadline;
+    bool ready{false};
+    std::coroutine_handle<> handle{};
+
+    // the span of the coroutine, other coroutines run meanwhile
+    TraceContext span{};
+  };
+
+  /**
+   * Awaits that the first of up to two sockets becomes readable, e.g., the
+   * responses of a request and of its hedge. Unlike Readiness, the timeout
+   * has microsecond resolution and the events of the other sockets are
+   * cancelled once one fired. Resumes with the index of a readable socket,
+   * -1 if the timeout passed first.
+   */
+  class AnyReadable {
+   public:
+    AnyReadable(std::array<int, 2> fds, size_t count,
+                std::chrono::microseconds timeout)
+        : fds{fds}, count{count}, timeout{timeout} {
+    }
+
+    AnyReadable(const AnyReadable&) = delete;
+    AnyReadable& operator=(const AnyReadable&) = delete;
+
+    ~AnyReadable();
+
+    [[nodiscard]] auto await_ready() const noexcept -> bool {
+      return false;
+    }
+
+    auto await_suspend(std::coroutine_handle<> handle) -> bool;
+
+    auto await_resume() -> int;
+
+   private:
+    static auto resume(int fd, short events, void* arg) -> void;
+
+    std::array<int, 2> fds;
+    size_t count;
+    std::chrono::microseconds timeout;
+    int result{-1};
+    std::array<void*, 2> events{};
+    std::coroutine_handle<> handle{};
+    TraceContext span{};
+  };
+
+  /**
+   * @param base  the event_base of the calling thread
+   */
+  explicit EventLoop(void* base);
+
+  EventLoop(const EventLoop&) = delete;
+  EventLoop& operator=(const EventLoop&) = delete;
+
+  ~EventLoop();
+
+  /**
+   * @return  the event loop of the calling thread, nullptr if it has none
+   */
+  static auto current() -> EventLoop*;
+
+  static auto wait(int fd, bool write, uint64_t deadline) -> Readiness {
+    return {fd, write, deadline};
+  }
+
+  static auto wait_readable(int fd, std::chrono::microseconds timeout)
+      -> AnyReadable {
+    return {{fd, -1}, 1, timeout};
+  }
+
+  static auto wait_readable(int first, int second,
+                            std::chrono::microseconds timeout) -> AnyReadable {
+    return {{first, second}, 2, timeout};
+  }
+
+ private:
+  void* base;
+};
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_EVENT_LOOP_HH
@@ -0,0 +1,103 @@
+#ifndef CLOUDLAB_METADATA_HH
+#define CLOUDLAB_METADATA_HH
+
+#include "cloudlab/metrics.hh"
+#include "cloudlab/network/address.hh"
+#include "cloudlab/network/connection.hh"
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace cloudlab {
+
+// pause before a batch that the router did not acknowledge is sent again
+const auto metadata_retry_interval = std::chrono::milliseconds(100);
+
+// time the router has to acknowledge a batch (ms)
+const auto metadata_ack_timeout_ms = 2000;
+
+/**
+ * Reports the partitions that a peer added or dropped to the router. Instead
+ * of a connection and a round trip per change, updates are queued and a
+ * background thread sends them as PARTITIONS_CHANGED batches over one
+ * persistent connection. Updates that are queued while a batch is in flight
+ * are coalesced into the next one.
+ *
+ * Batches carry increasing sequence numbers and are sent again with the same
+ * number until the router acknowledged them, s.t. the router applies every
+ * batch exactly once. Callers that depend on an update pass the sequence
+ * number on to the router as a barrier (see CloudMessage.barrier).
+ */
+class MetadataChannel {
+ public:
+  /**
+   * @param sender  address of the peer the updates belong to
+   * @param router  cluster address of the router, nothing is sent without it
+   */
+  MetadataChannel(std::string sender, std::optional<SocketAddress> router);
+
+  MetadataChannel(const MetadataChannel&) = delete;
+  MetadataChannel& operator=(const MetadataChannel&) = delete;
+
+  /**
+   * Sends the queued updates and stops the background thread.
+   */
+  ~MetadataChannel();
+
+  /**
+   * Queues that peer added (or, if removed is set, dropped) partition. A
+   * queued update of the same partition and peer is replaced.
+   *
+   * @return  the sequence number of the batch that carries the update, 0 if
+   *          the channel has no router
+   */
+  auto publish(uint32_t partition, const std::string& peer, bool removed)
+      -> uint64_t;
+
+  [[nodiscard]] auto get_sender() const -> const std::string& {
+    return sender;
+  }
+
+ private:
+  auto run() -> void;
+
+  /**
+   * Sends a batch and waits for the acknowledgement, reconnects on the next
+   * call if that fails.
+   *
+   * @return  true if the router applied the batch
+   */
+  auto deliver(const cloud::CloudMessage& batch) -> bool;
+
+  const std::string sender;
+  const std::optional<SocketAddress> router;
+
+  // only used by the background thread
+  std::unique_ptr<Connection> connection{};
+
+  // queued updates: [(partition ID, peer) -> removed]
+  std::map<std::pair<uint32_t, std::string>, bool> pending{};
+
+  // sequence number of the batch that carries the queued updates
+  uint64_t next_sequence;
+
+  std::mutex mtx{};
+  std::condition_variable cond{};
+  bool stopped{false};
+
+  Counter& batches;
+  Counter& resends;
+
+  std::thread worker{};
+};
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_METADATA_HH
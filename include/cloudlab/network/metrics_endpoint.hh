@@ -0,0 +1,20 @@
+#ifndef CLOUDLAB_METRICS_ENDPOINT_HH
+#define CLOUDLAB_METRICS_ENDPOINT_HH
+
+#include <string>
+#include <thread>
+
+namespace cloudlab {
+
+/**
+ * Serves the metrics of the process in the Prometheus text format over HTTP
+ * on address. Every request is answered with all metrics regardless of its
+ * path, one connection at a time.
+ *
+ * @return  handle of the thread that serves the endpoint
+ */
+auto serve_metrics(const std::string& address) -> std::thread;
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_METRICS_ENDPOINT_HH
@@ -60,6 +60,17 @@ namespace cloudlab {
             return {};
         }
 
+        /**
+         * All peers that store the partition of key, the first one is the
+         * one requests are sent to by default.
+         */
+        auto find_peers(const std::string &key) -> std::vector<SocketAddress> {
+            if (partitions == 0) return {};
+            auto search = table.find(get_partition(key));
+            if (search != table.end()) return search->second;
+            return {};
+        }
+
         auto get_partition(const std::string &key) const -> uint32_t {
             uint64_t part = 0;
             uint64_t multiplier = 1 % cluster_partitions;
@@ -2,9 +2,14 @@
 #define CLOUDLAB_SERVER_HH
 
 #include "cloudlab/handler/handler.hh"
+#include "cloudlab/metrics.hh"
+#include "cloudlab/network/admission.hh"
 #include "cloudlab/spmc.hh"
 
 #include <array>
+#include <chrono>
+#include <memory>
+#include <string>
 #include <thread>
 #include <unistd.h>
 
@@ -12,13 +17,39 @@ namespace cloudlab {
 
 const auto num_workers = 4;
 
+/**
+ * Event loop that accepts connections and reads requests. Both hand requests
+ * to the same workers and handlers, only the I/O differs.
+ */
+enum class ServerBackend {
+  // bufferevents, the workers read and write the sockets themselves
+  LIBEVENT,
+
+  // a single io_uring with multishot accept and receive into a provided
+  // buffer ring, responses are buffered and sent by the ring's thread in
+  // batches
+  IO_URING,
+};
+
+/**
+ * Parses "libevent" or "io_uring".
+ */
+auto parse_server_backend(const std::string& name) -> ServerBackend;
+
 /**
  * A (TCP) network server class.
  */
 class Server {
  public:
-  Server(std::string address, ServerHandler& handler)
-      : address{std::move(address)}, handler{handler} {
+  Server(std::string address, ServerHandler& handler,
+         AdmissionConfig config = {},
+         ServerBackend backend = ServerBackend::LIBEVENT)
+      : address{std::move(address)},
+        backend{backend},
+        admission{this->address, config},
+        bev_queue{config.queue_capacity},
+        handler{handler} {
+    register_server_metrics(this->address, admission.metrics);
   }
 
   Server(const Server&) = delete;
@@ -32,19 +63,70 @@ class Server {
     }
   }
 
+  /**
+   * Starts the workers and the event loop. Setting up the io_uring backend
+   * fails right away if the kernel does not support it.
+   */
   auto run() -> std::thread;
 
  private:
-  static auto server(const std::string& address, SPMCQueue<void*>& bev_queue)
-      -> void;
+  // a connection with a request that waits for a worker, either a
+  // bufferevent or a request that the io_uring backend read already
+  struct Request {
+    void* bev;
+    std::chrono::steady_clock::time_point enqueued_at;
+    BufferedRequest* buffered{nullptr};
+  };
 
-  static auto worker(ServerHandler& handler, SPMCQueue<void*>& bev_queue)
-      -> void;
+  struct Admission {
+    Admission(const std::string& address, const AdmissionConfig& config)
+        : config{config},
+          shedder{config},
+          queue_wait{cloudlab::metrics().histogram(
+              "cloudlab_server_queue_wait_us",
+              "Time requests waited for a worker in microseconds",
+              {{"server", address}})} {
+    }
+
+    const AdmissionConfig config;
+    LoadShedder shedder;
+    std::shared_ptr<ServerMetrics> metrics{std::make_shared<ServerMetrics>()};
+    Histogram& queue_wait;
+  };
+
+  static auto server(const std::string& address, SPMCQueue<Request>& bev_queue,
+                     Admission& admission, ServerHandler& handler) -> void;
+
+  // event loop of the io_uring backend, see uring.cc
+  class UringLoop;
+
+  /**
+   * Answers the pending request of a connection with BUSY. Requests that
+   * manage the cluster or ask for metrics are never shed.
+   *
+   * @return  false if the request must be handled
+   */
+  static auto shed(Connection& con) -> bool;
+
+  /**
+   * Sets up the listening socket and the ring in the calling thread.
+   *
+   * @return  the thread of the event loop
+   */
+  static auto uring_server(const std::string& address,
+                           SPMCQueue<Request>& bev_queue, Admission& admission)
+      -> std::thread;
+
+  static auto worker(ServerHandler& handler, SPMCQueue<Request>& bev_queue,
+                     Admission& admission) -> void;
 
   const std::string address;
+  const ServerBackend backend;
+
+  Admission admission;
 
   std::array<std::thread, num_workers> workers;
-  SPMCQueue<void*> bev_queue{};
+  SPMCQueue<Request> bev_queue;
 
   ServerHandler& handler;
 };
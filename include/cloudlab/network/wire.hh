@@ -0,0 +1,131 @@
+#ifndef CLOUDLAB_WIRE_HH
+#define CLOUDLAB_WIRE_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace cloud {
+class CloudMessage;
+}
+
+namespace cloudlab {
+
+/**
+ * Compact binary format for key operations (PUT, GET, DELETE and the atomic
+ * read-modify-write operations), an alternative to protobuf for small
+ * requests. Frames are length-prefixed like protobuf frames but set the
+ * highest bit of the length word. The payload starts with a fixed header:
+ *
+ *   0     version (compact_version)
+ *   1     type (bits 0-1), success (bit 2)
+ *   2     operation
+ *   3     durability
+ *   4     status: index into the well-known messages ("OK", "ERROR", ...),
+ *         compact_custom_status if the message follows as a string
+ *   5     present fields: timestamp (bit 0), deadline (bit 1), trace (bit 2)
+ *   6-7   number of key-value pairs (little endian)
+ *
+ * followed by the present fields as varints (trace_id and span_id for the
+ * trace), the custom message and the key-value pairs. A pair starts with a
+ * byte of present fields: ttl (bit 0), version (bit 1), expected (bit 2),
+ * then the key and the value, and the present fields. Strings are a varint
+ * length followed by the bytes.
+ */
+
+// set in the length word of frames in the compact format
+const uint32_t compact_frame = 0x80000000;
+
+const uint8_t compact_version = 1;
+
+const auto compact_header_size = 8;
+
+const uint8_t compact_custom_status = 0xff;
+
+/**
+ * A key-value pair of a compact message, pointing into the frame.
+ */
+struct CompactKeyValue {
+  std::string_view key{};
+  std::string_view value{};
+  uint64_t ttl{0};
+  uint64_t version{0};
+  std::optional<std::string_view> expected{};
+};
+
+/**
+ * A message in the compact format, decoded in place: strings point into the
+ * frame, which must outlive the message. Neither parsing nor iterating the
+ * key-value pairs allocates.
+ */
+class CompactMessage {
+ public:
+  /**
+   * Parses the header of frame (without the length word) and validates that
+   * all key-value pairs are well-formed.
+   *
+   * @return  false if frame is not a valid compact message
+   */
+  auto parse(std::string_view frame) -> bool;
+
+  /**
+   * Reads the next key-value pair.
+   *
+   * @return  false after the last pair
+   */
+  auto next(CompactKeyValue& kvp) -> bool;
+
+  /**
+   * Restarts iterating at the first key-value pair.
+   */
+  auto rewind() -> void {
+    position = pairs_begin;
+    remaining = kvp_count;
+  }
+
+  /**
+   * Copies the message into msg.
+   */
+  auto to_cloud_message(cloud::CloudMessage& msg) -> void;
+
+  uint8_t type{0};
+  uint8_t operation{0};
+  bool success{false};
+  uint8_t durability{0};
+  std::string_view message{};
+  uint64_t timestamp{0};
+  uint64_t deadline{0};
+  uint64_t trace_id{0};
+  uint64_t span_id{0};
+  uint16_t kvp_count{0};
+
+ private:
+  std::string_view frame{};
+  size_t pairs_begin{0};
+  size_t position{0};
+  uint16_t remaining{0};
+};
+
+/**
+ * Whether msg can be sent in the compact format. Control-plane messages
+ * (cluster management, partitions, transactions and STATS) cannot.
+ */
+auto compact_encodable(const cloud::CloudMessage& msg) -> bool;
+
+/**
+ * Size of msg in the compact format, excluding the length word.
+ */
+auto compact_size(const cloud::CloudMessage& msg) -> size_t;
+
+/**
+ * Writes msg in the compact format to buffer, which must hold at least
+ * compact_size(msg) bytes.
+ *
+ * @return  the number of bytes written
+ */
+auto encode_compact(const cloud::CloudMessage& msg, uint8_t* buffer) -> size_t;
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_WIRE_HH
@@ -0,0 +1,179 @@
+#ifndef CLOUDLAB_PARTITIONS_HH
+#define CLOUDLAB_PARTITIONS_HH
+
+#include "cloudlab/kvs.hh"
+#include "cloudlab/network/routing.hh"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cloudlab {
+
+enum class PartitionState : uint8_t {
+  // not stored on this peer (anymore)
+  DROPPED,
+
+  // stored and owned by this peer
+  ACTIVE,
+
+  // created for a STEAL, the previous owners did not drop it yet. Already
+  // accepts reads and writes.
+  MIGRATING_IN,
+
+  // handed to another peer by a TRANSFER or JOIN_CLUSTER, reads are still
+  // served until the handoff completed but writes are rejected s.t. none is
+  // lost in the handoff
+  MIGRATING_OUT,
+};
+
+auto to_string(PartitionState state) -> const char*;
+
+/**
+ * The partitions stored on a peer. Server workers look partitions up while
+ * other workers create, steal and drop them, so every partition ID has a
+ * fixed slot whose KVS is only ever replaced atomically. Lookups take no lock
+ * and hand out a reference-counted handle: a partition that is dropped while
+ * a request still uses it is closed once the last handle is gone.
+ */
+class PartitionRegistry {
+ public:
+  using Handle = std::shared_ptr<KVS>;
+
+  /**
+   * A partition that a write may change. The partition does not finish to
+   * migrate out (see migrate_out) until all of its write handles are gone.
+   * Handles may be kept beyond a request, e.g., by a prepared transaction.
+   */
+  class WriteHandle {
+   public:
+    WriteHandle() = default;
+
+    WriteHandle(std::atomic<uint32_t>* writers, Handle kvs)
+        : writers{writers}, kvs{std::move(kvs)} {
+    }
+
+    WriteHandle(const WriteHandle&) = delete;
+    WriteHandle& operator=(const WriteHandle&) = delete;
+
+    WriteHandle(WriteHandle&& other) noexcept
+        : writers{std::exchange(other.writers, nullptr)},
+          kvs{std::move(other.kvs)} {
+    }
+
+    WriteHandle& operator=(WriteHandle&& other) = delete;
+
+    ~WriteHandle() {
+      if (writers) writers->fetch_sub(1);
+    }
+
+    explicit operator bool() const {
+      return kvs != nullptr;
+    }
+
+    auto operator->() const -> KVS* {
+      return kvs.get();
+    }
+
+   private:
+    std::atomic<uint32_t>* writers{nullptr};
+    Handle kvs{};
+  };
+
+  /**
+   * @return  the KVS of partition id, nullptr if it is not stored on this
+   *          peer
+   */
+  [[nodiscard]] auto get(uint32_t id) const -> Handle;
+
+  /**
+   * @return  the KVS of partition id if writes may change it, i.e., it is
+   *          ACTIVE or MIGRATING_IN, an empty handle otherwise
+   */
+  auto get_writable(uint32_t id) -> WriteHandle;
+
+  [[nodiscard]] auto get_state(uint32_t id) const -> PartitionState;
+
+  /**
+   * Stores kvs as partition id, replacing the partition's previous KVS.
+   *
+   * @return  false if id is not a valid partition ID
+   */
+  auto install(uint32_t id, Handle kvs,
+               PartitionState state = PartitionState::ACTIVE) -> bool;
+
+  /**
+   * Changes the state of a partition that is stored on this peer.
+   */
+  auto set_state(uint32_t id, PartitionState state) -> void;
+
+  /**
+   * Marks partition id as MIGRATING_OUT and waits until the writes that
+   * looked it up before are done, s.t. its data does not change anymore.
+   * Prepared transactions hold their write handles until they are decided,
+   * so this also waits for their commit or abort.
+   *
+   * @param owner  the peer that takes the partition over, if known
+   */
+  auto migrate_out(uint32_t id, const std::string& owner) -> void;
+
+  /**
+   * Drops partition id.
+   *
+   * @param owner  the peer that stores the partition from now on, if known
+   * @return  its KVS, nullptr if it was not stored on this peer
+   */
+  auto remove(uint32_t id, const std::string& owner = "") -> Handle;
+
+  /**
+   * @return  the peer that takes over a partition that was dropped or
+   *          migrates out, empty if unknown
+   */
+  [[nodiscard]] auto get_owner(uint32_t id) const -> std::string;
+
+  /**
+   * @return  the number of partition changes of this peer so far
+   */
+  [[nodiscard]] auto get_epoch() const -> uint64_t {
+    return epoch.load();
+  }
+
+  /**
+   * Calls fn for every partition stored on this peer, in order of their IDs.
+   */
+  auto for_each(const std::function<void(uint32_t, KVS&)>& fn) const -> void;
+
+  /**
+   * @return  the IDs of the partitions stored on this peer
+   */
+  [[nodiscard]] auto ids() const -> std::vector<uint32_t>;
+
+  [[nodiscard]] auto size() const -> size_t;
+
+ private:
+  struct Slot {
+    std::atomic<PartitionState> state{PartitionState::DROPPED};
+    std::atomic<Handle> kvs{};
+
+    // writes that hold a WriteHandle of the partition
+    std::atomic<uint32_t> writers{0};
+  };
+
+  std::array<Slot, cluster_partitions> slots{};
+
+  std::atomic<uint64_t> epoch{0};
+
+  // new owners of dropped partitions, only read by requests that missed
+  std::array<std::string, cluster_partitions> owners{};
+  mutable std::mutex owners_mtx{};
+};
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_PARTITIONS_HH
@@ -3,6 +3,7 @@
 
 #include <condition_variable>
 #include <deque>
+#include <mutex>
 #include <vector>
 
 namespace cloudlab {
@@ -16,14 +17,39 @@ namespace cloudlab {
 template <typename T>
 class SPMCQueue {
  public:
-  SPMCQueue() = default;
+  /**
+   * @param capacity  Bound for try_produce, 0 means unbounded
+   */
+  explicit SPMCQueue(size_t capacity = 0) : capacity{capacity} {
+  }
 
+  /**
+   * Enqueues val regardless of the capacity.
+   */
   auto produce(T val) -> void {
     std::lock_guard<std::mutex> lock_guard(mtx);
     q.push_back(val);
     cond.notify_one();
   }
 
+  /**
+   * Enqueues val unless the queue is full.
+   *
+   * @return  false if the queue is full
+   */
+  auto try_produce(T val) -> bool {
+    std::lock_guard<std::mutex> lock_guard(mtx);
+    if (capacity && q.size() >= capacity) return false;
+    q.push_back(val);
+    cond.notify_one();
+    return true;
+  }
+
+  auto size() -> size_t {
+    std::lock_guard<std::mutex> lock_guard(mtx);
+    return q.size();
+  }
+
   auto consume() -> T {
     std::unique_lock<std::mutex> lock_guard(mtx);
     cond.wait(lock_guard, [this] { return !q.empty(); });
@@ -33,6 +59,7 @@ class SPMCQueue {
   }
 
  private:
+  const size_t capacity;
   std::deque<T> q{};
   std::mutex mtx{};
   std::condition_variable cond{};
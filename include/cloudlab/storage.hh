@@ -0,0 +1,112 @@
+#ifndef CLOUDLAB_STORAGE_HH
+#define CLOUDLAB_STORAGE_HH
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace rocksdb {
+class Cache;
+struct Options;
+}  // namespace rocksdb
+
+namespace cloudlab {
+
+/**
+ * Durability guarantee of a write once it was acknowledged.
+ */
+enum class Durability {
+  // written to the WAL and fsynced before the write returns
+  SYNC,
+  // written to the WAL, concurrent writers share one fsync after a bounded
+  // delay and return once it completed
+  GROUP_COMMIT,
+  // written to the WAL without fsync, survives a crash of the process but not
+  // of the machine (rocksdb's default)
+  BUFFERED,
+  // no WAL, memtables are flushed periodically, recent writes may be lost
+  ASYNC
+};
+
+auto parse_durability(const std::string& name) -> Durability;
+
+auto durability_name(Durability durability) -> std::string;
+
+/**
+ * Node-level storage configuration, i.e., the rocksdb tuning knobs that apply
+ * to all partitions stored on a peer.
+ */
+struct StorageConfig {
+  // size of the block cache shared by all partitions in bytes
+  size_t block_cache_size{8 << 20};
+
+  // bits per key of the bloom filters, 0 disables bloom filters
+  int bloom_bits_per_key{0};
+
+  // compression per LSM level (none, snappy, zlib, lz4, lz4hc, zstd), empty
+  // means rocksdb's default compression on all levels
+  std::vector<std::string> compression_per_level{};
+
+  // size of a single memtable in bytes
+  size_t write_buffer_size{64 << 20};
+
+  int max_background_jobs{2};
+
+  // bypass the page cache for reads, flushes and compactions
+  bool use_direct_io{false};
+
+  // capacity of the in-memory value cache of every partition in bytes, 0
+  // disables it
+  size_t value_cache_size{0};
+
+  // durability of writes that do not ask for a specific level
+  Durability durability{Durability::BUFFERED};
+
+  // how long the leader of a group commit waits for more writers to join
+  uint64_t group_commit_delay_us{500};
+
+  // minimum time between two memtable flushes triggered by ASYNC writes
+  uint64_t async_flush_interval_ms{1000};
+
+  // how long snapshots for reads at older timestamps are kept, 0 only allows
+  // reads of the latest state
+  uint64_t snapshot_retention_ms{1000};
+
+  /**
+   * Named presets: "default", "read-heavy" and "write-heavy".
+   */
+  static auto preset(const std::string& name) -> StorageConfig;
+
+  /**
+   * Reads a configuration file with one "<option> = <value>" per line ('#'
+   * starts a comment). Options that are not set keep their value from base.
+   */
+  static auto from_file(const std::string& path, StorageConfig base)
+      -> StorageConfig;
+};
+
+/**
+ * A storage configuration plus the rocksdb resources (block cache) that are
+ * shared by all KVS instances of a peer.
+ */
+class StorageProfile {
+ public:
+  explicit StorageProfile(StorageConfig config = {});
+
+  /**
+   * Applies the configuration to the rocksdb options of a partition.
+   */
+  auto apply(rocksdb::Options& options) const -> void;
+
+  [[nodiscard]] auto get_config() const -> const StorageConfig& {
+    return config;
+  }
+
+ private:
+  const StorageConfig config;
+  std::shared_ptr<rocksdb::Cache> block_cache;
+};
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_STORAGE_HH
@@ -0,0 +1,185 @@
+#ifndef CLOUDLAB_TASK_HH
+#define CLOUDLAB_TASK_HH
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+namespace cloudlab {
+
+template <typename T>
+class Task;
+
+namespace detail {
+
+// resumes the coroutine that awaits a finished task
+struct FinalAwaiter {
+  [[nodiscard]] auto await_ready() const noexcept -> bool {
+    return false;
+  }
+
+  template <typename Promise>
+  auto await_suspend(std::coroutine_handle<Promise> handle) noexcept
+      -> std::coroutine_handle<> {
+    auto continuation = handle.promise().continuation;
+    return continuation ? continuation : std::noop_coroutine();
+  }
+
+  auto await_resume() noexcept -> void {
+  }
+};
+
+struct PromiseBase {
+  std::coroutine_handle<> continuation{};
+  std::exception_ptr exception{};
+
+  auto initial_suspend() noexcept -> std::suspend_always {
+    return {};
+  }
+
+  auto final_suspend() noexcept -> FinalAwaiter {
+    return {};
+  }
+
+  auto unhandled_exception() noexcept -> void {
+    exception = std::current_exception();
+  }
+
+  auto rethrow() -> void {
+    if (exception) std::rethrow_exception(exception);
+  }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+  std::optional<T> value{};
+
+  auto get_return_object() -> Task<T>;
+
+  auto return_value(T v) -> void {
+    value = std::move(v);
+  }
+
+  auto result() -> T {
+    rethrow();
+    return std::move(*value);
+  }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+  auto get_return_object() -> Task<void>;
+
+  auto return_void() -> void {
+  }
+
+  auto result() -> void {
+    rethrow();
+  }
+};
+
+}  // namespace detail
+
+/**
+ * A coroutine that starts once it is awaited and resumes its awaiter when it
+ * is done. Exceptions are rethrown in the awaiter.
+ */
+template <typename T = void>
+class [[nodiscard]] Task {
+ public:
+  using promise_type = detail::Promise<T>;
+
+  explicit Task(std::coroutine_handle<promise_type> handle) : handle{handle} {
+  }
+
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+
+  Task(Task&& other) noexcept : handle{std::exchange(other.handle, {})} {
+  }
+
+  Task& operator=(Task&& other) noexcept {
+    if (this != &other) {
+      if (handle) handle.destroy();
+      handle = std::exchange(other.handle, {});
+    }
+    return *this;
+  }
+
+  ~Task() {
+    if (handle) handle.destroy();
+  }
+
+  [[nodiscard]] auto await_ready() const noexcept -> bool {
+    return false;
+  }
+
+  auto await_suspend(std::coroutine_handle<> awaiter) noexcept
+      -> std::coroutine_handle<> {
+    handle.promise().continuation = awaiter;
+    return handle;
+  }
+
+  auto await_resume() -> T {
+    return handle.promise().result();
+  }
+
+  /**
+   * Runs the task in the calling thread until it is done. Only for tasks
+   * that never suspend, i.e., whose I/O blocks because the thread has no
+   * event loop (see EventLoop).
+   */
+  auto get() -> T {
+    handle.resume();
+    if (!handle.done()) {
+      throw std::logic_error{"task suspended outside of an event loop"};
+    }
+    return handle.promise().result();
+  }
+
+ private:
+  std::coroutine_handle<promise_type> handle;
+};
+
+template <typename T>
+auto detail::Promise<T>::get_return_object() -> Task<T> {
+  return Task<T>{std::coroutine_handle<Promise<T>>::from_promise(*this)};
+}
+
+inline auto detail::Promise<void>::get_return_object() -> Task<void> {
+  return Task<void>{std::coroutine_handle<Promise<void>>::from_promise(*this)};
+}
+
+/**
+ * A coroutine that starts right away and frees itself once it is done, e.g.,
+ * a request that an event loop handles. Exceptions terminate the process
+ * like exceptions of a thread do.
+ */
+struct Detached {
+  struct promise_type {
+    auto get_return_object() -> Detached {
+      return {};
+    }
+
+    auto initial_suspend() noexcept -> std::suspend_never {
+      return {};
+    }
+
+    auto final_suspend() noexcept -> std::suspend_never {
+      return {};
+    }
+
+    auto return_void() -> void {
+    }
+
+    auto unhandled_exception() noexcept -> void {
+      std::terminate();
+    }
+  };
+};
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_TASK_HH
@@ -0,0 +1,156 @@
+#ifndef CLOUDLAB_TRACING_HH
+#define CLOUDLAB_TRACING_HH
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace cloudlab {
+
+/**
+ * Identifies a span within a trace, trace_id 0 means the request is not
+ * sampled.
+ */
+struct TraceContext {
+  uint64_t trace_id{0};
+  uint64_t span_id{0};
+
+  [[nodiscard]] auto sampled() const -> bool {
+    return trace_id != 0;
+  }
+};
+
+/**
+ * Records the spans of sampled requests to a file in the Chrome trace event
+ * format (load it in chrome://tracing or Perfetto). Whether a request is
+ * traced is decided once where it enters the system (head-based sampling);
+ * everything downstream only records spans of requests that carry a trace
+ * ID, so requests that are not sampled cost a thread-local lookup per span.
+ */
+class Tracer {
+ public:
+  Tracer() = default;
+  Tracer(const Tracer&) = delete;
+  Tracer& operator=(const Tracer&) = delete;
+  ~Tracer();
+
+  /**
+   * Starts writing spans to path.
+   *
+   * @param sample_rate  Fraction of the requests that enter here to trace
+   * @param process      Name of the process shown in the trace viewer
+   */
+  auto open(const std::string& path, double sample_rate,
+            const std::string& process) -> void;
+
+  [[nodiscard]] auto enabled() const -> bool {
+    return is_open.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Sampling decision for a request that enters the system.
+   *
+   * @return  the context of a new trace, or an empty context if the request
+   *          is not traced
+   */
+  auto start_trace() -> TraceContext;
+
+  /**
+   * Records a finished span of a sampled trace.
+   */
+  auto record(std::string_view name, TraceContext span, uint64_t parent_id,
+              std::chrono::steady_clock::time_point start,
+              std::chrono::steady_clock::time_point end) -> void;
+
+  /**
+   * Records how long the request that the calling worker handles right now
+   * waited in the queue and how long it took to receive it, as children of
+   * span.
+   */
+  auto record_arrival(TraceContext span) -> void;
+
+  static auto new_id() -> uint64_t;
+
+  /**
+   * Span of the calling thread that new spans are children of.
+   */
+  static auto current() -> TraceContext;
+
+  static auto set_current(TraceContext context) -> void;
+
+  /**
+   * Called by server workers when they dequeue a request.
+   */
+  static auto set_dequeued(std::chrono::steady_clock::time_point enqueued_at,
+                           std::chrono::steady_clock::time_point dequeued_at)
+      -> void;
+
+  /**
+   * Time the request that the calling worker handles was enqueued, now if the
+   * thread is not a server worker.
+   */
+  static auto enqueued_at() -> std::chrono::steady_clock::time_point;
+
+ private:
+  auto flush() -> void;
+
+  std::atomic<bool> is_open{false};
+  double sample_rate{0};
+
+  // spans are formatted by the recording thread and written by the flusher
+  std::string buffer{};
+  std::FILE* file{nullptr};
+  std::mutex mtx{};
+  std::condition_variable cond{};
+  bool stopped{false};
+  std::thread flusher{};
+};
+
+/**
+ * The tracer of the process.
+ */
+auto tracer() -> Tracer&;
+
+/**
+ * A span that lasts as long as the object and is the current span of the
+ * thread meanwhile. Nothing is recorded unless its parent is sampled.
+ */
+class ScopedSpan {
+ public:
+  /**
+   * Child of the current span of the thread.
+   */
+  explicit ScopedSpan(std::string_view name)
+      : ScopedSpan(name, Tracer::current()) {
+  }
+
+  ScopedSpan(std::string_view name, TraceContext parent,
+             std::chrono::steady_clock::time_point start =
+                 std::chrono::steady_clock::now());
+
+  ScopedSpan(const ScopedSpan&) = delete;
+  ScopedSpan& operator=(const ScopedSpan&) = delete;
+
+  ~ScopedSpan();
+
+  [[nodiscard]] auto context() const -> TraceContext {
+    return own;
+  }
+
+ private:
+  std::string_view name;
+  uint64_t parent_id{0};
+  TraceContext own{};
+  TraceContext previous{};
+  std::chrono::steady_clock::time_point start{};
+};
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_TRACING_HH
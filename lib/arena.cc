@@ -0,0 +1,47 @@
+#include "cloudlab/arena.hh"
+
+#include <memory>
+
+namespace cloudlab {
+
+namespace {
+
+/**
+ * An arena that starts with a block owned by the thread, which survives
+ * resets, so the arena only allocates once a request outgrows it.
+ */
+struct ThreadArena {
+  ThreadArena()
+      : initial_block{std::make_unique<char[]>(arena_initial_block_size)},
+        arena{options(initial_block.get())} {
+  }
+
+  static auto options(char* block) -> google::protobuf::ArenaOptions {
+    google::protobuf::ArenaOptions options{};
+    options.initial_block = block;
+    options.initial_block_size = arena_initial_block_size;
+    options.start_block_size = arena_initial_block_size;
+    return options;
+  }
+
+  // declared before the arena s.t. it outlives it
+  std::unique_ptr<char[]> initial_block;
+  google::protobuf::Arena arena;
+};
+
+}  // namespace
+
+static auto thread_arena() -> ThreadArena& {
+  thread_local ThreadArena arena{};
+  return arena;
+}
+
+auto request_arena() -> google::protobuf::Arena& {
+  return thread_arena().arena;
+}
+
+auto reset_request_arena() -> uint64_t {
+  return thread_arena().arena.Reset();
+}
+
+}  // namespace cloudlab
@@ -0,0 +1,171 @@
+#include "cloudlab/cache.hh"
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+namespace cloudlab {
+
+// approximate bookkeeping overhead of a cached entry in bytes
+const auto entry_overhead = 64;
+
+static auto charge(const std::string& key, const std::string& value)
+    -> size_t {
+  return key.size() + value.size() + entry_overhead;
+}
+
+ValueCache::ValueCache(size_t capacity, size_t num_shards) {
+  if (num_shards == 0) {
+    num_shards = std::max(1U, std::thread::hardware_concurrency());
+  }
+  for (size_t i = 0; i < num_shards; i++) {
+    shards.emplace_back(std::make_unique<Shard>(capacity / num_shards));
+  }
+}
+
+auto ValueCache::shard(const std::string& key) -> Shard& {
+  return *shards[std::hash<std::string>()(key) % shards.size()];
+}
+
+auto ValueCache::get(const std::string& key, std::string& value) -> bool {
+  return shard(key).get(key, value);
+}
+
+auto ValueCache::insert(const std::string& key, const std::string& value)
+    -> void {
+  shard(key).insert(key, value);
+}
+
+auto ValueCache::erase(const std::string& key) -> void {
+  shard(key).erase(key);
+}
+
+auto ValueCache::clear() -> void {
+  for (auto& s : shards) {
+    s->clear();
+  }
+}
+
+auto ValueCache::Shard::get(const std::string& key, std::string& value)
+    -> bool {
+  std::lock_guard<std::mutex> lck(mtx);
+  auto search = index.find(key);
+  if (search == index.end()) return false;
+
+  auto& entry = *search->second;
+  entry.freq = std::min(entry.freq + 1, 3);
+  value = entry.value;
+  return true;
+}
+
+auto ValueCache::Shard::insert(const std::string& key,
+                               const std::string& value) -> void {
+  std::lock_guard<std::mutex> lck(mtx);
+  if (charge(key, value) > capacity) return;
+
+  auto search = index.find(key);
+  if (search != index.end()) {
+    auto& entry = *search->second;
+    auto& size = entry.main ? main_size : small_size;
+    size = size - entry.value.size() + value.size();
+    entry.value = value;
+  } else {
+    // keys that were evicted from the small queue recently go straight to the
+    // main queue
+    auto ghost_search = ghost_index.find(key);
+    auto to_main = ghost_search != ghost_index.end();
+    if (to_main) {
+      ghost.erase(ghost_search->second);
+      ghost_index.erase(ghost_search);
+    }
+
+    auto& queue = to_main ? main : small;
+    queue.push_front({key, value, 0, to_main});
+    index.insert({key, queue.begin()});
+    (to_main ? main_size : small_size) += charge(key, value);
+  }
+
+  while (small_size + main_size > capacity) {
+    evict();
+  }
+}
+
+auto ValueCache::Shard::erase(const std::string& key) -> void {
+  std::lock_guard<std::mutex> lck(mtx);
+  auto search = index.find(key);
+  if (search == index.end()) return;
+
+  auto it = search->second;
+  if (it->main) {
+    main_size -= charge(it->key, it->value);
+    main.erase(it);
+  } else {
+    small_size -= charge(it->key, it->value);
+    small.erase(it);
+  }
+  index.erase(search);
+}
+
+auto ValueCache::Shard::clear() -> void {
+  std::lock_guard<std::mutex> lck(mtx);
+  small.clear();
+  main.clear();
+  index.clear();
+  ghost.clear();
+  ghost_index.clear();
+  small_size = main_size = 0;
+}
+
+auto ValueCache::Shard::evict() -> void {
+  while (true) {
+    // the small queue gets 10% of the capacity
+    if (!small.empty() && (small_size >= capacity / 10 || main.empty())) {
+      auto& entry = small.back();
+      auto size = charge(entry.key, entry.value);
+
+      if (entry.freq > 1) {
+        // read again while in the small queue -> promote
+        entry.freq = 0;
+        entry.main = true;
+        main.splice(main.begin(), small, std::prev(small.end()));
+        small_size -= size;
+        main_size += size;
+        continue;
+      }
+
+      remember(entry.key);
+      index.erase(entry.key);
+      small_size -= size;
+      small.pop_back();
+      return;
+    }
+
+    if (main.empty()) return;
+
+    auto& entry = main.back();
+    if (entry.freq > 0) {
+      // give entries that were read since the last pass another round
+      entry.freq--;
+      main.splice(main.begin(), main, std::prev(main.end()));
+      continue;
+    }
+
+    index.erase(entry.key);
+    main_size -= charge(entry.key, entry.value);
+    main.pop_back();
+    return;
+  }
+}
+
+auto ValueCache::Shard::remember(const std::string& key) -> void {
+  ghost.push_front(key);
+  ghost_index[key] = ghost.begin();
+
+  // the ghost queue remembers about as many keys as are cached
+  while (ghost.size() > std::max<size_t>(index.size(), 1)) {
+    ghost_index.erase(ghost.back());
+    ghost.pop_back();
+  }
+}
+
+}  // namespace cloudlab
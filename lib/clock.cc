@@ -0,0 +1,25 @@
+#include "cloudlab/clock.hh"
+
+#include <algorithm>
+
+namespace cloudlab {
+
+auto HybridLogicalClock::now() -> uint64_t {
+  auto physical = now_ms() << 16;
+  auto previous = last.load();
+  uint64_t next;
+  do {
+    // the logical counter only advances while the physical clock stands
+    // still (or lags behind a remote clock)
+    next = std::max(previous + 1, physical);
+  } while (!last.compare_exchange_weak(previous, next));
+  return next;
+}
+
+auto HybridLogicalClock::update(uint64_t remote) -> void {
+  auto previous = last.load();
+  while (previous < remote && !last.compare_exchange_weak(previous, remote)) {
+  }
+}
+
+}  // namespace cloudlab
@@ -1,33 +1,70 @@
 #include "cloud.pb.h"
 
 #include "cloudlab/handler/api.hh"
+#include "cloudlab/clock.hh"
+#include "cloudlab/tracing.hh"
 
 #include "fmt/core.h"
 
 namespace cloudlab {
 
 void APIHandler::handle_connection(Connection& con) {
+  // workers have no event loop, waiting for the backend blocks them
+  handle_connection_async(con).get();
+}
+
+auto APIHandler::handle_connection_async(Connection& con) -> Task<> {
+  // requests of other connections interleave on the thread, so the messages
+  // live in the coroutine instead of the thread's arena
   cloud::CloudMessage request{}, response{};
 
-  if (!con.receive(request)) {
-    return;
+  if (!co_await con.async_receive(request)) {
+    co_return;
   }
 
   if (request.type() != cloud::CloudMessage_Type_REQUEST) {
     throw std::runtime_error("api.cc: expected a request");
   }
 
-  auto backend_address = routing.get_backend_address();
+  auto started_at = std::chrono::steady_clock::now();
+
+  // requests enter the system here, so this is where they are sampled unless
+  // the client asked for a trace
+  TraceContext parent{request.trace_id(), request.span_id()};
+  if (!parent.sampled()) parent = tracer().start_trace();
+  ScopedSpan span{cloud::CloudMessage_Operation_Name(request.operation()),
+                  parent, Tracer::enqueued_at()};
+  tracer().record_arrival(span.context());
+  request.set_trace_id(span.context().trace_id);
+  request.set_span_id(span.context().span_id);
 
-  Connection backend{backend_address};
+  // the client's deadline bounds the wait for the router as well, the event
+  // loop runs other requests while the router accepts the connection
+  auto backend = co_await Connection::async_connect(
+      routing.get_backend_address(), request.deadline());
+  // the router speaks the format of the client
+  backend->set_compact(con.is_compact());
+  backend->set_compression(con.is_compressing());
 
   switch (request.operation()) {
     case cloud::CloudMessage_Operation_PUT:
     case cloud::CloudMessage_Operation_GET:
     case cloud::CloudMessage_Operation_DELETE:
-    case cloud::CloudMessage_Operation_JOIN_CLUSTER: {
-      backend.send(request);
-      backend.receive(response);
+    case cloud::CloudMessage_Operation_COMPARE_AND_SWAP:
+    case cloud::CloudMessage_Operation_INCREMENT:
+    case cloud::CloudMessage_Operation_APPEND:
+    case cloud::CloudMessage_Operation_TRANSACTION:
+    case cloud::CloudMessage_Operation_JOIN_CLUSTER:
+    case cloud::CloudMessage_Operation_STATS: {
+      if (backend->connect_failed || !co_await backend->async_send(request) ||
+          !co_await backend->async_receive(response)) {
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(request.operation());
+        response.set_success(false);
+        response.set_message(request.deadline() && now_ms() >= request.deadline()
+                                 ? "DEADLINE_EXCEEDED"
+                                 : "ERROR");
+      }
       break;
     }
     default:
@@ -38,7 +75,10 @@ void APIHandler::handle_connection(Connection& con) {
       break;
   }
 
-  con.send(response);
+  co_await con.async_send(response);
+  operations.record(request.operation(),
+                    cloud::CloudMessage_Operation_Name(request.operation()),
+                    std::chrono::steady_clock::now() - started_at);
 }
 
 }  // namespace cloudlab
\ No newline at end of file
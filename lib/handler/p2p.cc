@@ -1,20 +1,126 @@
 #include "cloudlab/handler/p2p.hh"
+#include "cloudlab/arena.hh"
+#include "cloudlab/tracing.hh"
 
 #include "fmt/core.h"
 
+#include <algorithm>
+
 #include "cloud.pb.h"
 
 namespace cloudlab {
 
-    P2PHandler::P2PHandler(Routing &routing) : routing{routing} {
+    // aborted transactions that are remembered s.t. a prepare that arrives
+    // after its abort does not lock keys forever
+    const auto txn_aborted_capacity = 1024;
+
+    static auto to_durability(cloud::CloudMessage_Durability durability, Durability fallback)
+    -> Durability {
+        switch (durability) {
+            case cloud::CloudMessage_Durability_SYNC:
+                return Durability::SYNC;
+            case cloud::CloudMessage_Durability_GROUP_COMMIT:
+                return Durability::GROUP_COMMIT;
+            case cloud::CloudMessage_Durability_BUFFERED:
+                return Durability::BUFFERED;
+            case cloud::CloudMessage_Durability_ASYNC:
+                return Durability::ASYNC;
+            default:
+                return fallback;
+        }
+    }
+
+    static auto from_durability(Durability durability) -> cloud::CloudMessage_Durability {
+        switch (durability) {
+            case Durability::SYNC:
+                return cloud::CloudMessage_Durability_SYNC;
+            case Durability::GROUP_COMMIT:
+                return cloud::CloudMessage_Durability_GROUP_COMMIT;
+            case Durability::BUFFERED:
+                return cloud::CloudMessage_Durability_BUFFERED;
+            case Durability::ASYNC:
+                return cloud::CloudMessage_Durability_ASYNC;
+        }
+        return cloud::CloudMessage_Durability_DEFAULT_DURABILITY;
+    }
+
+    /**
+     * Whether a request may be dropped once its deadline passed. The decision
+     * of a transaction and requests that move partitions must always be
+     * applied.
+     */
+    static auto is_droppable(const cloud::CloudMessage &msg) -> bool {
+        switch (msg.operation()) {
+            case cloud::CloudMessage_Operation_PUT:
+            case cloud::CloudMessage_Operation_GET:
+            case cloud::CloudMessage_Operation_DELETE:
+            case cloud::CloudMessage_Operation_COMPARE_AND_SWAP:
+            case cloud::CloudMessage_Operation_INCREMENT:
+            case cloud::CloudMessage_Operation_APPEND:
+            case cloud::CloudMessage_Operation_TXN_PREPARE:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    /**
+     * Answers a key whose partition is not stored on this peer with NOT_OWNER
+     * s.t. the router can tell a stale routing table from a missing key.
+     */
+    static auto not_owner(const PartitionRegistry &partitions, cloud::CloudMessage &response,
+                          cloud::CloudMessage_KeyValuePair &kvp, uint32_t id) -> void {
+        kvp.set_value("NOT_OWNER");
+        if (response.success()) response.set_message("NOT_OWNER");
+        response.set_success(false);
+        response.set_epoch(partitions.get_epoch());
+        for (auto &p: response.partition()) {
+            if (p.id() == id) return;
+        }
+        auto hint = response.add_partition();
+        hint->set_id(id);
+        hint->set_peer(partitions.get_owner(id));
+    }
+
+    P2PHandler::P2PHandler(Routing &routing, std::shared_ptr<const StorageProfile> storage)
+            : routing{routing},
+              metadata{routing.get_backend_address().string(), routing.get_cluster_address()},
+              storage{std::move(storage)} {
         auto hash = std::hash<SocketAddress>()(routing.get_backend_address());
         auto path = fmt::format("/tmp/{}-initial", hash);
 
-        partitions.insert({0, std::make_unique<KVS>(path)});
+        partitions.install(0, std::make_shared<KVS>(path, false, this->storage, clock));
+
+        register_rocksdb_property("rocksdb.estimate-num-keys");
+        register_rocksdb_property("rocksdb.estimate-live-data-size");
+        register_rocksdb_property("rocksdb.cur-size-all-mem-tables");
+        register_rocksdb_property("rocksdb.num-running-compactions");
+        register_rocksdb_property("rocksdb.num-running-flushes");
+        metrics().gauge("cloudlab_partitions", "Partitions stored on the peer",
+                        [this]() { return static_cast<int64_t>(partitions.size()); },
+                        {{"peer", this->routing.get_backend_address().string()}});
+    }
+
+    auto P2PHandler::register_rocksdb_property(const std::string &property) -> void {
+        // e.g., rocksdb.estimate-num-keys -> cloudlab_rocksdb_estimate_num_keys
+        auto name = fmt::format("cloudlab_{}", property);
+        std::replace(name.begin(), name.end(), '.', '_');
+        std::replace(name.begin(), name.end(), '-', '_');
+        metrics().gauge(name, fmt::format("Sum of {} over all partitions", property),
+                        [this, property]() {
+                            int64_t sum = 0;
+                            partitions.for_each([&](uint32_t, KVS &kvs) {
+                                uint64_t value = 0;
+                                if (kvs.get_property(property, value)) sum += static_cast<int64_t>(value);
+                            });
+                            return sum;
+                        },
+                        {{"peer", routing.get_backend_address().string()}});
     }
 
     auto P2PHandler::handle_connection(Connection &con) -> void {
-        cloud::CloudMessage request{}, response{};
+        auto &request = arena_message<cloud::CloudMessage>();
+        auto &response = arena_message<cloud::CloudMessage>();
 
         if (!con.receive(request)) {
             return;
@@ -24,6 +130,23 @@ namespace cloudlab {
             throw std::runtime_error("p2p.cc: expected a request");
         }
 
+        if (request.deadline() && now_ms() >= request.deadline() && is_droppable(request)) {
+            // nobody waits for the result anymore, answer without touching
+            // rocksdb
+            response.set_type(cloud::CloudMessage_Type_RESPONSE);
+            response.set_operation(request.operation());
+            response.set_success(false);
+            response.set_message("DEADLINE_EXCEEDED");
+            con.send(response);
+            return;
+        }
+
+        // spans of the request are children of the router's span
+        ScopedSpan span{cloud::CloudMessage_Operation_Name(request.operation()),
+                        {request.trace_id(), request.span_id()}, Tracer::enqueued_at()};
+        tracer().record_arrival(span.context());
+
+        auto started_at = std::chrono::steady_clock::now();
         switch (request.operation()) {
             case cloud::CloudMessage_Operation_PUT: {
                 handle_put(con, request);
@@ -37,6 +160,24 @@ namespace cloudlab {
                 handle_delete(con, request);
                 break;
             }
+            case cloud::CloudMessage_Operation_COMPARE_AND_SWAP:
+            case cloud::CloudMessage_Operation_INCREMENT:
+            case cloud::CloudMessage_Operation_APPEND: {
+                handle_read_modify_write(con, request);
+                break;
+            }
+            case cloud::CloudMessage_Operation_TXN_PREPARE: {
+                handle_txn_prepare(con, request);
+                break;
+            }
+            case cloud::CloudMessage_Operation_TXN_COMMIT: {
+                handle_txn_commit(con, request);
+                break;
+            }
+            case cloud::CloudMessage_Operation_TXN_ABORT: {
+                handle_txn_abort(con, request);
+                break;
+            }
             case cloud::CloudMessage_Operation_JOIN_CLUSTER: {
                 handle_join_cluster(con, request);
                 break;
@@ -57,6 +198,10 @@ namespace cloudlab {
                 handle_transfer_partition(con, request);
                 break;
             }
+            case cloud::CloudMessage_Operation_STATS: {
+                handle_stats(con, request);
+                break;
+            }
             default:
                 response.set_type(cloud::CloudMessage_Type_RESPONSE);
                 response.set_operation(request.operation());
@@ -67,28 +212,40 @@ namespace cloudlab {
 
                 break;
         }
+        operations.record(request.operation(), cloud::CloudMessage_Operation_Name(request.operation()),
+                          std::chrono::steady_clock::now() - started_at);
     }
 
     auto P2PHandler::handle_put(Connection &con, const cloud::CloudMessage &msg)
     -> void {
-        cloud::CloudMessage response;
+        auto &response = arena_message<cloud::CloudMessage>();
         response.set_type(cloud::CloudMessage_Type_RESPONSE);
         response.set_operation(cloud::CloudMessage_Operation_PUT);
         response.set_success(true);
         response.set_message("OK");
+        auto durability = to_durability(msg.durability(), storage->get_config().durability);
+        response.set_durability(from_durability(durability));
 
+        // held until the writes are applied s.t. no transaction locks their
+        // keys after the check
+        std::shared_lock<std::shared_mutex> lck(txn_mtx);
         for (const auto &kvp: msg.kvp()) {
             auto *tmp = response.add_kvp();
             tmp->set_key(kvp.key());
-            auto search = partitions.find(routing.get_partition(kvp.key()));
-            if (search == partitions.end() || !search->second) {
-                tmp->set_value("ERROR");
+            auto id = routing.get_partition(kvp.key());
+            auto kvs = partitions.get_writable(id);
+            if (!kvs) {
+                not_owner(partitions, response, *tmp, id);
+                continue;
+            }
+            if (is_locked(kvp.key())) {
+                tmp->set_value("CONFLICT");
                 response.set_success(false);
-                response.set_message("ERROR");
+                response.set_message("CONFLICT");
                 continue;
             }
 
-            if (search->second->put(kvp.key(), kvp.value())) {
+            if (kvs->put(kvp.key(), kvp.value(), durability, kvp.ttl())) {
                 tmp->set_value("OK");
             } else {
                 tmp->set_value("ERROR");
@@ -97,32 +254,48 @@ namespace cloudlab {
             }
         }
 
+        response.set_timestamp(clock->current());
         con.send(response);
     }
 
     auto P2PHandler::handle_get(Connection &con, const cloud::CloudMessage &msg)
     -> void {
-        cloud::CloudMessage response{};
+        auto &response = arena_message<cloud::CloudMessage>();
         std::string value;
 
         response.set_type(cloud::CloudMessage_Type_RESPONSE);
         response.set_operation(cloud::CloudMessage_Operation_GET);
         response.set_success(true);
         response.set_message("OK");
+        response.set_timestamp(msg.timestamp());
+        if (msg.timestamp() && !HybridLogicalClock::is_plausible(msg.timestamp())) {
+            response.set_success(false);
+            response.set_message("TIMESTAMP_IN_FUTURE");
+            con.send(response);
+            return;
+        }
 
         for (const auto &kvp: msg.kvp()) {
 
             auto *tmp = response.add_kvp();
             tmp->set_key(kvp.key());
-            auto search = partitions.find(routing.get_partition(kvp.key()));
-            if (search == partitions.end() || !search->second) {
-                tmp->set_value("ERROR");
+            auto id = routing.get_partition(kvp.key());
+            auto kvs = partitions.get(id);
+            if (!kvs) {
+                not_owner(partitions, response, *tmp, id);
                 continue;
             }
-            if (search->second->get(kvp.key(), value)) {
+            KVS::ValueInfo info{};
+            if (kvs->get(kvp.key(), value, &info, msg.timestamp())) {
                 tmp->set_value(value);
+                tmp->set_ttl(info.ttl);
+                tmp->set_version(info.version);
             } else {
                 tmp->set_value("ERROR");
+                if (info.snapshot_too_old) {
+                    response.set_success(false);
+                    response.set_message("SNAPSHOT_TOO_OLD");
+                }
             }
         }
 
@@ -131,26 +304,259 @@ namespace cloudlab {
 
     auto P2PHandler::handle_delete(Connection &con, const cloud::CloudMessage &msg)
     -> void {
-        cloud::CloudMessage response{};
+        auto &response = arena_message<cloud::CloudMessage>();
         response.set_type(cloud::CloudMessage_Type_RESPONSE);
         response.set_operation(cloud::CloudMessage_Operation_DELETE);
         response.set_success(true);
         response.set_message("OK");
+        auto durability = to_durability(msg.durability(), storage->get_config().durability);
+        response.set_durability(from_durability(durability));
 
+        // held until the writes are applied s.t. no transaction locks their
+        // keys after the check
+        std::shared_lock<std::shared_mutex> lck(txn_mtx);
         for (const auto &kvp: msg.kvp()) {
             auto *tmp = response.add_kvp();
             tmp->set_key(kvp.key());
-            auto search = partitions.find(routing.get_partition(kvp.key()));
-            if (search == partitions.end() || !search->second) {
-                tmp->set_value("ERROR");
+            auto id = routing.get_partition(kvp.key());
+            auto kvs = partitions.get_writable(id);
+            if (!kvs) {
+                not_owner(partitions, response, *tmp, id);
                 continue;
             }
-            if (search->second->remove(kvp.key())) {
+            if (is_locked(kvp.key())) {
+                tmp->set_value("CONFLICT");
+                continue;
+            }
+            if (kvs->remove(kvp.key(), durability)) {
                 tmp->set_value("OK");
             } else {
                 tmp->set_value("ERROR");
             }
         }
+        response.set_timestamp(clock->current());
+        con.send(response);
+    }
+
+    auto P2PHandler::handle_read_modify_write(Connection &con, const cloud::CloudMessage &msg)
+    -> void {
+        auto &response = arena_message<cloud::CloudMessage>();
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(msg.operation());
+        response.set_success(true);
+        response.set_message("OK");
+        auto durability = to_durability(msg.durability(), storage->get_config().durability);
+        response.set_durability(from_durability(durability));
+
+        auto fail = [&response](cloud::CloudMessage_KeyValuePair *kvp, const std::string &message) {
+            if (kvp->value().empty()) kvp->set_value("ERROR");
+            response.set_success(false);
+            response.set_message(message);
+        };
+
+        // held until the writes are applied s.t. no transaction locks their
+        // keys after the check
+        std::shared_lock<std::shared_mutex> lck(txn_mtx);
+        for (const auto &kvp: msg.kvp()) {
+            auto *tmp = response.add_kvp();
+            tmp->set_key(kvp.key());
+            auto id = routing.get_partition(kvp.key());
+            auto kvs = partitions.get_writable(id);
+            if (!kvs) {
+                not_owner(partitions, response, *tmp, id);
+                continue;
+            }
+            if (is_locked(kvp.key())) {
+                fail(tmp, "CONFLICT");
+                continue;
+            }
+
+            switch (msg.operation()) {
+                case cloud::CloudMessage_Operation_COMPARE_AND_SWAP: {
+                    // on a conflict, the current value is returned s.t. the
+                    // client can retry without another GET
+                    std::string current;
+                    auto swapped = kvs->compare_and_swap(kvp.key(), kvp.expected(), kvp.value(),
+                                                        current, durability, kvp.ttl());
+                    tmp->set_value(current);
+                    if (!swapped) fail(tmp, current != kvp.expected() ? "CONFLICT" : "ERROR");
+                    break;
+                }
+                case cloud::CloudMessage_Operation_INCREMENT: {
+                    // the value holds the delta, an empty value increments by one
+                    int64_t delta = 1, result;
+                    try {
+                        if (!kvp.value().empty()) {
+                            size_t parsed;
+                            delta = std::stoll(kvp.value(), &parsed);
+                            if (parsed != kvp.value().size()) {
+                                fail(tmp, "ERROR");
+                                break;
+                            }
+                        }
+                    } catch (std::logic_error &) {
+                        fail(tmp, "ERROR");
+                        break;
+                    }
+                    if (kvs->increment(kvp.key(), delta, result, durability)) {
+                        tmp->set_value(std::to_string(result));
+                    } else {
+                        fail(tmp, "ERROR");
+                    }
+                    break;
+                }
+                case cloud::CloudMessage_Operation_APPEND: {
+                    std::string result;
+                    if (kvs->append(kvp.key(), kvp.value(), result, durability)) {
+                        tmp->set_value(result);
+                    } else {
+                        fail(tmp, "ERROR");
+                    }
+                    break;
+                }
+                default:
+                    fail(tmp, "ERROR");
+                    break;
+            }
+        }
+
+        response.set_timestamp(clock->current());
+        con.send(response);
+    }
+
+    auto P2PHandler::is_locked(const std::string &key) -> bool {
+        return !locked_keys.empty() && locked_keys.contains(key);
+    }
+
+    auto P2PHandler::release(uint64_t transaction_id) -> void {
+        auto search = prepared.find(transaction_id);
+        if (search == prepared.end()) return;
+        for (auto &[id, writes]: search->second.writes) {
+            for (auto &write: writes) locked_keys.erase(write.key);
+        }
+        prepared.erase(search);
+    }
+
+    auto P2PHandler::handle_txn_prepare(Connection &con, const cloud::CloudMessage &msg)
+    -> void {
+        auto &response = arena_message<cloud::CloudMessage>();
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(cloud::CloudMessage_Operation_TXN_PREPARE);
+        response.set_transaction_id(msg.transaction_id());
+        response.set_success(true);
+        response.set_message("OK");
+
+        // a prepared transaction keeps its locks until the coordinator
+        // decided, a participant that aborted on its own could miss a commit
+        // that the other participants apply
+        std::lock_guard<std::shared_mutex> lck(txn_mtx);
+        if (aborted.contains(msg.transaction_id())) {
+            response.set_success(false);
+            response.set_message("ERROR");
+            con.send(response);
+            return;
+        }
+
+        PreparedTransaction txn{};
+        txn.durability = to_durability(msg.durability(), storage->get_config().durability);
+
+        // validate all keys before locking any of them, a key is in conflict
+        // if another transaction locked it or if its value is not the expected
+        // one
+        for (const auto &kvp: msg.kvp()) {
+            auto *tmp = response.add_kvp();
+            tmp->set_key(kvp.key());
+            auto id = routing.get_partition(kvp.key());
+            auto kvs = partitions.get_writable(id);
+            if (!kvs) {
+                not_owner(partitions, response, *tmp, id);
+                continue;
+            }
+            if (locked_keys.contains(kvp.key())) {
+                tmp->set_value("CONFLICT");
+                if (response.success()) response.set_message("CONFLICT");
+                response.set_success(false);
+                continue;
+            }
+            if (kvp.has_expected()) {
+                std::string current;
+                if (!kvs->get(kvp.key(), current)) current = "";
+                if (current != kvp.expected()) {
+                    tmp->set_value(current);
+                    if (response.success()) response.set_message("CONFLICT");
+                    response.set_success(false);
+                    continue;
+                }
+            }
+            tmp->set_value("OK");
+            txn.writes[id].push_back({kvp.key(), kvp.value(), kvp.ttl()});
+            if (!txn.handles.contains(id)) txn.handles.emplace(id, std::move(kvs));
+        }
+
+        if (response.success()) {
+            for (auto &[id, writes]: txn.writes) {
+                for (auto &write: writes) locked_keys.insert(write.key);
+            }
+            prepared[msg.transaction_id()] = std::move(txn);
+        }
+
+        con.send(response);
+    }
+
+    auto P2PHandler::handle_txn_commit(Connection &con, const cloud::CloudMessage &msg)
+    -> void {
+        auto &response = arena_message<cloud::CloudMessage>();
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(cloud::CloudMessage_Operation_TXN_COMMIT);
+        response.set_transaction_id(msg.transaction_id());
+        response.set_success(true);
+        response.set_message("OK");
+
+        std::lock_guard<std::shared_mutex> lck(txn_mtx);
+        auto search = prepared.find(msg.transaction_id());
+        if (search == prepared.end()) {
+            // never prepared on this peer, e.g., the prepare was dropped
+            response.set_success(false);
+            response.set_message("ERROR");
+            con.send(response);
+            return;
+        }
+
+        // the writes of every partition are applied as one batch
+        auto &txn = search->second;
+        response.set_durability(from_durability(txn.durability));
+        for (auto &[id, writes]: txn.writes) {
+            auto &kvs = txn.handles.at(id);
+            if (!kvs->write(writes, txn.durability)) {
+                response.set_success(false);
+                response.set_message("ERROR");
+            }
+        }
+        release(msg.transaction_id());
+
+        response.set_timestamp(clock->current());
+        con.send(response);
+    }
+
+    auto P2PHandler::handle_txn_abort(Connection &con, const cloud::CloudMessage &msg)
+    -> void {
+        auto &response = arena_message<cloud::CloudMessage>();
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(cloud::CloudMessage_Operation_TXN_ABORT);
+        response.set_transaction_id(msg.transaction_id());
+        response.set_success(true);
+        response.set_message("OK");
+
+        std::lock_guard<std::shared_mutex> lck(txn_mtx);
+        if (!prepared.contains(msg.transaction_id()) && aborted.insert(msg.transaction_id()).second) {
+            aborted_order.push_back(msg.transaction_id());
+            if (aborted_order.size() > txn_aborted_capacity) {
+                aborted.erase(aborted_order.front());
+                aborted_order.pop_front();
+            }
+        }
+        release(msg.transaction_id());
+
         con.send(response);
     }
 
@@ -161,38 +567,31 @@ namespace cloudlab {
         response.set_operation(cloud::CloudMessage_Operation_JOIN_CLUSTER);
         response.set_message("OK");
         response.set_success(true);
-        cloud::CloudMessage requestresponse;
-        requestresponse.set_type(cloud::CloudMessage_Type_REQUEST);
-        requestresponse.set_operation(cloud::CloudMessage_Operation_PARTITIONS_REMOVED);
-        requestresponse.set_message("OK");
-        requestresponse.set_success(true);
 
+        uint64_t sequence = 0;
         std::vector<std::pair<std::string, std::string>> keyvalues;
-        for (auto it = partitions.begin(); it != partitions.end();) {
-            if (it->second) {
-                if (!it->second->get_all(keyvalues)) {
-                    response.set_success(false);
-                    response.set_message("ERROR");
-
-                }
-                it->second->clear();
-
+        std::vector<uint64_t> ttls;
+        for (auto id: partitions.ids()) {
+            // the router takes over the data of the partition. No write may
+            // change it after it was copied, and requests that still hold it
+            // fail once it is cleared.
+            partitions.migrate_out(id, "");
+            auto kvs = partitions.remove(id);
+            sequence = metadata.publish(id, msg.address().address(), true);
+            if (!kvs) continue;
+            if (!kvs->get_all(keyvalues, &ttls)) {
+                response.set_success(false);
+                response.set_message("ERROR");
             }
-            auto tmp = requestresponse.add_partition();
-            tmp->set_peer(msg.address().address());
-            tmp->set_id(it->first);
-            it = partitions.erase(it);
+            kvs->clear();
         }
-        for (auto &keyvalue: keyvalues) {
+        for (size_t i = 0; i < keyvalues.size(); i++) {
             auto tmp = response.add_kvp();
-            tmp->set_value(keyvalue.second);
-            tmp->set_key(keyvalue.first);
-        }
-        Connection con1(routing.get_cluster_address().value());
-        con1.send(requestresponse);
-        con1.receive(requestresponse);
-        response.set_message(requestresponse.message());
-        response.set_success(requestresponse.success());
+            tmp->set_value(keyvalues[i].second);
+            tmp->set_key(keyvalues[i].first);
+            tmp->set_ttl(ttls[i]);
+        }
+        add_barrier(response, sequence);
         con.send(response);
 
     }
@@ -203,23 +602,15 @@ namespace cloudlab {
         cloud::CloudMessage response;
         response.set_type(cloud::CloudMessage_Type_RESPONSE);
         response.set_operation(cloud::CloudMessage_Operation_CREATE_PARTITIONS);
-        cloud::CloudMessage requestresponse;
-        requestresponse.set_type(cloud::CloudMessage_Type_REQUEST);
-        requestresponse.set_operation(cloud::CloudMessage_Operation_PARTITIONS_ADDED);
-        requestresponse.set_message("OK");
-        requestresponse.set_success(true);
+        response.set_message("OK");
+        response.set_success(true);
+        uint64_t sequence = 0;
         for (auto &part: msg.partition()) {
             auto path = fmt::format("/tmp/{}", part.id());
-            partitions.insert({part.id(), std::make_unique<KVS>(path)});
-            auto tmp = requestresponse.add_partition();
-            tmp->set_peer(msg.address().address());
-            tmp->set_id(part.id());
-        }
-        Connection con1{routing.get_cluster_address().value()};
-        con1.send(requestresponse);
-        con1.receive(requestresponse);
-        response.set_message(requestresponse.message());
-        response.set_success(requestresponse.success());
+            partitions.install(part.id(), std::make_shared<KVS>(path, false, storage, clock));
+            sequence = metadata.publish(part.id(), msg.address().address(), false);
+        }
+        add_barrier(response, sequence);
         con.send(response);
     }
 
@@ -230,18 +621,15 @@ namespace cloudlab {
         cloud::CloudMessage response;
         response.set_type(cloud::CloudMessage_Type_RESPONSE);
         response.set_operation(cloud::CloudMessage_Operation_STEAL_PARTITIONS);
-        cloud::CloudMessage requestresponse;
-        requestresponse.set_type(cloud::CloudMessage_Type_REQUEST);
-        requestresponse.set_operation(cloud::CloudMessage_Operation_PARTITIONS_ADDED);
-        requestresponse.set_message("OK");
-        requestresponse.set_success(true);
+        response.set_message("OK");
+        response.set_success(true);
+        uint64_t sequence = 0;
 
         for (auto &part: msg.partition()) {
             auto path = fmt::format("/tmp/{}", part.id());
-            partitions.insert({part.id(), std::make_unique<KVS>(path)});
-            auto tmp = requestresponse.add_partition();
-            tmp->set_peer(msg.address().address());
-            tmp->set_id(part.id());
+            partitions.install(part.id(), std::make_shared<KVS>(path, false, storage, clock),
+                               PartitionState::MIGRATING_IN);
+            sequence = metadata.publish(part.id(), msg.address().address(), false);
             auto x = tosend.find(SocketAddress(part.peer()));
             if (x == tosend.end()) {
                 std::pair p{std::make_unique<Connection>(SocketAddress(part.peer())),
@@ -252,17 +640,15 @@ namespace cloudlab {
                 address->set_address(part.peer());
                 auto tmp1 = p.second->add_partition();
                 tmp1->set_id(part.id());
+                tmp1->set_peer(msg.address().address());
                 tosend.insert({SocketAddress(part.peer()), std::move(p)});
             } else {
                 auto tmp1 = x->second.second->add_partition();
                 tmp1->set_id(part.id());
+                tmp1->set_peer(msg.address().address());
             }
         }
-        Connection con1{routing.get_cluster_address().value()};
-        con1.send(requestresponse);
-        con1.receive(requestresponse);
-        response.set_success(requestresponse.success());
-        response.set_message(requestresponse.message());
+        add_barrier(response, sequence);
         for (auto &s: tosend) {
             s.second.first->send(*s.second.second);
         }
@@ -272,8 +658,12 @@ namespace cloudlab {
                 response.set_success(false);
                 response.set_message("ERROR");
             }
+            // the peers report the dropped partitions themselves
+            response.mutable_barrier()->MergeFrom(r.second.second->barrier());
+        }
+        for (auto &part: msg.partition()) {
+            partitions.set_state(part.id(), PartitionState::ACTIVE);
         }
-
 
         con.send(response);
     }
@@ -284,24 +674,15 @@ namespace cloudlab {
         cloud::CloudMessage response;
         response.set_type(cloud::CloudMessage_Type_RESPONSE);
         response.set_operation(cloud::CloudMessage_Operation_DROP_PARTITIONS);
-        cloud::CloudMessage requestresponse;
-        requestresponse.set_type(cloud::CloudMessage_Type_REQUEST);
-        requestresponse.set_operation(cloud::CloudMessage_Operation_PARTITIONS_REMOVED);
-        requestresponse.set_message("OK");
-        requestresponse.set_success(true);
+        response.set_message("OK");
+        response.set_success(true);
+        uint64_t sequence = 0;
         for (auto &part: msg.partition()) {
-            auto search = partitions.find(part.id());
-            if (search != partitions.end()) partitions.erase(search);
-            auto tmp = requestresponse.add_partition();
-            tmp->set_peer(msg.address().address());
-            tmp->set_id(part.id());
-        }
-        Connection con1{routing.get_cluster_address().value()};
-        con1.send(requestresponse);
-        con1.receive(requestresponse);
-
-        response.set_message(requestresponse.message());
-        response.set_success(requestresponse.success());
+            // STEAL names the peer that took the partition over
+            partitions.remove(part.id(), part.peer());
+            sequence = metadata.publish(part.id(), msg.address().address(), true);
+        }
+        add_barrier(response, sequence);
         con.send(response);
 
     }
@@ -313,18 +694,14 @@ namespace cloudlab {
         cloud::CloudMessage response;
         response.set_type(cloud::CloudMessage_Type_RESPONSE);
         response.set_operation(cloud::CloudMessage_Operation_TRANSFER_PARTITION);
-        cloud::CloudMessage requestresponse;
-        requestresponse.set_type(cloud::CloudMessage_Type_REQUEST);
-        requestresponse.set_operation(cloud::CloudMessage_Operation_PARTITIONS_REMOVED);
-        requestresponse.set_message("OK");
-        requestresponse.set_success(true);
+        response.set_message("OK");
+        response.set_success(true);
+        uint64_t sequence = 0;
 
         for (auto &part: msg.partition()) {
-            auto search = partitions.find(part.id());
-            if (search != partitions.end()) partitions.erase(search);
-            auto tmp = requestresponse.add_partition();
-            tmp->set_peer(msg.address().address());
-            tmp->set_id(part.id());
+            // reads are served until the new owners created the partitions
+            partitions.migrate_out(part.id(), part.peer());
+            sequence = metadata.publish(part.id(), msg.address().address(), true);
             auto x = tosend.find(SocketAddress(part.peer()));
             if (x == tosend.end()) {
                 std::pair p{std::make_unique<Connection>(SocketAddress(part.peer())),
@@ -341,11 +718,7 @@ namespace cloudlab {
                 tmp1->set_id(part.id());
             }
         }
-        Connection con1{routing.get_cluster_address().value()};
-        con1.send(requestresponse);
-        con1.receive(requestresponse);
-        response.set_success(requestresponse.success());
-        response.set_message(requestresponse.message());
+        add_barrier(response, sequence);
         for (auto &s: tosend) {
             s.second.first->send(*s.second.second);
         }
@@ -356,8 +729,35 @@ namespace cloudlab {
                 response.set_success(false);
                 response.set_message("ERROR");
             }
+            response.mutable_barrier()->MergeFrom(r.second.second->barrier());
+        }
+        for (auto &part: msg.partition()) {
+            partitions.remove(part.id(), part.peer());
+        }
+        con.send(response);
+    }
+
+    auto P2PHandler::add_barrier(cloud::CloudMessage &response, uint64_t sequence) -> void {
+        if (sequence == 0) return;
+        auto barrier = response.add_barrier();
+        barrier->set_peer(metadata.get_sender());
+        barrier->set_sequence(sequence);
+    }
+
+    auto P2PHandler::handle_stats(Connection &con, const cloud::CloudMessage &/*msg*/)
+    -> void {
+        cloud::CloudMessage response;
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(cloud::CloudMessage_Operation_STATS);
+        response.set_success(true);
+        response.set_message("OK");
+
+        for (auto &[name, value]: metrics().samples()) {
+            auto tmp = response.add_kvp();
+            tmp->set_key(name);
+            tmp->set_value(value);
         }
         con.send(response);
     }
 
-}  // namespace cloudlab
\ No newline at end of file
+}  // namespace cloudlab
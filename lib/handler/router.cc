@@ -1,7 +1,13 @@
 #include "cloudlab/handler/router.hh"
+#include "cloudlab/network/event_loop.hh"
+#include "cloudlab/tracing.hh"
 
 #include "fmt/core.h"
 
+#include <algorithm>
+#include <csignal>
+#include <sys/socket.h>
+
 #include "cloud.pb.h"
 
 namespace cloudlab {
@@ -9,20 +15,55 @@ namespace cloudlab {
     }
 
     auto RouterHandler::handle_connection(Connection &con) -> void {
-        cloud::CloudMessage request{}, response{};
+        // workers have no event loop, waiting for the peers blocks them
+        handle_connection_async(con).get();
+    }
+
+    auto RouterHandler::is_async(const Connection &con) const -> bool {
+        int operation{};
+        if (!con.peek_operation(operation)) return false;
+        switch (operation) {
+            case cloud::CloudMessage_Operation_PUT:
+            case cloud::CloudMessage_Operation_GET:
+            case cloud::CloudMessage_Operation_DELETE:
+            case cloud::CloudMessage_Operation_COMPARE_AND_SWAP:
+            case cloud::CloudMessage_Operation_INCREMENT:
+            case cloud::CloudMessage_Operation_APPEND:
+            case cloud::CloudMessage_Operation_TRANSACTION:
+                return true;
+            default:
+                // joins wait for PARTITIONS_CHANGED batches that the event
+                // loop of this server reads, so they must not block it
+                return false;
+        }
+    }
+
+    auto RouterHandler::handle_connection_async(Connection &con) -> Task<> {
+        // requests of other connections interleave on the event loop, so the
+        // messages live in the coroutine instead of the thread's arena
+        cloud::CloudMessage request{};
 
-        if (!con.receive(request)) {
-            return;
+        if (!co_await con.async_receive(request)) {
+            co_return;
         }
 
-        response.set_type(cloud::CloudMessage_Type_RESPONSE);
-        response.set_operation(request.operation());
+        ScopedSpan span{cloud::CloudMessage_Operation_Name(request.operation()),
+                        {request.trace_id(), request.span_id()}, Tracer::enqueued_at()};
+        tracer().record_arrival(span.context());
 
+        auto started_at = std::chrono::steady_clock::now();
         switch (request.operation()) {
             case cloud::CloudMessage_Operation_PUT:
             case cloud::CloudMessage_Operation_GET:
-            case cloud::CloudMessage_Operation_DELETE: {
-                handle_key_operation(con, request);
+            case cloud::CloudMessage_Operation_DELETE:
+            case cloud::CloudMessage_Operation_COMPARE_AND_SWAP:
+            case cloud::CloudMessage_Operation_INCREMENT:
+            case cloud::CloudMessage_Operation_APPEND: {
+                co_await handle_key_operation(con, request);
+                break;
+            }
+            case cloud::CloudMessage_Operation_TRANSACTION: {
+                co_await handle_transaction(con, request);
                 break;
             }
             case cloud::CloudMessage_Operation_JOIN_CLUSTER: {
@@ -37,41 +78,114 @@ namespace cloudlab {
                 handle_partitions_removed(con, request);
                 break;
             }
+            case cloud::CloudMessage_Operation_PARTITIONS_CHANGED: {
+                handle_partitions_changed(con, request);
+                break;
+            }
+            case cloud::CloudMessage_Operation_STATS: {
+                handle_stats(con, request);
+                break;
+            }
             default:
                 break;
         }
+        operations.record(request.operation(), cloud::CloudMessage_Operation_Name(request.operation()),
+                          std::chrono::steady_clock::now() - started_at);
     }
 
     auto RouterHandler::handle_key_operation(Connection &con,
                                              const cloud::CloudMessage &msg)
-    -> void {
+    -> Task<> {
         signal(SIGPIPE, sigpipehandler);
-        cloud::CloudMessage response;
+        cloud::CloudMessage response{};
         response.set_operation(msg.operation());
         response.set_success(true);
         response.set_message("OK");
         response.set_type(cloud::CloudMessage_Type_RESPONSE);
-        std::unordered_map<SocketAddress, std::pair<std::unique_ptr<Connection>, std::unique_ptr<cloud::CloudMessage>>> tosend;
+
+        // requests without a deadline get the default one s.t. a stuck peer
+        // cannot hold this request forever
+        auto deadline = msg.deadline() ? msg.deadline() : now_ms() + request_timeout_ms;
+        if (now_ms() >= deadline) {
+            response.set_success(false);
+            response.set_message("DEADLINE_EXCEEDED");
+            co_await con.async_send(response);
+            co_return;
+        }
+
+        std::unordered_map<SocketAddress, PeerRequest> tosend;
+        std::unordered_set<SocketAddress> unreachable;
+        // keys that their peer does not own anymore
+        std::vector<Redirect> moved;
+        // second peer that stores all keys of a GET sent to a peer, if any
+        std::unordered_map<SocketAddress, std::optional<SocketAddress>> alternatives;
+        // tokens of hot keys whose values may be cached once they arrive
+        std::unordered_map<std::string, uint64_t> fill_tokens;
+        auto is_get = msg.operation() == cloud::CloudMessage_Operation_GET;
+        auto is_read_modify_write = msg.operation() == cloud::CloudMessage_Operation_COMPARE_AND_SWAP ||
+                                    msg.operation() == cloud::CloudMessage_Operation_INCREMENT ||
+                                    msg.operation() == cloud::CloudMessage_Operation_APPEND;
+        // GETs of several keys read all of them at one timestamp s.t. they
+        // observe a consistent state, even if the keys live on different peers
+        uint64_t timestamp = 0;
+        if (is_get) {
+            timestamp = msg.timestamp();
+            if (timestamp && !HybridLogicalClock::is_plausible(timestamp)) {
+                response.set_success(false);
+                response.set_message("TIMESTAMP_IN_FUTURE");
+                co_await con.async_send(response);
+                co_return;
+            }
+            if (timestamp) {
+                clock.update(timestamp);
+            } else if (msg.kvp_size() > 1) {
+                timestamp = clock.now();
+            }
+            response.set_timestamp(timestamp);
+        }
         for (auto &kvp: msg.kvp()) {
+            if (is_get) {
+                hot_keys.record(kvp.key());
+                // the cache only holds the latest values
+                std::string value;
+                if (!timestamp && hot_keys.lookup(kvp.key(), value)) {
+                    auto tmp = response.add_kvp();
+                    tmp->set_key(kvp.key());
+                    tmp->set_value(value);
+                    continue;
+                }
+                if (!timestamp) fill_tokens.insert({kvp.key(), hot_keys.fill_token(kvp.key())});
+            } else {
+                hot_keys.invalidate(kvp.key());
+            }
             auto h = routing.find_peer(kvp.key());
             if (!h.has_value()) continue;
+            if (is_get && hedging.enabled()) {
+                std::optional<SocketAddress> alternative;
+                for (auto &peer: routing.find_peers(kvp.key())) {
+                    if (peer != h.value()) {
+                        alternative = peer;
+                        break;
+                    }
+                }
+                auto a = alternatives.find(h.value());
+                if (a == alternatives.end()) {
+                    alternatives.insert({h.value(), alternative});
+                } else if (a->second != alternative) {
+                    a->second.reset();
+                }
+            }
             auto x = tosend.find(h.value());
             if (x == tosend.end()) {
-                std::pair p{std::make_unique<Connection>(h.value()), std::make_unique<cloud::CloudMessage>()};
-                p.second->set_operation(msg.operation());
-                p.second->set_type(cloud::CloudMessage_Type_REQUEST);
-                auto tmp = p.second->add_kvp();
-                tmp->set_key(kvp.key());
-                tmp->set_value(kvp.value());
-                tosend.insert({h.value(), std::move(p)});
-            } else {
-                auto tmp = x->second.second->add_kvp();
-                tmp->set_value(kvp.value());
-                tmp->set_key(kvp.key());
+                x = tosend.insert({h.value(), co_await peer_request(msg, h.value(), timestamp, deadline)}).first;
             }
+            *x->second.second->add_kvp() = kvp;
         }
+        auto sent_at = std::chrono::steady_clock::now();
         for (auto &sendpair: tosend) {
-            if (!sendpair.second.first->send(*sendpair.second.second)) {
+            if (sendpair.second.first->connect_failed ||
+                !co_await sendpair.second.first->async_send(*sendpair.second.second)) {
+                unreachable.insert(sendpair.first);
                 for (auto &kvp: sendpair.second.second->kvp()) {
                     auto tmp = response.add_kvp();
                     tmp->set_key(kvp.key());
@@ -80,18 +194,364 @@ namespace cloudlab {
             }
         }
         for (auto &r: tosend) {
-            r.second.first->receive(*r.second.second);
-            if (!r.second.second->success() && msg.operation() == cloud::CloudMessage_Operation_PUT) {
+            if (unreachable.contains(r.first)) continue;
+            auto received = false;
+            if (is_get && hedging.enabled()) {
+                auto a = alternatives.find(r.first);
+                received = co_await receive_hedged(r.second, a != alternatives.end() ? a->second : std::nullopt,
+                                                   sent_at, deadline);
+            } else {
+                received = co_await r.second.first->async_receive(*r.second.second);
+            }
+            if (!received) {
+                // the peer failed or did not answer in time, the request still
+                // holds the keys sent to it
+                for (auto &kvp: r.second.second->kvp()) {
+                    hot_keys.invalidate(kvp.key());
+                    auto tmp = response.add_kvp();
+                    tmp->set_key(kvp.key());
+                    tmp->set_value("ERROR");
+                }
+                if (now_ms() >= deadline) {
+                    response.set_success(false);
+                    response.set_message("DEADLINE_EXCEEDED");
+                }
+                continue;
+            }
+            // keys answered with NOT_OWNER are sent to their owner below
+            auto failed = !r.second.second->success() && r.second.second->message() != "NOT_OWNER";
+            if (failed && msg.operation() == cloud::CloudMessage_Operation_PUT) {
                 response.set_success(false);
                 response.set_message("ERROR");
             }
+            if (failed && is_read_modify_write) {
+                response.set_success(false);
+                response.set_message(r.second.second->message());
+            }
+            // overloaded peers shed requests without handling them
+            if (r.second.second->message() == "BUSY" ||
+                (is_get && r.second.second->message() == "SNAPSHOT_TOO_OLD")) {
+                response.set_success(false);
+                response.set_message(r.second.second->message());
+            }
+            response.set_durability(r.second.second->durability());
+            if (!is_get) clock.update(r.second.second->timestamp());
             for (auto &kvp: r.second.second->kvp()) {
+                if (kvp.value() == "NOT_OWNER") {
+                    std::string owner;
+                    auto id = routing.get_partition(kvp.key());
+                    for (auto &p: r.second.second->partition()) {
+                        if (p.id() == id) owner = p.peer();
+                    }
+                    moved.push_back({kvp.key(), r.first, owner});
+                    continue;
+                }
                 auto tmp = response.add_kvp();
                 tmp->set_key(kvp.key());
                 tmp->set_value(kvp.value());
+                tmp->set_ttl(kvp.ttl());
+                tmp->set_version(kvp.version());
+                if (!is_get) {
+                    hot_keys.invalidate(kvp.key());
+                    continue;
+                }
+                // values with a time to live are not cached s.t. they cannot
+                // outlive it at the router
+                auto token = fill_tokens.find(kvp.key());
+                if (token != fill_tokens.end() && kvp.value() != "ERROR" && kvp.ttl() == 0) {
+                    hot_keys.fill(kvp.key(), kvp.value(), token->second);
+                }
             }
         }
-        con.send(response);
+        if (!moved.empty()) co_await redirect(msg, moved, timestamp, deadline, response);
+        if (!is_get) response.set_timestamp(clock.current());
+        co_await con.async_send(response);
+    }
+
+    auto RouterHandler::peer_request(const cloud::CloudMessage &msg, const SocketAddress &peer,
+                                     uint64_t timestamp, uint64_t deadline) -> Task<PeerRequest> {
+        // the connection is bounded by the deadline as well
+        PeerRequest p{co_await Connection::async_connect(peer, deadline),
+                      std::make_unique<cloud::CloudMessage>()};
+        p.second->set_operation(msg.operation());
+        p.second->set_type(cloud::CloudMessage_Type_REQUEST);
+        p.second->set_durability(msg.durability());
+        p.second->set_timestamp(timestamp);
+        p.second->set_deadline(deadline);
+        p.second->set_trace_id(Tracer::current().trace_id);
+        p.second->set_span_id(Tracer::current().span_id);
+        // peers of this version understand the compact format, large
+        // batches are compressed
+        p.first->set_compact(true);
+        p.first->set_compression(true);
+        co_return p;
+    }
+
+    auto RouterHandler::redirect(const cloud::CloudMessage &msg, const std::vector<Redirect> &moved,
+                                 uint64_t timestamp, uint64_t deadline,
+                                 cloud::CloudMessage &response) -> Task<> {
+        auto is_get = msg.operation() == cloud::CloudMessage_Operation_GET;
+        std::unordered_map<std::string, const cloud::CloudMessage_KeyValuePair *> requested;
+        for (auto &kvp: msg.kvp()) {
+            requested.insert({kvp.key(), &kvp});
+        }
+
+        std::unordered_map<SocketAddress, PeerRequest> tosend;
+        for (auto &m: moved) {
+            redirects.add();
+            // without a hint, another peer of the partition may own it already
+            std::optional<SocketAddress> owner;
+            if (!m.owner.empty()) {
+                owner = SocketAddress(m.owner);
+            } else {
+                for (auto &peer: routing.find_peers(m.key)) {
+                    if (peer != m.stale) {
+                        owner = peer;
+                        break;
+                    }
+                }
+            }
+            auto kvp = requested.find(m.key);
+            if (!owner.has_value() || owner.value() == m.stale || kvp == requested.end()) {
+                auto tmp = response.add_kvp();
+                tmp->set_key(m.key);
+                tmp->set_value("ERROR");
+                continue;
+            }
+            auto x = tosend.find(owner.value());
+            if (x == tosend.end()) {
+                x = tosend.insert({owner.value(), co_await peer_request(msg, owner.value(), timestamp, deadline)}).first;
+            }
+            *x->second.second->add_kvp() = *kvp->second;
+        }
+
+        // keys are redirected once, a peer that does not own them either
+        // makes them fail
+        for (auto &r: tosend) {
+            auto &reply = *r.second.second;
+            if (r.second.first->connect_failed || !co_await r.second.first->async_send(reply) ||
+                !co_await r.second.first->async_receive(reply)) {
+                for (auto &kvp: reply.kvp()) {
+                    hot_keys.invalidate(kvp.key());
+                    auto tmp = response.add_kvp();
+                    tmp->set_key(kvp.key());
+                    tmp->set_value("ERROR");
+                }
+                continue;
+            }
+            if (!reply.success() && (!is_get || reply.message() == "BUSY" ||
+                                     reply.message() == "SNAPSHOT_TOO_OLD")) {
+                response.set_success(false);
+                response.set_message(reply.message() == "NOT_OWNER" ? "ERROR" : reply.message());
+            }
+            if (!is_get) clock.update(reply.timestamp());
+            for (auto &kvp: reply.kvp()) {
+                if (!is_get) hot_keys.invalidate(kvp.key());
+                auto tmp = response.add_kvp();
+                tmp->set_key(kvp.key());
+                tmp->set_value(kvp.value() == "NOT_OWNER" ? "ERROR" : kvp.value());
+                tmp->set_ttl(kvp.ttl());
+                tmp->set_version(kvp.version());
+            }
+        }
+    }
+
+    auto RouterHandler::receive_hedged(PeerRequest &request,
+                                       const std::optional<SocketAddress> &alternative,
+                                       std::chrono::steady_clock::time_point sent_at,
+                                       uint64_t deadline) -> Task<bool> {
+        using namespace std::chrono;
+        hedging.request();
+        auto &primary = request.first;
+        auto &msg = *request.second;
+        auto remaining = [deadline]() -> microseconds {
+            auto now = now_ms();
+            return milliseconds(deadline > now ? deadline - now : 0);
+        };
+        auto receive = [&](Connection &con) -> Task<bool> {
+            if (!co_await con.async_receive(msg)) co_return false;
+            hedging.record(duration_cast<microseconds>(steady_clock::now() - sent_at));
+            co_return true;
+        };
+
+        // wait for the peer until the hedge delay elapsed
+        auto hedge_delay = hedging.delay();
+        if (!alternative.has_value() || hedge_delay == microseconds::max()) {
+            co_return co_await receive(*primary);
+        }
+        auto until_hedge = duration_cast<microseconds>(sent_at + hedge_delay - steady_clock::now());
+        if (co_await EventLoop::wait_readable(primary->get_fd(),
+                                              std::clamp(until_hedge, microseconds(0), remaining())) >= 0 ||
+            remaining() == microseconds(0) || !hedging.try_hedge()) {
+            co_return co_await receive(*primary);
+        }
+
+        // the request message is still unchanged as nothing was received yet
+        auto hedge = co_await Connection::async_connect(alternative.value(), deadline);
+        hedge->set_compact(true);
+        hedge->set_compression(true);
+        if (hedge->connect_failed || !co_await hedge->async_send(msg)) {
+            co_return co_await receive(*primary);
+        }
+        auto first = co_await EventLoop::wait_readable(primary->get_fd(), hedge->get_fd(), remaining());
+
+        // the loser is reset instead of closed gracefully s.t. the peer drops
+        // the connection as soon as it tries to send its response
+        auto cancel = [](std::unique_ptr<Connection> &con) {
+            linger reset{1, 0};
+            setsockopt(con->get_fd(), SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+            con.reset();
+        };
+        if (first == 1) {
+            if (co_await receive(*hedge)) {
+                hedging.won();
+                cancel(primary);
+                primary = std::move(hedge);
+                co_return true;
+            }
+            co_return co_await receive(*primary);
+        }
+        if (co_await receive(*primary)) {
+            cancel(hedge);
+            co_return true;
+        }
+        if (!co_await receive(*hedge)) co_return false;
+        hedging.won();
+        primary = std::move(hedge);
+        co_return true;
+    }
+
+    auto RouterHandler::handle_transaction(Connection &con,
+                                           const cloud::CloudMessage &msg)
+    -> Task<> {
+        signal(SIGPIPE, sigpipehandler);
+        cloud::CloudMessage response{};
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(cloud::CloudMessage_Operation_TRANSACTION);
+        response.set_success(true);
+        response.set_message("OK");
+        auto transaction_id = next_transaction_id++;
+        response.set_transaction_id(transaction_id);
+
+        auto deadline = msg.deadline() ? msg.deadline() : now_ms() + request_timeout_ms;
+        if (now_ms() >= deadline) {
+            response.set_success(false);
+            response.set_message("DEADLINE_EXCEEDED");
+            co_await con.async_send(response);
+            co_return;
+        }
+
+        // phase 1: every peer that owns one of the keys validates and locks
+        // its part of the transaction
+        std::unordered_map<SocketAddress, PeerRequest> tosend;
+        for (auto &kvp: msg.kvp()) {
+            hot_keys.invalidate(kvp.key());
+            auto h = routing.find_peer(kvp.key());
+            if (!h.has_value()) {
+                auto tmp = response.add_kvp();
+                tmp->set_key(kvp.key());
+                tmp->set_value("ERROR");
+                response.set_success(false);
+                response.set_message("ERROR");
+                continue;
+            }
+            auto x = tosend.find(h.value());
+            if (x == tosend.end()) {
+                PeerRequest p{co_await Connection::async_connect(h.value(), deadline),
+                              std::make_unique<cloud::CloudMessage>()};
+                p.second->set_operation(cloud::CloudMessage_Operation_TXN_PREPARE);
+                p.second->set_type(cloud::CloudMessage_Type_REQUEST);
+                p.second->set_durability(msg.durability());
+                p.second->set_transaction_id(transaction_id);
+                p.second->set_deadline(deadline);
+                p.second->set_trace_id(Tracer::current().trace_id);
+                p.second->set_span_id(Tracer::current().span_id);
+                p.first->set_compression(true);
+                x = tosend.insert({h.value(), std::move(p)}).first;
+            }
+            *x->second.second->add_kvp() = kvp;
+        }
+        if (!response.success()) {
+            co_await con.async_send(response);
+            co_return;
+        }
+
+        for (auto &sendpair: tosend) {
+            if (sendpair.second.first->connect_failed ||
+                !co_await sendpair.second.first->async_send(*sendpair.second.second)) {
+                response.set_success(false);
+                response.set_message("ERROR");
+            }
+        }
+        for (auto &r: tosend) {
+            cloud::CloudMessage vote{};
+            if (!co_await r.second.first->async_receive(vote)) {
+                response.set_success(false);
+                response.set_message(now_ms() >= deadline ? "DEADLINE_EXCEEDED" : "ERROR");
+                continue;
+            }
+            if (vote.success()) continue;
+            // conflicts are reported with the current value of the key
+            for (auto &kvp: vote.kvp()) {
+                if (kvp.value() == "OK") continue;
+                auto tmp = response.add_kvp();
+                tmp->set_key(kvp.key());
+                tmp->set_value(kvp.value());
+            }
+            if (response.success() || vote.message() == "ERROR") {
+                response.set_message(vote.message());
+            }
+            response.set_success(false);
+        }
+
+        // phase 2: commit if all peers voted yes, abort everywhere otherwise.
+        // The decision has no deadline, peers must apply it even if it
+        // arrives late. A peer that does not confirm it in time gets it again
+        // in the background until it answers, the outcome for its keys is
+        // unknown to the client until then.
+        auto decision_deadline = now_ms() + request_timeout_ms;
+        auto commit = response.success();
+        std::vector<std::pair<SocketAddress, PeerRequest>> outcomes;
+        for (auto &r: tosend) {
+            cloud::CloudMessage request{};
+            request.set_type(cloud::CloudMessage_Type_REQUEST);
+            request.set_operation(commit ? cloud::CloudMessage_Operation_TXN_COMMIT
+                                         : cloud::CloudMessage_Operation_TXN_ABORT);
+            request.set_transaction_id(transaction_id);
+            request.set_trace_id(Tracer::current().trace_id);
+            request.set_span_id(Tracer::current().span_id);
+            auto peer = co_await Connection::async_connect(r.first, decision_deadline);
+            if (!peer->connect_failed && co_await peer->async_send(request)) {
+                outcomes.emplace_back(r.first, PeerRequest{std::move(peer), std::make_unique<cloud::CloudMessage>()});
+            } else {
+                decisions.resend(r.first, transaction_id, commit);
+                if (commit) {
+                    response.set_success(false);
+                    response.set_message("ERROR");
+                }
+            }
+        }
+        for (auto &[peer, outcome]: outcomes) {
+            auto &result = *outcome.second;
+            if (!co_await outcome.first->async_receive(result)) {
+                decisions.resend(peer, transaction_id, commit);
+                result.set_success(false);
+            }
+            if (commit) {
+                if (!result.success()) {
+                    response.set_success(false);
+                    response.set_message("ERROR");
+                }
+                response.set_durability(result.durability());
+                clock.update(result.timestamp());
+            }
+        }
+
+        for (auto &kvp: msg.kvp()) {
+            hot_keys.invalidate(kvp.key());
+        }
+        response.set_timestamp(clock.current());
+        co_await con.async_send(response);
     }
 
     auto RouterHandler::handle_join_cluster(Connection &con,
@@ -107,30 +567,36 @@ namespace cloudlab {
         requesttonode.set_type(cloud::CloudMessage_Type_REQUEST);
         auto address = requesttonode.mutable_address();
         address->set_address(msg.address().address());
+        // the node answers with all of its data
         Connection con1{msg.address().address()};
+        con1.set_compression(true);
         con1.send(requesttonode);
         cloud::CloudMessage responsefromnode;
         con1.receive(responsefromnode);
+        await_metadata(responsefromnode);
         response.set_success(responsefromnode.success());
         response.set_message(responsefromnode.message());
         add_new_node(SocketAddress(msg.address().address()));
-        std::unordered_map<SocketAddress, std::pair<std::unique_ptr<Connection>, std::unique_ptr<cloud::CloudMessage>>> tosend;
+        std::unordered_map<SocketAddress, PeerRequest> tosend;
         for (auto &kvp: responsefromnode.kvp()) {
             auto h = routing.find_peer(kvp.key());
             if (!h.has_value()) continue;
             auto x = tosend.find(h.value());
             if (x == tosend.end()) {
-                std::pair p{std::make_unique<Connection>(h.value()), std::make_unique<cloud::CloudMessage>()};
+                PeerRequest p{std::make_unique<Connection>(h.value()), std::make_unique<cloud::CloudMessage>()};
                 p.second->set_operation(cloud::CloudMessage_Operation_PUT);
                 p.second->set_type(cloud::CloudMessage_Type_REQUEST);
+                p.first->set_compression(true);
                 auto tmp = p.second->add_kvp();
                 tmp->set_key(kvp.key());
                 tmp->set_value(kvp.value());
+                tmp->set_ttl(kvp.ttl());
                 tosend.insert({h.value(), std::move(p)});
             } else {
                 auto tmp = x->second.second->add_kvp();
                 tmp->set_value(kvp.value());
                 tmp->set_key(kvp.key());
+                tmp->set_ttl(kvp.ttl());
             }
         }
         for (auto &sendpair: tosend) {
@@ -160,7 +626,9 @@ namespace cloudlab {
 
     auto RouterHandler::add_new_node(const SocketAddress &peer) -> void {
         nodes.insert(peer);
+        auto started_at = std::chrono::steady_clock::now();
         redistribute_partitions();
+        redistributions.record(std::chrono::steady_clock::now() - started_at);
     }
 
     auto RouterHandler::redistribute_partitions() -> void {
@@ -296,6 +764,7 @@ namespace cloudlab {
         }
         for (auto &receiver: tosend) {
             receiver.second.first->receive(*receiver.second.second);
+            await_metadata(*receiver.second.second);
         }
 
         auto iter2 = unassociated.begin();
@@ -324,6 +793,7 @@ namespace cloudlab {
         }
         for (auto &receiver: tosendcreate) {
             receiver.first->receive(*receiver.second);
+            await_metadata(*receiver.second);
         }
 
     }
@@ -362,4 +832,77 @@ namespace cloudlab {
         con.send(response);
     }
 
+    auto RouterHandler::handle_partitions_changed(Connection &con,
+                                                  const cloud::CloudMessage &msg)
+    -> void {
+        cloud::CloudMessage response;
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(cloud::CloudMessage_Operation_PARTITIONS_CHANGED);
+        response.set_message("OK");
+        response.set_success(true);
+        {
+            std::lock_guard<std::mutex> lck(metadata_mtx);
+            auto &applied = applied_sequences[msg.address().address()];
+            // a batch that is sent again because its acknowledgement got lost
+            // was applied already
+            if (msg.sequence() > applied) {
+                for (auto &p: msg.partition()) {
+                    if (p.removed()) {
+                        routing.remove_peer(p.id(), SocketAddress(p.peer()));
+                    } else {
+                        routing.add_peer(p.id(), SocketAddress(p.peer()));
+                    }
+                }
+                applied = msg.sequence();
+                metadata_applied.notify_all();
+            }
+            response.set_sequence(applied);
+        }
+        con.send(response);
+    }
+
+    auto RouterHandler::await_metadata(const cloud::CloudMessage &response) -> void {
+        auto until = std::chrono::steady_clock::now() + metadata_timeout;
+        std::unique_lock<std::mutex> lck(metadata_mtx);
+        for (auto &barrier: response.barrier()) {
+            metadata_applied.wait_until(lck, until, [&]() {
+                return applied_sequences[barrier.peer()] >= barrier.sequence();
+            });
+        }
+    }
+
+    auto RouterHandler::handle_stats(Connection &con,
+                                     const cloud::CloudMessage &/*msg*/)
+    -> void {
+        cloud::CloudMessage response;
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(cloud::CloudMessage_Operation_STATS);
+        response.set_success(true);
+        response.set_message("OK");
+
+        auto hits = hot_keys.hits();
+        auto lookups = hits + hot_keys.misses();
+        auto add_stat = [&response](const std::string &name, const std::string &value) {
+            auto tmp = response.add_kvp();
+            tmp->set_key(name);
+            tmp->set_value(value);
+        };
+        add_stat("cache_hits", std::to_string(hits));
+        add_stat("cache_lookups", std::to_string(lookups));
+        add_stat("cache_hit_ratio",
+                 fmt::format("{:.4f}", lookups ? static_cast<double>(hits) / lookups : 0.0));
+        for (auto &[key, count]: hot_keys.top_keys()) {
+            add_stat(fmt::format("hot_key.{}", key), std::to_string(count));
+        }
+        add_stat("hedges", std::to_string(hedging.hedges()));
+        add_stat("hedges_won", std::to_string(hedging.hedges_won()));
+        auto hedge_delay = hedging.delay();
+        add_stat("hedge_delay_us", hedge_delay == std::chrono::microseconds::max()
+                                       ? "inf" : std::to_string(hedge_delay.count()));
+        for (auto &[name, value]: metrics().samples()) {
+            add_stat(name, value);
+        }
+        con.send(response);
+    }
+
 }  // namespace cloudlab
\ No newline at end of file
@@ -0,0 +1,66 @@
+#include "cloudlab/hedging.hh"
+
+#include <algorithm>
+#include <vector>
+
+namespace cloudlab {
+
+// hedges that can be saved up while peers are fast
+const auto max_tokens = 10.0;
+
+HedgingPolicy::HedgingPolicy(HedgingConfig config) : config{config} {
+}
+
+auto HedgingPolicy::record(std::chrono::microseconds latency) -> void {
+  std::lock_guard<std::mutex> lck(mtx);
+  latencies[recorded % hedge_window] = static_cast<uint32_t>(
+      std::min<int64_t>(latency.count(), UINT32_MAX));
+  recorded++;
+
+  if (recorded < hedge_min_samples || recorded % (hedge_window / 16) != 0) {
+    return;
+  }
+
+  std::vector<uint32_t> window(
+      latencies.begin(),
+      latencies.begin() + std::min<size_t>(recorded, hedge_window));
+  auto nth = window.begin() + static_cast<ptrdiff_t>(
+                                  config.percentile * (window.size() - 1));
+  std::nth_element(window.begin(), nth, window.end());
+  current_delay = std::max(config.min_delay, std::chrono::microseconds(*nth));
+}
+
+auto HedgingPolicy::delay() -> std::chrono::microseconds {
+  std::lock_guard<std::mutex> lck(mtx);
+  return current_delay;
+}
+
+auto HedgingPolicy::request() -> void {
+  std::lock_guard<std::mutex> lck(mtx);
+  tokens = std::min(tokens + config.budget, max_tokens);
+}
+
+auto HedgingPolicy::try_hedge() -> bool {
+  std::lock_guard<std::mutex> lck(mtx);
+  if (tokens < 1.0) return false;
+  tokens -= 1.0;
+  num_hedges++;
+  return true;
+}
+
+auto HedgingPolicy::won() -> void {
+  std::lock_guard<std::mutex> lck(mtx);
+  num_won++;
+}
+
+auto HedgingPolicy::hedges() -> uint64_t {
+  std::lock_guard<std::mutex> lck(mtx);
+  return num_hedges;
+}
+
+auto HedgingPolicy::hedges_won() -> uint64_t {
+  std::lock_guard<std::mutex> lck(mtx);
+  return num_won;
+}
+
+}  // namespace cloudlab
@@ -0,0 +1,168 @@
+#include "cloudlab/hotkeys.hh"
+
+#include <algorithm>
+#include <functional>
+
+namespace cloudlab {
+
+CountMinSketch::CountMinSketch(size_t width, size_t depth)
+    : width{width}, depth{depth}, counters(width * depth) {
+}
+
+auto CountMinSketch::index(size_t row, size_t hash) const -> size_t {
+  // derive one hash per row from a single string hash (Kirsch-Mitzenmacher)
+  auto h1 = hash;
+  auto h2 = (hash >> 32) | (hash << 32);
+  return row * width + (h1 + row * (h2 | 1)) % width;
+}
+
+auto CountMinSketch::add(const std::string& key) -> uint32_t {
+  auto hash = std::hash<std::string>()(key);
+  auto current = estimate(key);
+
+  // conservative update: only raise the counters that define the estimate
+  for (size_t row = 0; row < depth; row++) {
+    auto& counter = counters[index(row, hash)];
+    counter = std::max(counter, current + 1);
+  }
+  return current + 1;
+}
+
+auto CountMinSketch::estimate(const std::string& key) const -> uint32_t {
+  auto hash = std::hash<std::string>()(key);
+  auto result = UINT32_MAX;
+  for (size_t row = 0; row < depth; row++) {
+    result = std::min(result, counters[index(row, hash)]);
+  }
+  return result;
+}
+
+auto CountMinSketch::decay() -> void {
+  for (auto& counter : counters) {
+    counter >>= 1;
+  }
+}
+
+HotKeyCache::HotKeyCache(size_t top_k, size_t capacity)
+    : top_k{top_k}, capacity{capacity}, sketch{1024, 4} {
+}
+
+auto HotKeyCache::stripe(const std::string& key) const -> size_t {
+  return std::hash<std::string>()(key) % write_seq.size();
+}
+
+auto HotKeyCache::evict(const std::string& key) -> void {
+  auto search = values.find(key);
+  if (search != values.end()) {
+    size -= search->first.size() + search->second.size();
+    values.erase(search);
+  }
+}
+
+auto HotKeyCache::record(const std::string& key) -> void {
+  std::lock_guard<std::mutex> lck(mtx);
+
+  auto count = sketch.add(key);
+
+  // age the statistics s.t. the hot set follows shifts in the workload
+  if (++records % (1024 * 8) == 0) {
+    sketch.decay();
+    for (auto it = top.begin(); it != top.end();) {
+      it->second >>= 1;
+      if (it->second == 0) {
+        evict(it->first);
+        it = top.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  auto search = top.find(key);
+  if (search != top.end()) {
+    search->second = count;
+    return;
+  }
+
+  if (top.size() < top_k) {
+    top.insert({key, count});
+    return;
+  }
+
+  auto coldest = std::min_element(
+      top.begin(), top.end(),
+      [](const auto& lhs, const auto& rhs) { return lhs.second < rhs.second; });
+  if (coldest->second < count) {
+    evict(coldest->first);
+    top.erase(coldest);
+    top.insert({key, count});
+  }
+}
+
+auto HotKeyCache::lookup(const std::string& key, std::string& value) -> bool {
+  std::lock_guard<std::mutex> lck(mtx);
+  auto search = values.find(key);
+  if (search == values.end()) {
+    cache_misses++;
+    return false;
+  }
+  cache_hits++;
+  value = search->second;
+  return true;
+}
+
+auto HotKeyCache::fill_token(const std::string& key) -> uint64_t {
+  std::lock_guard<std::mutex> lck(mtx);
+  return write_seq[stripe(key)];
+}
+
+auto HotKeyCache::fill(const std::string& key, const std::string& value,
+                       uint64_t token) -> void {
+  std::lock_guard<std::mutex> lck(mtx);
+  if (write_seq[stripe(key)] != token) return;
+
+  auto search = top.find(key);
+  if (search == top.end() || search->second < hot_key_min_count) return;
+  if (key.size() + value.size() > capacity) return;
+
+  evict(key);
+
+  // make room by dropping the coldest cached keys
+  while (size + key.size() + value.size() > capacity) {
+    auto coldest = values.begin();
+    for (auto it = values.begin(); it != values.end(); ++it) {
+      if (top.at(it->first) < top.at(coldest->first)) coldest = it;
+    }
+    evict(coldest->first);
+  }
+
+  values.insert({key, value});
+  size += key.size() + value.size();
+}
+
+auto HotKeyCache::invalidate(const std::string& key) -> void {
+  std::lock_guard<std::mutex> lck(mtx);
+  write_seq[stripe(key)]++;
+  evict(key);
+}
+
+auto HotKeyCache::top_keys() -> std::vector<std::pair<std::string, uint32_t>> {
+  std::lock_guard<std::mutex> lck(mtx);
+  std::vector<std::pair<std::string, uint32_t>> result{top.begin(), top.end()};
+  std::sort(result.begin(), result.end(), [](const auto& lhs, const auto& rhs) {
+    return lhs.second > rhs.second;
+  });
+  return result;
+}
+
+auto HotKeyCache::hits() -> uint64_t {
+  std::lock_guard<std::mutex> lck(mtx);
+  return cache_hits;
+}
+
+auto HotKeyCache::misses() -> uint64_t {
+  std::lock_guard<std::mutex> lck(mtx);
+  return cache_misses;
+}
+
+}  // namespace cloudlab
@@ -1,56 +1,402 @@
 #include "cloudlab/kvs.hh"
+#include "cloudlab/tracing.hh"
 
+#include "value.hh"
+
+#include "rocksdb/compaction_filter.h"
 #include "rocksdb/db.h"
+#include "rocksdb/write_batch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
 
 namespace cloudlab {
 
+/**
+ * Physically removes expired values when rocksdb compacts the files they are
+ * stored in, s.t. expired keys do not need to be deleted explicitly.
+ */
+class ExpiryFilter : public rocksdb::CompactionFilter {
+ public:
+  auto Filter(int, const rocksdb::Slice&, const rocksdb::Slice& existing_value,
+              std::string*, bool*) const -> bool override {
+    return value_expired({existing_value.data(), existing_value.size()},
+                         now_ms());
+  }
+
+  auto Name() const -> const char* override {
+    return "cloudlab.ExpiryFilter";
+  }
+};
+
+static const ExpiryFilter expiry_filter{};
+
+// upper bound for the snapshots kept per partition, under heavy write load
+// snapshots are dropped before their retention time passed
+const auto max_snapshots = 1024;
+
 auto KVS::open() -> bool {
   rocksdb::Options options;
+  if (storage) storage->apply(options);
   options.create_if_missing = true;
-  return rocksdb::DB::Open(options, path.string(), &db).ok();
+  options.compaction_filter = &expiry_filter;
+  if (!rocksdb::DB::Open(options, path.string(), &db).ok()) return false;
+
+  // the versions of values written before are unknown, so reads at older
+  // timestamps cannot be served, unless there are no values at all
+  std::unique_ptr<rocksdb::Iterator> it{db->NewIterator(rocksdb::ReadOptions())};
+  it->SeekToFirst();
+  latest_version = it->Valid() ? clock->now() : 0;
+  return true;
 }
  KVS::~KVS( ) {
      std::shared_lock<std::shared_timed_mutex> lck(mtx);
+     release_snapshots();
      if (db!= nullptr) db->Close();
+     delete db;
 }
 
-auto KVS::get(const std::string& key, std::string& result) -> bool {
+auto KVS::get(const std::string& key, std::string& result, ValueInfo* info,
+              uint64_t timestamp) -> bool {
+  ScopedSpan span{"kvs.get"};
   std::shared_lock<std::shared_timed_mutex> lck(mtx);
   if (!kvs_open) kvs_open = open();
-  return db && db->Get(rocksdb::ReadOptions(), key, &result).ok();
+
+  rocksdb::ReadOptions options;
+  if (timestamp && !snapshot_at(timestamp, options.snapshot)) {
+    if (info) info->snapshot_too_old = true;
+    return false;
+  }
+
+  // the cache only holds the latest values
+  std::string stored;
+  auto use_cache = cache && !options.snapshot;
+  if (!use_cache || !cache->get(key, stored)) {
+    if (!db || !db->Get(options, key, &stored).ok()) {
+      return false;
+    }
+    if (use_cache) cache->insert(key, stored);
+  }
+
+  // expired values are treated as deleted until compaction drops them
+  auto now = now_ms();
+  if (value_expired(stored, now)) return false;
+
+  result = value_payload(stored);
+  if (info) {
+    info->ttl = remaining_ttl(stored, now);
+    info->version = value_version(stored);
+  }
+  return true;
 }
 
-auto KVS::get_all(std::vector<std::pair<std::string, std::string>>& buffer)
+auto KVS::snapshot_at(uint64_t timestamp, const rocksdb::Snapshot*& snapshot)
     -> bool {
+  // snapshots are only taken while someone reads them
+  last_snapshot_read.store(now_ms(), std::memory_order_relaxed);
+
+  // a timestamp far ahead would advance the clock for good
+  if (!HybridLogicalClock::is_plausible(timestamp)) return false;
+
+  // writes are versioned while holding the exclusive lock, so all writes
+  // after this read get a version greater than timestamp
+  clock->update(timestamp);
+
+  snapshot = nullptr;
+  if (timestamp >= latest_version) return true;
+
+  // the newest snapshot taken before a write versioned after timestamp
+  auto it = std::upper_bound(
+      snapshots.begin(), snapshots.end(), timestamp,
+      [](uint64_t ts, const VersionedSnapshot& s) { return ts < s.version; });
+  if (it == snapshots.begin()) return false;
+  snapshot = std::prev(it)->snapshot;
+  return true;
+}
+
+auto KVS::next_version() -> uint64_t {
+  auto version = clock->now();
+  auto retention = storage ? storage->get_config().snapshot_retention_ms
+                           : StorageConfig{}.snapshot_retention_ms;
+  if (db && retention > 0) {
+    auto now = now_ms();
+    while (!snapshots.empty() &&
+           (snapshots.size() >= max_snapshots ||
+            snapshots.front().taken_at + retention < now)) {
+      db->ReleaseSnapshot(snapshots.front().snapshot);
+      snapshots.pop_front();
+    }
+    // without reads at older timestamps within the retention time, snapshots
+    // would only pin old versions and slow down compactions. Once a write
+    // has no snapshot, the older ones would miss it, so all of them go.
+    auto read_at = last_snapshot_read.load(std::memory_order_relaxed);
+    if (read_at + retention >= now) {
+      snapshots.push_back({latest_version, now, db->GetSnapshot()});
+    } else {
+      release_snapshots();
+    }
+  }
+  latest_version = version;
+  return version;
+}
+
+auto KVS::release_snapshots() -> void {
+  for (auto& s : snapshots) {
+    if (db) db->ReleaseSnapshot(s.snapshot);
+  }
+  snapshots.clear();
+}
+
+auto KVS::get_all(std::vector<std::pair<std::string, std::string>>& buffer,
+                  std::vector<uint64_t>* ttls) -> bool {
+  ScopedSpan span{"kvs.get_all"};
   std::shared_lock<std::shared_timed_mutex> lck(mtx);
   if (!kvs_open) kvs_open = open();
+  if (!db) return false;
 
-  auto* it = db->NewIterator(rocksdb::ReadOptions());
+  auto now = now_ms();
+  std::unique_ptr<rocksdb::Iterator> it{db->NewIterator(rocksdb::ReadOptions())};
   it->SeekToFirst();
 
   while (it->Valid()) {
-    buffer.emplace_back(it->key().data(), it->value().data());
+    std::string_view stored{it->value().data(), it->value().size()};
+    if (!value_expired(stored, now)) {
+      buffer.emplace_back(it->key().ToString(), value_payload(stored));
+      if (ttls) ttls->push_back(remaining_ttl(stored, now));
+    }
     it->Next();
   }
   return true;
 }
 
-auto KVS::put(const std::string& key, const std::string& value) -> bool {
-  std::lock_guard<std::shared_timed_mutex> lck(mtx);
-  if (!kvs_open) kvs_open = open();
-  return db && db->Put(rocksdb::WriteOptions(), key, value).ok();
+auto KVS::write_options(Durability durability) -> rocksdb::WriteOptions {
+  rocksdb::WriteOptions options;
+  options.sync = durability == Durability::SYNC;
+  options.disableWAL = durability == Durability::ASYNC;
+  return options;
 }
 
-auto KVS::remove(const std::string& key) -> bool {
-  std::lock_guard<std::shared_timed_mutex> lck(mtx);
-  if (!kvs_open) kvs_open = open();
-  return db && db->Delete(rocksdb::WriteOptions(), key).ok();
+auto KVS::after_write(Durability durability, uint64_t seq) -> bool {
+  using namespace std::chrono;
+
+  if (durability == Durability::ASYNC && storage) {
+    // without WAL the memtables are the only copy, flush them periodically
+    auto now = duration_cast<milliseconds>(
+                   system_clock::now().time_since_epoch())
+                   .count();
+    auto last = last_flush.load();
+    auto interval = storage->get_config().async_flush_interval_ms;
+    if (now - last >= static_cast<int64_t>(interval) &&
+        last_flush.compare_exchange_strong(last, now)) {
+      std::shared_lock<std::shared_timed_mutex> lck(mtx);
+      rocksdb::FlushOptions options;
+      options.wait = false;
+      return db && db->Flush(options).ok();
+    }
+    return true;
+  }
+
+  if (durability != Durability::GROUP_COMMIT) return true;
+
+  std::unique_lock<std::mutex> lck(commit_mtx);
+  while (synced < seq) {
+    if (syncing) {
+      commit_cond.wait(lck);
+      continue;
+    }
+
+    // become the leader: give concurrent writers a moment to join the group,
+    // then sync the WAL once for all of them
+    syncing = true;
+    lck.unlock();
+    if (storage) {
+      std::this_thread::sleep_for(
+          microseconds(storage->get_config().group_commit_delay_us));
+    }
+    lck.lock();
+    auto target = written;
+    lck.unlock();
+
+    bool ok;
+    {
+      std::shared_lock<std::shared_timed_mutex> db_lck(mtx);
+      ok = db && db->SyncWAL().ok();
+    }
+
+    lck.lock();
+    syncing = false;
+    if (ok) synced = std::max(synced, target);
+    commit_cond.notify_all();
+    if (!ok) return false;
+  }
+  return true;
+}
+
+auto KVS::put(const std::string& key, const std::string& value,
+              Durability durability, uint64_t ttl) -> bool {
+  ScopedSpan span{"kvs.put"};
+  auto expires_at = ttl ? now_ms() + ttl * 1000 : 0;
+  uint64_t seq;
+  {
+    std::lock_guard<std::shared_timed_mutex> lck(mtx);
+    if (!kvs_open) kvs_open = open();
+    if (!db) return false;
+    if (cache) cache->erase(key);
+    auto stored = encode_value(value, expires_at, next_version());
+    if (!db->Put(write_options(durability), key, stored).ok()) {
+      return false;
+    }
+    std::lock_guard<std::mutex> commit_lck(commit_mtx);
+    seq = ++written;
+  }
+  return after_write(durability, seq);
+}
+
+auto KVS::remove(const std::string& key, Durability durability) -> bool {
+  ScopedSpan span{"kvs.remove"};
+  uint64_t seq;
+  {
+    std::lock_guard<std::shared_timed_mutex> lck(mtx);
+    if (!kvs_open) kvs_open = open();
+    if (!db) return false;
+    if (cache) cache->erase(key);
+    next_version();
+    if (!db->Delete(write_options(durability), key).ok()) {
+      return false;
+    }
+    std::lock_guard<std::mutex> commit_lck(commit_mtx);
+    seq = ++written;
+  }
+  return after_write(durability, seq);
+}
+
+auto KVS::write(const std::vector<Write>& writes, Durability durability)
+    -> bool {
+  ScopedSpan span{"kvs.write"};
+  auto now = now_ms();
+  uint64_t seq;
+  {
+    std::lock_guard<std::shared_timed_mutex> lck(mtx);
+    if (!kvs_open) kvs_open = open();
+    if (!db) return false;
+
+    // all writes of the batch share one version
+    auto version = next_version();
+    rocksdb::WriteBatch batch;
+    for (const auto& w : writes) {
+      if (cache) cache->erase(w.key);
+      batch.Put(w.key, encode_value(w.value, w.ttl ? now + w.ttl * 1000 : 0,
+                                    version));
+    }
+    if (!db->Write(write_options(durability), &batch).ok()) {
+      return false;
+    }
+    std::lock_guard<std::mutex> commit_lck(commit_mtx);
+    seq = ++written;
+  }
+  return after_write(durability, seq);
+}
+
+auto KVS::update(
+    const std::string& key, Durability durability, uint64_t ttl,
+    const std::function<bool(const std::string*, std::string&)>& modify)
+    -> bool {
+  ScopedSpan span{"kvs.update"};
+  uint64_t seq;
+  {
+    std::lock_guard<std::shared_timed_mutex> lck(mtx);
+    if (!kvs_open) kvs_open = open();
+    if (!db) return false;
+
+    std::string stored;
+    auto status = db->Get(rocksdb::ReadOptions(), key, &stored);
+    if (!status.ok() && !status.IsNotFound()) return false;
+
+    auto now = now_ms();
+    auto exists = status.ok() && !value_expired(stored, now);
+    std::string current{exists ? value_payload(stored) : ""};
+    std::string value;
+    if (!modify(exists ? &current : nullptr, value)) return false;
+
+    auto expires_at = exists ? value_expires_at(stored) : 0;
+    if (ttl) expires_at = now + ttl * 1000;
+
+    if (cache) cache->erase(key);
+    if (!db->Put(write_options(durability), key,
+                 encode_value(value, expires_at, next_version()))
+             .ok()) {
+      return false;
+    }
+    std::lock_guard<std::mutex> commit_lck(commit_mtx);
+    seq = ++written;
+  }
+  return after_write(durability, seq);
+}
+
+auto KVS::compare_and_swap(const std::string& key, const std::string& expected,
+                           const std::string& desired, std::string& current,
+                           Durability durability, uint64_t ttl) -> bool {
+  return update(key, durability, ttl,
+                [&](const std::string* value, std::string& result) {
+                  current = value ? *value : "";
+                  if (current != expected) return false;
+                  current = result = desired;
+                  return true;
+                });
+}
+
+auto KVS::increment(const std::string& key, int64_t delta, int64_t& result,
+                    Durability durability) -> bool {
+  return update(key, durability, 0,
+                [&](const std::string* value, std::string& updated) {
+                  int64_t number = 0;
+                  if (value) {
+                    try {
+                      size_t parsed;
+                      number = std::stoll(*value, &parsed);
+                      if (parsed != value->size()) return false;
+                    } catch (std::logic_error&) {
+                      return false;
+                    }
+                  }
+                  if (__builtin_add_overflow(number, delta, &result)) {
+                    return false;
+                  }
+                  updated = std::to_string(result);
+                  return true;
+                });
+}
+
+auto KVS::append(const std::string& key, const std::string& suffix,
+                 std::string& result, Durability durability) -> bool {
+  return update(key, durability, 0,
+                [&](const std::string* value, std::string& updated) {
+                  updated = (value ? *value : "") + suffix;
+                  result = updated;
+                  return true;
+                });
 }
 
 auto KVS::clear() -> bool {
   std::lock_guard<std::shared_timed_mutex> lck(mtx);
-  if (db!=nullptr) db->Close();
+  if (cache) cache->clear();
+  release_snapshots();
+  latest_version = 0;
+  // requests that still hold the KVS fail instead of using a closed database
+  if (db != nullptr) {
+    db->Close();
+    delete db;
+    db = nullptr;
+  }
+  kvs_open = true;
   return rocksdb::DestroyDB(path.string(), {}).ok();
 }
 
-}  // namespace cloudlab
\ No newline at end of file
+auto KVS::get_property(const std::string& property, uint64_t& value) -> bool {
+  std::shared_lock<std::shared_timed_mutex> lck(mtx);
+  if (!kvs_open || db == nullptr) return false;
+  return db->GetIntProperty(property, &value);
+}
+
+}  // namespace cloudlab
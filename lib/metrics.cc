@@ -0,0 +1,260 @@
+#include "cloudlab/metrics.hh"
+
+#include "fmt/core.h"
+
+#include <bit>
+#include <cmath>
+
+namespace cloudlab {
+
+// quantiles of the histograms reported by STATS and Prometheus
+static const std::array<std::pair<double, const char*>, 4> quantiles{
+    {{0.5, "0.5"}, {0.9, "0.9"}, {0.99, "0.99"}, {0.999, "0.999"}}};
+
+auto metric_shard() -> size_t {
+  static std::atomic<size_t> next_shard{0};
+  thread_local auto shard = next_shard++ % metric_shards;
+  return shard;
+}
+
+auto Counter::value() const -> uint64_t {
+  uint64_t sum = 0;
+  for (const auto& shard : shards) {
+    sum += shard.value.load(std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+Histogram::~Histogram() {
+  for (auto& shard : shards) {
+    delete shard.load();
+  }
+}
+
+auto Histogram::bucket(uint64_t value) -> size_t {
+  if (value < sub_buckets) return value;
+  auto shift = std::bit_width(value) - 1 - sub_bucket_bits;
+  return sub_buckets * (shift + 1) + ((value >> shift) - sub_buckets);
+}
+
+auto Histogram::highest_value(size_t bucket) -> uint64_t {
+  if (bucket < sub_buckets) return bucket;
+  auto shift = bucket / sub_buckets - 1;
+  auto lowest = static_cast<uint64_t>(bucket % sub_buckets + sub_buckets)
+                << shift;
+  return lowest + ((uint64_t{1} << shift) - 1);
+}
+
+auto Histogram::shard() -> Shard& {
+  auto& slot = shards[metric_shard()];
+  auto* shard = slot.load(std::memory_order_acquire);
+  if (shard) return *shard;
+
+  // threads that share the shard race to allocate it
+  auto* fresh = new Shard();
+  if (slot.compare_exchange_strong(shard, fresh, std::memory_order_acq_rel)) {
+    return *fresh;
+  }
+  delete fresh;
+  return *shard;
+}
+
+auto Histogram::record(uint64_t value) -> void {
+  auto& s = shard();
+  s.buckets[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+  s.sum.fetch_add(value, std::memory_order_relaxed);
+  auto max = s.max.load(std::memory_order_relaxed);
+  while (value > max && !s.max.compare_exchange_weak(
+                            max, value, std::memory_order_relaxed)) {
+  }
+}
+
+auto Histogram::snapshot() const -> Snapshot {
+  Snapshot result{};
+  for (const auto& slot : shards) {
+    const auto* shard = slot.load(std::memory_order_acquire);
+    if (!shard) continue;
+    for (size_t i = 0; i < num_buckets; i++) {
+      auto n = shard->buckets[i].load(std::memory_order_relaxed);
+      result.buckets[i] += n;
+      result.count += n;
+    }
+    result.sum += shard->sum.load(std::memory_order_relaxed);
+    result.max = std::max(result.max, shard->max.load());
+  }
+  return result;
+}
+
+auto Histogram::Snapshot::percentile(double q) const -> uint64_t {
+  if (count == 0) return 0;
+  auto rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(q * static_cast<double>(count))));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets.size(); i++) {
+    seen += buckets[i];
+    if (seen >= rank) return std::min(highest_value(i), max);
+  }
+  return max;
+}
+
+static auto escape(const std::string& value) -> std::string {
+  std::string result;
+  for (auto c : value) {
+    if (c == '\\' || c == '"') result.push_back('\\');
+    if (c == '\n') {
+      result.append("\\n");
+      continue;
+    }
+    result.push_back(c);
+  }
+  return result;
+}
+
+/**
+ * Renders labels without the braces, e.g., a="1",b="2".
+ */
+static auto render(const Labels& labels) -> std::string {
+  std::string result;
+  for (const auto& [key, value] : labels) {
+    if (!result.empty()) result.push_back(',');
+    result.append(fmt::format("{}=\"{}\"", key, escape(value)));
+  }
+  return result;
+}
+
+static auto sample_name(const std::string& name, const std::string& labels,
+                        const std::string& extra = {}) -> std::string {
+  if (labels.empty() && extra.empty()) return name;
+  if (labels.empty()) return fmt::format("{}{{{}}}", name, extra);
+  if (extra.empty()) return fmt::format("{}{{{}}}", name, labels);
+  return fmt::format("{}{{{},{}}}", name, labels, extra);
+}
+
+auto MetricsRegistry::find(const std::string& name, const std::string& type,
+                           const std::string& help, const Labels& labels)
+    -> Metric& {
+  auto& family = families[name];
+  if (family.type.empty()) {
+    family.type = type;
+    family.help = help;
+  } else if (family.type != type) {
+    throw std::invalid_argument(
+        fmt::format("metric {} is a {}, not a {}", name, family.type, type));
+  }
+  return family.metrics[render(labels)];
+}
+
+auto MetricsRegistry::counter(const std::string& name, const std::string& help,
+                              const Labels& labels) -> Counter& {
+  std::lock_guard<std::mutex> lck(mtx);
+  auto& metric = find(name, "counter", help, labels);
+  if (std::holds_alternative<std::monostate>(metric)) {
+    metric = std::make_unique<Counter>();
+  }
+  return *std::get<std::unique_ptr<Counter>>(metric);
+}
+
+auto MetricsRegistry::histogram(const std::string& name,
+                                const std::string& help, const Labels& labels)
+    -> Histogram& {
+  std::lock_guard<std::mutex> lck(mtx);
+  auto& metric = find(name, "summary", help, labels);
+  if (std::holds_alternative<std::monostate>(metric)) {
+    metric = std::make_unique<Histogram>();
+  }
+  return *std::get<std::unique_ptr<Histogram>>(metric);
+}
+
+auto MetricsRegistry::gauge(const std::string& name, const std::string& help,
+                            std::function<int64_t()> read,
+                            const Labels& labels) -> void {
+  std::lock_guard<std::mutex> lck(mtx);
+  find(name, "gauge", help, labels) = std::move(read);
+}
+
+auto MetricsRegistry::visit(
+    const std::function<void(const std::string&, const Family&)>& on_family,
+    const std::function<void(const std::string&, const std::string&)>&
+        on_sample,
+    bool with_max) -> void {
+  for (const auto& [name, family] : families) {
+    on_family(name, family);
+    for (const auto& [labels, metric] : family.metrics) {
+      if (const auto* counter =
+              std::get_if<std::unique_ptr<Counter>>(&metric)) {
+        on_sample(sample_name(name, labels),
+                  std::to_string((*counter)->value()));
+      } else if (const auto* histogram =
+                     std::get_if<std::unique_ptr<Histogram>>(&metric)) {
+        auto snapshot = (*histogram)->snapshot();
+        for (const auto& [q, label] : quantiles) {
+          on_sample(
+              sample_name(name, labels, fmt::format("quantile=\"{}\"", label)),
+              std::to_string(snapshot.percentile(q)));
+        }
+        on_sample(sample_name(name + "_sum", labels),
+                  std::to_string(snapshot.sum));
+        on_sample(sample_name(name + "_count", labels),
+                  std::to_string(snapshot.count));
+        // not part of a Prometheus summary
+        if (with_max) {
+          on_sample(sample_name(name + "_max", labels),
+                    std::to_string(snapshot.max));
+        }
+      } else if (const auto* read =
+                     std::get_if<std::function<int64_t()>>(&metric)) {
+        on_sample(sample_name(name, labels), std::to_string((*read)()));
+      }
+    }
+  }
+}
+
+auto MetricsRegistry::samples()
+    -> std::vector<std::pair<std::string, std::string>> {
+  std::lock_guard<std::mutex> lck(mtx);
+  std::vector<std::pair<std::string, std::string>> result;
+  visit([](const std::string&, const Family&) {},
+        [&result](const std::string& sample, const std::string& value) {
+          result.emplace_back(sample, value);
+        },
+        true);
+  return result;
+}
+
+auto MetricsRegistry::prometheus() -> std::string {
+  std::lock_guard<std::mutex> lck(mtx);
+  std::string result;
+  visit(
+      [&result](const std::string& name, const Family& family) {
+        result.append(fmt::format("# HELP {} {}\n# TYPE {} {}\n", name,
+                                  family.help, name, family.type));
+      },
+      [&result](const std::string& sample, const std::string& value) {
+        result.append(fmt::format("{} {}\n", sample, value));
+      },
+      false);
+  return result;
+}
+
+auto metrics() -> MetricsRegistry& {
+  static MetricsRegistry registry{};
+  return registry;
+}
+
+auto OperationMetrics::record(int operation, const std::string& name,
+                              std::chrono::steady_clock::duration latency)
+    -> void {
+  if (operation < 0 || operation >= max_operations) return;
+  auto* histogram = histograms[operation].load(std::memory_order_acquire);
+  if (!histogram) {
+    // the registry returns the same histogram to racing threads
+    histogram = &metrics().histogram(
+        "cloudlab_operation_duration_us",
+        "Time to handle a request in microseconds",
+        {{"handler", handler}, {"operation", name}});
+    histograms[operation].store(histogram, std::memory_order_release);
+  }
+  histogram->record(latency);
+}
+
+}  // namespace cloudlab
@@ -4,7 +4,9 @@
 #include "fmt/core.h"
 
 #include <arpa/inet.h>
+#include <cstring>
 #include <netinet/in.h>
+#include <sys/un.h>
 
 namespace cloudlab {
 
@@ -14,6 +16,17 @@ SocketAddress::SocketAddress(const std::string& address) {
     struct sockaddr_in6 v6;
   } buffer{};
 
+  if (address.starts_with(unix_address_prefix)) {
+    type = IPAddressType::UNIX;
+    ip_address = address.substr(strlen(unix_address_prefix));
+    if (ip_address.empty() ||
+        ip_address.size() >= sizeof(sockaddr_un::sun_path)) {
+      throw std::invalid_argument(fmt::format(
+          "{} is not a valid Unix domain socket path", ip_address));
+    }
+    return;
+  }
+
   // split address string by last colon
   auto cut = address.find_last_of(":\\");
 
@@ -59,9 +72,21 @@ SocketAddress::SocketAddress(const std::string& address) {
 }
 
 auto SocketAddress::string() const -> std::string {
+  if (type == IPAddressType::UNIX) {
+    return fmt::format("{}{}", unix_address_prefix, ip_address);
+  }
   const auto* pattern = (type == IPAddressType::V4) ? "{}:{}" : "[{}]:{}";
 
   return fmt::format("{}:{}", ip_address, port);
 }
 
-}  // namespace cloudlab
\ No newline at end of file
+auto SocketAddress::unix_address(struct sockaddr_un& address) const
+    -> socklen_t {
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  memcpy(address.sun_path, ip_address.data(), ip_address.size());
+  return static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) +
+                                ip_address.size() + 1);
+}
+
+}  // namespace cloudlab
@@ -0,0 +1,49 @@
+#include "cloudlab/network/admission.hh"
+#include "cloudlab/metrics.hh"
+
+#include "fmt/core.h"
+
+#include <algorithm>
+
+namespace cloudlab {
+
+auto LoadShedder::should_shed(std::chrono::steady_clock::duration sojourn,
+                              std::chrono::steady_clock::time_point now)
+    -> bool {
+  std::lock_guard<std::mutex> lck(mtx);
+  if (now >= interval_end) {
+    // the queue did not drain once during the last interval
+    overloaded = min_sojourn > target &&
+                 min_sojourn != std::chrono::steady_clock::duration::max();
+    min_sojourn = std::chrono::steady_clock::duration::max();
+    interval_end = now + interval;
+  }
+  min_sojourn = std::min(min_sojourn, sojourn);
+  return sojourn > (overloaded ? target : interval);
+}
+
+auto register_server_metrics(const std::string& name,
+                             std::shared_ptr<const ServerMetrics> metrics)
+    -> void {
+  auto add = [&](const char* metric, const char* help,
+                 std::atomic<uint64_t> ServerMetrics::*value) {
+    cloudlab::metrics().gauge(
+        fmt::format("cloudlab_server_{}", metric), help,
+        [metrics, value]() {
+          return static_cast<int64_t>(((*metrics).*value).load());
+        },
+        {{"server", name}});
+  };
+  add("queue_depth", "Requests waiting for a worker",
+      &ServerMetrics::queue_depth);
+  add("in_flight", "Requests handled by a worker", &ServerMetrics::in_flight);
+  add("connections", "Open connections", &ServerMetrics::connections);
+  add("rejected_connections", "Connections closed at the connection limit",
+      &ServerMetrics::rejected_connections);
+  add("shed_queue_full", "Requests shed because the queue was full",
+      &ServerMetrics::shed_queue_full);
+  add("shed_queue_time", "Requests shed because they queued for too long",
+      &ServerMetrics::shed_queue_time);
+}
+
+}  // namespace cloudlab
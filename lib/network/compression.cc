@@ -0,0 +1,91 @@
+#include "cloudlab/network/compression.hh"
+#include "cloudlab/network/connection.hh"
+
+#include "fmt/core.h"
+
+#include <arpa/inet.h>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <zlib.h>
+
+namespace cloudlab {
+
+static CompressionConfig config{};
+
+auto CompressionConfig::load_dictionary(const std::string& path) -> void {
+  std::ifstream file{path, std::ios::binary};
+  if (!file) {
+    throw std::runtime_error(fmt::format("could not open {}", path));
+  }
+  std::stringstream content;
+  content << file.rdbuf();
+  dictionary = content.str();
+}
+
+auto set_compression_config(CompressionConfig c) -> void {
+  config = std::move(c);
+}
+
+auto compression_config() -> const CompressionConfig& {
+  return config;
+}
+
+auto compress_payload(const uint8_t* data, size_t size, std::string& payload)
+    -> bool {
+  z_stream stream{};
+  if (deflateInit(&stream, config.level) != Z_OK) return false;
+  if (!config.dictionary.empty() &&
+      deflateSetDictionary(
+          &stream, reinterpret_cast<const Bytef*>(config.dictionary.data()),
+          static_cast<uInt>(config.dictionary.size())) != Z_OK) {
+    deflateEnd(&stream);
+    return false;
+  }
+
+  payload.resize(4 + deflateBound(&stream, size));
+  uint32_t size_nb = htonl(static_cast<uint32_t>(size));
+  memcpy(payload.data(), &size_nb, 4);
+
+  stream.next_in = const_cast<Bytef*>(data);
+  stream.avail_in = static_cast<uInt>(size);
+  stream.next_out = reinterpret_cast<Bytef*>(payload.data() + 4);
+  stream.avail_out = static_cast<uInt>(payload.size() - 4);
+  auto result = deflate(&stream, Z_FINISH);
+  payload.resize(4 + stream.total_out);
+  deflateEnd(&stream);
+
+  return result == Z_STREAM_END && payload.size() < size;
+}
+
+auto decompress_payload(const uint8_t* data, size_t size, std::string& message)
+    -> bool {
+  if (size < 4) return false;
+  uint32_t original{};
+  memcpy(&original, data, 4);
+  original = ntohl(original);
+  if (original > max_message_size) return false;
+
+  z_stream stream{};
+  if (inflateInit(&stream) != Z_OK) return false;
+  message.resize(original);
+  stream.next_in = const_cast<Bytef*>(data + 4);
+  stream.avail_in = static_cast<uInt>(size - 4);
+  stream.next_out = reinterpret_cast<Bytef*>(message.data());
+  stream.avail_out = original;
+
+  auto result = inflate(&stream, Z_FINISH);
+  // the stream names the dictionary it needs by its checksum, zlib verifies
+  // that ours matches
+  if (result == Z_NEED_DICT && !config.dictionary.empty() &&
+      inflateSetDictionary(
+          &stream, reinterpret_cast<const Bytef*>(config.dictionary.data()),
+          static_cast<uInt>(config.dictionary.size())) == Z_OK) {
+    result = inflate(&stream, Z_FINISH);
+  }
+  auto done = result == Z_STREAM_END && stream.total_out == original;
+  inflateEnd(&stream);
+  return done;
+}
+
+}  // namespace cloudlab
@@ -1,18 +1,82 @@
 #include "cloudlab/network/connection.hh"
 #include "cloudlab/network/address.hh"
+#include "cloudlab/network/compression.hh"
+#include "cloudlab/network/event_loop.hh"
+#include "cloudlab/network/wire.hh"
+#include "cloudlab/clock.hh"
+#include "cloudlab/metrics.hh"
+#include "cloudlab/tracing.hh"
 
 #include "fmt/core.h"
 
 #include "cloud.pb.h"
 #include <event2/buffer.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
 #include <event2/bufferevent.h>
 
+#include <array>
+#include <cerrno>
+#include <fcntl.h>
 #include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 namespace cloudlab {
 
+static auto sent_bytes() -> Counter& {
+  static auto& counter = metrics().counter(
+      "cloudlab_connection_sent_bytes_total",
+      "Bytes of messages sent, including their length prefix");
+  return counter;
+}
+
+static auto received_bytes() -> Counter& {
+  static auto& counter = metrics().counter(
+      "cloudlab_connection_received_bytes_total",
+      "Bytes of messages received, including their length prefix");
+  return counter;
+}
+
+static auto deferred_sends() -> Counter& {
+  static auto& counter = metrics().counter(
+      "cloudlab_connection_deferred_sends_total",
+      "Messages that the socket did not take at once, the event loop sent "
+      "the rest");
+  return counter;
+}
+
+static auto compressed_bytes() -> Counter& {
+  static auto& counter = metrics().counter(
+      "cloudlab_connection_compression_saved_bytes_total",
+      "Bytes saved by compressing messages before sending them");
+  return counter;
+}
+
+// flags in the length word of a frame
+const uint32_t frame_flags =
+    compact_frame | compressed_frame | accepts_compression;
+
 Connection::Connection(const SocketAddress& address) {
+  if (!open(address, false)) connect_failed = true;
+}
+
+auto Connection::open(const SocketAddress& address, bool nonblocking) -> bool {
+  // co-located peers skip the TCP stack
+  if (address.is_unix()) {
+    fd = socket(AF_UNIX, SOCK_STREAM | (nonblocking ? SOCK_NONBLOCK : 0), 0);
+    if (fd == -1) {
+      throw std::runtime_error("socket() failed");
+    }
+    sockaddr_un un{};
+    auto length = address.unix_address(un);
+    // local connects complete right away, a full backlog fails them
+    return connect(fd, reinterpret_cast<sockaddr*>(&un), length) == 0;
+  }
+
   addrinfo hints{}, *req = nullptr;
   memset(&hints, 0, sizeof(addrinfo));
 
@@ -33,21 +97,53 @@ Connection::Connection(const SocketAddress& address) {
     throw std::runtime_error("getaddrinfo() failed");
   }
 
-  fd = socket(req->ai_family, req->ai_socktype, req->ai_protocol);
+  fd = socket(req->ai_family,
+              req->ai_socktype | (nonblocking ? SOCK_NONBLOCK : 0),
+              req->ai_protocol);
   if (fd == -1) {
+    freeaddrinfo(req);
     throw std::runtime_error("socket() failed");
   }
 
   // allow kernel to rebind address even when in TIME_WAIT state
   int yes = 1;
   if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1) {
+    freeaddrinfo(req);
     throw std::runtime_error("setsockopt() failed");
   }
 
-  if (connect(fd, req->ai_addr, req->ai_addrlen) == -1) {
-    // throw std::runtime_error("perform_connect() failed");
-    connect_failed = true;
+  auto connected = connect(fd, req->ai_addr, req->ai_addrlen) == 0 ||
+                   (nonblocking && errno == EINPROGRESS);
+  freeaddrinfo(req);
+  return connected;
+}
+
+auto Connection::async_connect(const SocketAddress& address, uint64_t deadline)
+    -> Task<std::unique_ptr<Connection>> {
+  auto con = std::unique_ptr<Connection>(new Connection());
+  if (!con->open(address, true)) {
+    con->connect_failed = true;
+    co_return con;
+  }
+
+  // the connection is established once the socket is writable
+  if (!co_await EventLoop::wait(con->fd, true, deadline)) {
+    con->connect_failed = true;
+    co_return con;
   }
+  int error{};
+  socklen_t length = sizeof(error);
+  if (getsockopt(con->fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1 ||
+      error != 0) {
+    con->connect_failed = true;
+    co_return con;
+  }
+
+  // blocking sends and receives remain possible, async_send and
+  // async_receive do not block either way
+  fcntl(con->fd, F_SETFL, fcntl(con->fd, F_GETFL) & ~O_NONBLOCK);
+  if (deadline) con->set_deadline(deadline);
+  co_return con;
 }
 
 Connection::Connection(const std::string& address)
@@ -58,20 +154,163 @@ Connection::~Connection() {
   close(fd);
 }
 
+/**
+ * Reads exactly size bytes unless the connection is closed, fails or times
+ * out.
+ *
+ * @return  the number of bytes read, or the result of the failed read if
+ *          nothing was read
+ */
+static auto read_fully(int fd, void* buf, size_t size) -> ssize_t {
+  size_t done = 0;
+  while (done < size) {
+    auto n = read(fd, static_cast<uint8_t*>(buf) + done, size - done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return done ? static_cast<ssize_t>(done) : n;
+    done += n;
+  }
+  return static_cast<ssize_t>(done);
+}
+
+/**
+ * Parses the payload of a frame whose length word had the given flags set.
+ */
+static auto parse(cloud::CloudMessage& msg, const uint8_t* buf, uint32_t size,
+                  uint32_t flags) -> bool {
+  std::string decompressed;
+  if (flags & compressed_frame) {
+    if (!decompress_payload(buf, size, decompressed)) return false;
+    buf = reinterpret_cast<const uint8_t*>(decompressed.data());
+    size = static_cast<uint32_t>(decompressed.size());
+  }
+  if (!(flags & compact_frame)) {
+    return msg.ParseFromArray(buf, static_cast<int>(size));
+  }
+  CompactMessage compact{};
+  if (!compact.parse({reinterpret_cast<const char*>(buf), size})) return false;
+  compact.to_cloud_message(msg);
+  return true;
+}
+
+/**
+ * Advances iov past n written bytes.
+ */
+static auto skip_written(iovec*& iov, size_t& count, size_t n) -> void {
+  while (count > 0 && n >= iov->iov_len) {
+    n -= iov->iov_len;
+    iov++;
+    count--;
+  }
+  if (count > 0) {
+    iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+    iov->iov_len -= n;
+  }
+}
+
+/**
+ * Writes all iovecs to a blocking socket, retrying after partial writes.
+ *
+ * @return  false if the connection is closed, fails or times out
+ */
+static auto write_fully(int fd, iovec* iov, size_t count) -> bool {
+  while (count > 0) {
+    auto written = writev(fd, iov, static_cast<int>(count));
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) return false;
+    skip_written(iov, count, static_cast<size_t>(written));
+  }
+  return true;
+}
+
+/**
+ * Sends a frame on a non-blocking socket of a server. As much as the socket
+ * takes is written right away, the rest is queued in the output buffer of
+ * the bufferevent, which the event loop writes once the socket is writable.
+ * Frames queue behind earlier ones that are still pending to keep their
+ * order. iov points into payload, which is only moved once written.
+ *
+ * @return  false if the connection failed
+ */
+static auto send_buffered(struct bufferevent* bev, std::array<iovec, 2> iov,
+                          std::string&& payload) -> bool {
+  bufferevent_lock(bev);
+  auto* output = bufferevent_get_output(bev);
+  auto total = iov[0].iov_len + iov[1].iov_len;
+  size_t written{};
+
+  if (evbuffer_get_length(output) == 0) {
+    auto n = writev(bufferevent_getfd(bev), iov.data(), iov.size());
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      bufferevent_unlock(bev);
+      return false;
+    }
+    written = n > 0 ? static_cast<size_t>(n) : 0;
+  }
+
+  if (written < total) {
+    deferred_sends().add();
+    if (written < 4) {
+      evbuffer_add(output, static_cast<char*>(iov[0].iov_base) + written,
+                   4 - written);
+    }
+
+    // the output buffer references the payload until it is written
+    auto offset = written > 4 ? written - 4 : 0;
+    auto* rest = new std::string(std::move(payload));
+    evbuffer_add_reference(
+        output, rest->data() + offset, rest->size() - offset,
+        [](const void*, size_t, void* extra) {
+          delete static_cast<std::string*>(extra);
+        },
+        rest);
+  }
+
+  bufferevent_unlock(bev);
+  return true;
+}
+
+/**
+ * Splits the length word of a frame into the size of the payload and the
+ * flags.
+ *
+ * @return  the flags
+ */
+static auto split_length(uint32_t word_nb, uint32_t& size) -> uint32_t {
+  auto word = ntohl(word_nb);
+  size = word & ~frame_flags;
+  return word & frame_flags;
+}
+
 auto Connection::receive(cloud::CloudMessage& msg) const -> bool {
-  uint32_t size{}, read_bytes{};
+  // waiting for the response of a peer within a traced request
+  ScopedSpan span{"receive"};
+  uint32_t size{};
+  ssize_t read_bytes{};
+
+  // the server read the request already, there is only one
+  if (buffered) {
+    if (buffered->received || buffered->frame.size() < 4) return false;
+    buffered->received = true;
+    uint32_t word{};
+    memcpy(&word, buffered->frame.data(), 4);
+    auto flags = split_length(word, size);
+    if (buffered->frame.size() != size + 4) return false;
+    return decode(
+        msg, reinterpret_cast<const uint8_t*>(buffered->frame.data()) + 4,
+        size, flags);
+  }
 
   if (bev) {
     auto* input = bufferevent_get_input(static_cast<struct bufferevent*>(bev));
     read_bytes = evbuffer_remove(input, &size, 4);
   } else {
-    read_bytes = read(fd, &size, 4);
+    read_bytes = read_fully(fd, &size, 4);
   }
 
   if (read_bytes < 4) {
-    if (read_bytes == 0) {
-      // connection closed by other side -> we should close our connection as
-      // well ... for now we just return here
+    if (read_bytes <= 0) {
+      // connection closed by other side, failed or timed out -> we should
+      // close our connection as well ... for now we just return here
       return false;
     }
 
@@ -80,7 +319,7 @@ auto Connection::receive(cloud::CloudMessage& msg) const -> bool {
   }
 
   // convert size to host byte order
-  size = ntohl(size);
+  auto flags = split_length(size, size);
 
   if (size > max_message_size) {
     throw std::runtime_error(
@@ -94,41 +333,267 @@ auto Connection::receive(cloud::CloudMessage& msg) const -> bool {
     auto* input = bufferevent_get_input(static_cast<struct bufferevent*>(bev));
     read_bytes = evbuffer_remove(input, buf.get(), size);
   } else {
-    read_bytes = read(fd, buf.get(), size);
+    read_bytes = read_fully(fd, buf.get(), size);
   }
 
-  msg.ParseFromArray(buf.get(), size);
+  if (read_bytes != size) return false;
+  return decode(msg, buf.get(), size, flags);
+}
+
+auto Connection::decode(cloud::CloudMessage& msg, const uint8_t* payload,
+                        uint32_t size, uint32_t flags) const -> bool {
+  received_bytes().add(size + 4);
 
-  return (read_bytes == size);
+  // answer in the format the peer speaks
+  if (flags & compact_frame) compact = true;
+  if (flags & accepts_compression) compression = true;
+  return parse(msg, payload, size, flags);
 }
 
-auto Connection::send(const cloud::CloudMessage& msg) const -> bool {
-  uint32_t size = msg.ByteSizeLong();
-  auto buffer = std::make_unique<uint8_t[]>(size + 4);
+auto Connection::set_deadline(uint64_t deadline) const -> bool {
+  auto now = now_ms();
+  if (deadline <= now) return false;
+  this->deadline = deadline;
+  if (bev || fd == -1) return true;
+
+  auto left = deadline - now;
+  timeval timeout{};
+  timeout.tv_sec = static_cast<time_t>(left / 1000);
+  timeout.tv_usec = static_cast<suseconds_t>((left % 1000) * 1000);
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  return true;
+}
 
-  // set first four bytes to size of message (in network byte order)
-  uint32_t size_nb = htonl(size);
-  memcpy(buffer.get(), &size_nb, 4);
+auto Connection::encode(const cloud::CloudMessage& msg,
+                        std::string& payload) const -> uint32_t {
+  auto is_compact = compact && compact_encodable(msg);
+  uint32_t size = is_compact ? compact_size(msg) : msg.ByteSizeLong();
+  payload.assign(size, '\0');
+  auto* buffer = reinterpret_cast<uint8_t*>(payload.data());
 
   // serialize message
-  msg.SerializeToArray(buffer.get() + 4, size);
+  if (is_compact) {
+    encode_compact(msg, buffer);
+  } else {
+    msg.SerializeToArray(buffer, static_cast<int>(size));
+  }
+
+  // the flags of the length word mark the format of the payload
+  uint32_t flags = is_compact ? compact_frame : 0;
+  if (compression) {
+    flags |= accepts_compression;
+    std::string compressed;
+    if (size >= compression_config().threshold &&
+        compress_payload(buffer, size, compressed)) {
+      compressed_bytes().add(size - compressed.size());
+      flags |= compressed_frame;
+      size = static_cast<uint32_t>(compressed.size());
+      payload = std::move(compressed);
+    }
+  }
+  return htonl(size | flags);
+}
+
+auto Connection::send(const cloud::CloudMessage& msg) const -> bool {
+  ScopedSpan span{"send"};
+  std::string payload;
+  auto size_nb = encode(msg, payload);
+  auto size = static_cast<uint32_t>(payload.size());
+
+  // the length word is sent in front of the payload
+  std::array<iovec, 2> iov{iovec{&size_nb, 4},
+                           iovec{payload.data(), payload.size()}};
 
   bool success{};
 
   // write everything out
-  if (bev) {
-    auto fd = bufferevent_getfd(static_cast<struct bufferevent*>(bev));
-    success = write(fd, buffer.get(), size + 4) == size + 4;
-
-    /*
-    success = bufferevent_write(static_cast<struct bufferevent*>(bev),
-                                buffer.get(), size + 4) == 0;
-    */
+  if (buffered) {
+    // the server writes the response once the handler is done
+    std::string frame;
+    frame.reserve(size + 4);
+    frame.append(reinterpret_cast<const char*>(&size_nb), 4);
+    frame.append(payload);
+    buffered->responses.push_back(std::move(frame));
+    success = true;
+  } else if (bev) {
+    success = send_buffered(static_cast<struct bufferevent*>(bev), iov,
+                            std::move(payload));
   } else {
-    success = write(fd, buffer.get(), size + 4) == size + 4;
+    success = write_fully(fd, iov.data(), iov.size());
   }
 
+  if (success) sent_bytes().add(size + 4);
   return success;
 }
 
+auto Connection::has_message() const -> bool {
+  if (buffered) return !buffered->received;
+  if (!bev) return true;
+
+  auto* input = bufferevent_get_input(static_cast<struct bufferevent*>(bev));
+  uint32_t size{};
+  if (evbuffer_copyout(input, &size, 4) < 4) return false;
+  split_length(size, size);
+  return size > max_message_size || evbuffer_get_length(input) >= size + 4;
+}
+
+auto Connection::peek(cloud::CloudMessage& msg) const -> bool {
+  if (buffered) {
+    uint32_t size{};
+    uint32_t word{};
+    if (buffered->received || buffered->frame.size() < 4) return false;
+    memcpy(&word, buffered->frame.data(), 4);
+    auto flags = split_length(word, size);
+    if (buffered->frame.size() != size + 4) return false;
+    return parse(
+        msg, reinterpret_cast<const uint8_t*>(buffered->frame.data()) + 4,
+        size, flags);
+  }
+  if (!bev) return false;
+
+  auto* input = bufferevent_get_input(static_cast<struct bufferevent*>(bev));
+  uint32_t size{};
+  if (evbuffer_copyout(input, &size, 4) < 4) return false;
+  auto flags = split_length(size, size);
+  if (size > max_message_size || evbuffer_get_length(input) < size + 4) {
+    return false;
+  }
+
+  auto buf = std::make_unique<uint8_t[]>(size + 4);
+  evbuffer_copyout(input, buf.get(), size + 4);
+  return parse(msg, buf.get() + 4, size, flags);
+}
+
+/**
+ * Finds the operation in the payload of a frame. Protobuf serializes fields
+ * in the order of their numbers, so it is one of the first few bytes.
+ */
+static auto parse_operation(const uint8_t* buf, uint32_t size, uint32_t flags,
+                            int& operation) -> bool {
+  using google::protobuf::internal::WireFormatLite;
+  if (flags & compressed_frame) {
+    cloud::CloudMessage msg;
+    if (!parse(msg, buf, size, flags)) return false;
+    operation = msg.operation();
+    return true;
+  }
+  if (flags & compact_frame) {
+    if (size < compact_header_size) return false;
+    operation = buf[2];
+    return true;
+  }
+
+  google::protobuf::io::CodedInputStream input{buf, static_cast<int>(size)};
+  while (auto tag = input.ReadTag()) {
+    if (WireFormatLite::GetTagFieldNumber(tag) ==
+            cloud::CloudMessage::kOperationFieldNumber &&
+        WireFormatLite::GetTagWireType(tag) ==
+            WireFormatLite::WIRETYPE_VARINT) {
+      uint32_t value{};
+      if (!input.ReadVarint32(&value)) return false;
+      operation = static_cast<int>(value);
+      return true;
+    }
+    if (!WireFormatLite::SkipField(&input, tag)) return false;
+  }
+  // proto3 does not serialize the default value
+  operation = 0;
+  return input.ConsumedEntireMessage();
+}
+
+auto Connection::peek_operation(int& operation) const -> bool {
+  if (buffered) {
+    uint32_t size{};
+    uint32_t word{};
+    if (buffered->received || buffered->frame.size() < 4) return false;
+    memcpy(&word, buffered->frame.data(), 4);
+    auto flags = split_length(word, size);
+    if (buffered->frame.size() != size + 4) return false;
+    return parse_operation(
+        reinterpret_cast<const uint8_t*>(buffered->frame.data()) + 4, size,
+        flags, operation);
+  }
+  if (!bev) return false;
+
+  auto* input = bufferevent_get_input(static_cast<struct bufferevent*>(bev));
+  uint32_t size{};
+  if (evbuffer_copyout(input, &size, 4) < 4) return false;
+  auto flags = split_length(size, size);
+  if (size > max_message_size || evbuffer_get_length(input) < size + 4) {
+    return false;
+  }
+
+  // the frame is read from the buffer later anyway, making it contiguous
+  // spares a copy
+  auto* frame = evbuffer_pullup(input, size + 4);
+  return frame && parse_operation(frame + 4, size, flags, operation);
+}
+
+auto Connection::async_send(const cloud::CloudMessage& msg) const
+    -> Task<bool> {
+  // servers queue what the socket does not take, there is nothing to wait for
+  if (buffered || bev) co_return send(msg);
+
+  ScopedSpan span{"send"};
+  std::string payload;
+  auto size_nb = encode(msg, payload);
+  std::array<iovec, 2> iov{iovec{&size_nb, 4},
+                           iovec{payload.data(), payload.size()}};
+  auto* pending = iov.data();
+  size_t count = iov.size();
+
+  while (count > 0) {
+    msghdr header{};
+    header.msg_iov = pending;
+    header.msg_iovlen = count;
+    auto written = sendmsg(fd, &header, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (!co_await EventLoop::wait(fd, true, deadline)) co_return false;
+      continue;
+    }
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) co_return false;
+    skip_written(pending, count, static_cast<size_t>(written));
+  }
+
+  sent_bytes().add(payload.size() + 4);
+  co_return true;
+}
+
+auto Connection::async_receive(cloud::CloudMessage& msg) const -> Task<bool> {
+  // servers hand requests to handlers once they arrived completely
+  if (buffered || bev) co_return receive(msg);
+
+  ScopedSpan span{"receive"};
+  uint32_t size{};
+  if (!co_await async_read(&size, 4)) co_return false;
+  auto flags = split_length(size, size);
+
+  if (size > max_message_size) {
+    throw std::runtime_error(
+        "Connection received a message that exceeds the maximum message size");
+  }
+
+  auto buf = std::make_unique<uint8_t[]>(size);
+  if (!co_await async_read(buf.get(), size)) co_return false;
+  co_return decode(msg, buf.get(), size, flags);
+}
+
+auto Connection::async_read(void* buf, size_t size) const -> Task<bool> {
+  size_t done = 0;
+  while (done < size) {
+    auto n = recv(fd, static_cast<char*>(buf) + done, size - done,
+                  MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (!co_await EventLoop::wait(fd, false, deadline)) co_return false;
+      continue;
+    }
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) co_return false;
+    done += static_cast<size_t>(n);
+  }
+  co_return true;
+}
+
 }  // namespace cloudlab
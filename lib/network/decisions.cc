@@ -0,0 +1,98 @@
+#include "cloudlab/network/decisions.hh"
+#include "cloudlab/clock.hh"
+#include "cloudlab/network/connection.hh"
+
+#include <algorithm>
+#include <csignal>
+#include <pthread.h>
+
+#include "cloud.pb.h"
+
+namespace cloudlab {
+
+DecisionChannel::DecisionChannel()
+    : resends{metrics().counter(
+          "cloudlab_router_txn_decision_resends_total",
+          "Transaction decisions sent again because a participant missed them")},
+      delivered{metrics().counter(
+          "cloudlab_router_txn_decisions_recovered_total",
+          "Transaction decisions that reached a participant when sent again")} {
+  worker = std::thread([this]() { run(); });
+}
+
+DecisionChannel::~DecisionChannel() {
+  {
+    std::lock_guard<std::mutex> lck(mtx);
+    stopped = true;
+  }
+  cond.notify_all();
+  if (worker.joinable()) worker.join();
+}
+
+auto DecisionChannel::resend(const SocketAddress& peer,
+                             uint64_t transaction_id, bool commit) -> void {
+  std::lock_guard<std::mutex> lck(mtx);
+  pending.push_back({peer, transaction_id, commit,
+                     std::chrono::steady_clock::now() + decision_retry_interval,
+                     decision_retry_interval});
+  cond.notify_all();
+}
+
+auto DecisionChannel::run() -> void {
+  // a participant that closed the connection must not kill the router, writes
+  // fail with EPIPE instead
+  sigset_t pipe;
+  sigemptyset(&pipe);
+  sigaddset(&pipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipe, nullptr);
+
+  std::unique_lock<std::mutex> lck(mtx);
+  while (true) {
+    cond.wait(lck, [this]() { return stopped || !pending.empty(); });
+    if (stopped) return;
+
+    auto next = std::min_element(
+        pending.begin(), pending.end(),
+        [](const Decision& a, const Decision& b) { return a.due < b.due; });
+    auto due = next->due;
+    if (due > std::chrono::steady_clock::now()) {
+      // decisions queued meanwhile may be due earlier
+      cond.wait_until(lck, due);
+      continue;
+    }
+    auto decision = *next;
+    pending.erase(next);
+
+    lck.unlock();
+    resends.add();
+    auto answered = deliver(decision);
+    lck.lock();
+
+    if (answered) {
+      delivered.add();
+      continue;
+    }
+    decision.backoff = std::min(
+        decision.backoff * 2,
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            decision_max_backoff));
+    decision.due = std::chrono::steady_clock::now() + decision.backoff;
+    pending.push_back(decision);
+  }
+}
+
+auto DecisionChannel::deliver(const Decision& decision) -> bool {
+  cloud::CloudMessage request;
+  request.set_type(cloud::CloudMessage_Type_REQUEST);
+  request.set_operation(decision.commit
+                            ? cloud::CloudMessage_Operation_TXN_COMMIT
+                            : cloud::CloudMessage_Operation_TXN_ABORT);
+  request.set_transaction_id(decision.transaction_id);
+
+  Connection peer{decision.peer};
+  peer.set_deadline(now_ms() + decision_ack_timeout_ms);
+  cloud::CloudMessage response;
+  return peer.send(request) && peer.receive(response);
+}
+
+}  // namespace cloudlab
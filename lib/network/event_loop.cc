@@ -0,0 +1,130 @@
+#include "cloudlab/network/event_loop.hh"
+#include "cloudlab/clock.hh"
+
+#include <event2/event.h>
+#include <poll.h>
+#include <time.h>
+#include <stdexcept>
+
+namespace cloudlab {
+
+static thread_local EventLoop* current_loop{nullptr};
+
+EventLoop::EventLoop(void* base) : base{base} {
+  if (current_loop) {
+    throw std::logic_error{"thread has an event loop already"};
+  }
+  current_loop = this;
+}
+
+EventLoop::~EventLoop() {
+  current_loop = nullptr;
+}
+
+auto EventLoop::current() -> EventLoop* {
+  return current_loop;
+}
+
+auto EventLoop::Readiness::await_suspend(std::coroutine_handle<> handle)
+    -> bool {
+  auto now = now_ms();
+  if (deadline && deadline <= now) return false;
+
+  if (!current_loop) {
+    pollfd pfd{fd, static_cast<short>(write ? POLLOUT : POLLIN), 0};
+    auto timeout = deadline ? static_cast<int>(deadline - now) : -1;
+    ready = poll(&pfd, 1, timeout) > 0;
+    return false;
+  }
+
+  timeval timeout{};
+  if (deadline) {
+    auto left = deadline - now;
+    timeout.tv_sec = static_cast<time_t>(left / 1000);
+    timeout.tv_usec = static_cast<suseconds_t>((left % 1000) * 1000);
+  }
+  if (event_base_once(static_cast<struct event_base*>(current_loop->base), fd,
+                      write ? EV_WRITE : EV_READ, resume, this,
+                      deadline ? &timeout : nullptr) != 0) {
+    return false;
+  }
+
+  // the loop runs other coroutines until the socket is ready
+  this->handle = handle;
+  span = Tracer::current();
+  Tracer::set_current({});
+  return true;
+}
+
+auto EventLoop::Readiness::await_resume() -> bool {
+  if (handle) Tracer::set_current(span);
+  return ready;
+}
+
+auto EventLoop::Readiness::resume(int, short events, void* arg) -> void {
+  auto* readiness = static_cast<Readiness*>(arg);
+  readiness->ready = (events & (EV_READ | EV_WRITE)) != 0;
+  readiness->handle.resume();
+}
+
+EventLoop::AnyReadable::~AnyReadable() {
+  for (auto* event : events) {
+    if (event) event_free(static_cast<struct event*>(event));
+  }
+}
+
+auto EventLoop::AnyReadable::await_suspend(std::coroutine_handle<> handle)
+    -> bool {
+  if (timeout.count() < 0) timeout = std::chrono::microseconds(0);
+  auto usec = timeout.count();
+
+  if (!current_loop) {
+    std::array<pollfd, 2> pfds{pollfd{fds[0], POLLIN, 0},
+                               pollfd{fds[1], POLLIN, 0}};
+    timespec ts{static_cast<time_t>(usec / 1000000),
+                static_cast<long>(usec % 1000000 * 1000)};
+    if (ppoll(pfds.data(), count, &ts, nullptr) > 0) {
+      result = pfds[0].revents != 0 ? 0 : 1;
+    }
+    return false;
+  }
+
+  timeval tv{static_cast<time_t>(usec / 1000000),
+             static_cast<suseconds_t>(usec % 1000000)};
+  auto* base = static_cast<struct event_base*>(current_loop->base);
+  for (size_t i = 0; i < count; i++) {
+    auto* event = event_new(base, fds[i], EV_READ, resume, this);
+    events[i] = event;
+    // a single timeout is enough, it fires for the first socket
+    if (!event || event_add(event, i == 0 ? &tv : nullptr) != 0) {
+      for (auto* e : events) {
+        if (e) event_del(static_cast<struct event*>(e));
+      }
+      return false;
+    }
+  }
+
+  this->handle = handle;
+  span = Tracer::current();
+  Tracer::set_current({});
+  return true;
+}
+
+auto EventLoop::AnyReadable::await_resume() -> int {
+  if (handle) Tracer::set_current(span);
+  return result;
+}
+
+auto EventLoop::AnyReadable::resume(int fd, short events, void* arg) -> void {
+  auto* readable = static_cast<AnyReadable*>(arg);
+  // the other events must not fire for an awaiter that is gone
+  for (auto* event : readable->events) {
+    if (event) event_del(static_cast<struct event*>(event));
+  }
+  if (events & EV_READ) {
+    readable->result = fd == readable->fds[0] ? 0 : 1;
+  }
+  readable->handle.resume();
+}
+
+}  // namespace cloudlab
@@ -0,0 +1,104 @@
+#include "cloudlab/network/metadata.hh"
+#include "cloudlab/clock.hh"
+
+#include <csignal>
+#include <pthread.h>
+
+#include "cloud.pb.h"
+
+namespace cloudlab {
+
+MetadataChannel::MetadataChannel(std::string sender,
+                                 std::optional<SocketAddress> router)
+    : sender{std::move(sender)},
+      router{std::move(router)},
+      // a restarted peer continues above the sequence numbers of its previous
+      // run, the router would ignore its batches otherwise
+      next_sequence{now_ms() << 16},
+      batches{metrics().counter("cloudlab_metadata_batches_total",
+                                "Metadata batches acknowledged by the router",
+                                {{"peer", this->sender}})},
+      resends{metrics().counter(
+          "cloudlab_metadata_resends_total",
+          "Metadata batches sent again because the router did not answer",
+          {{"peer", this->sender}})} {
+  if (this->router) worker = std::thread([this]() { run(); });
+}
+
+MetadataChannel::~MetadataChannel() {
+  {
+    std::lock_guard<std::mutex> lck(mtx);
+    stopped = true;
+  }
+  cond.notify_all();
+  if (worker.joinable()) worker.join();
+}
+
+auto MetadataChannel::publish(uint32_t partition, const std::string& peer,
+                              bool removed) -> uint64_t {
+  if (!router) return 0;
+  std::lock_guard<std::mutex> lck(mtx);
+  pending[{partition, peer}] = removed;
+  cond.notify_all();
+  return next_sequence;
+}
+
+auto MetadataChannel::run() -> void {
+  // a router that closed the connection must not kill the peer, writes fail
+  // with EPIPE instead
+  sigset_t pipe;
+  sigemptyset(&pipe);
+  sigaddset(&pipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipe, nullptr);
+
+  std::unique_lock<std::mutex> lck(mtx);
+  while (true) {
+    cond.wait(lck, [this]() { return stopped || !pending.empty(); });
+    if (pending.empty()) return;
+
+    cloud::CloudMessage batch;
+    batch.set_type(cloud::CloudMessage_Type_REQUEST);
+    batch.set_operation(cloud::CloudMessage_Operation_PARTITIONS_CHANGED);
+    batch.set_success(true);
+    batch.mutable_address()->set_address(sender);
+    batch.set_sequence(next_sequence++);
+    for (auto& [update, removed] : pending) {
+      auto* partition = batch.add_partition();
+      partition->set_id(update.first);
+      partition->set_peer(update.second);
+      partition->set_removed(removed);
+    }
+    pending.clear();
+
+    // updates queued meanwhile go into the next batch
+    for (auto attempt = 0;; attempt++) {
+      if (attempt > 0) {
+        if (cond.wait_for(lck, metadata_retry_interval,
+                          [this]() { return stopped; })) {
+          return;
+        }
+        resends.add();
+      }
+      lck.unlock();
+      auto delivered = deliver(batch);
+      lck.lock();
+      if (delivered) break;
+    }
+    batches.add();
+  }
+}
+
+auto MetadataChannel::deliver(const cloud::CloudMessage& batch) -> bool {
+  if (!connection) connection = std::make_unique<Connection>(*router);
+
+  cloud::CloudMessage ack;
+  connection->set_deadline(now_ms() + metadata_ack_timeout_ms);
+  if (connection->send(batch) && connection->receive(ack) && ack.success() &&
+      ack.sequence() >= batch.sequence()) {
+    return true;
+  }
+  connection.reset();
+  return false;
+}
+
+}  // namespace cloudlab
@@ -0,0 +1,104 @@
+#include "cloudlab/network/metrics_endpoint.hh"
+#include "cloudlab/metrics.hh"
+#include "cloudlab/network/address.hh"
+
+#include "fmt/core.h"
+
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace cloudlab {
+
+// scrapers that do not send their request within this time are dropped
+const auto scrape_timeout_ms = 1000;
+
+static auto write_fully(int fd, const std::string& data) -> void {
+  size_t done = 0;
+  while (done < data.size()) {
+    auto n = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return;
+    done += n;
+  }
+}
+
+/**
+ * Reads the request up to the end of its header, the request itself is
+ * ignored.
+ */
+static auto read_request(int fd) -> bool {
+  std::string request;
+  char buffer[1024];
+  while (request.find("\r\n\r\n") == std::string::npos) {
+    auto n = read(fd, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    request.append(buffer, n);
+    if (request.size() > 16 * sizeof(buffer)) return false;
+  }
+  return true;
+}
+
+auto serve_metrics(const std::string& address) -> std::thread {
+  auto socket_address = SocketAddress{address};
+
+  addrinfo hints{}, *req = nullptr;
+  memset(&hints, 0, sizeof(addrinfo));
+  hints.ai_family = socket_address.is_ipv4() ? AF_INET : AF_INET6;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  if (getaddrinfo(socket_address.get_ip_address().c_str(),
+                  std::to_string(socket_address.get_port()).c_str(), &hints,
+                  &req) != 0) {
+    throw std::runtime_error{"getaddrinfo() failed"};
+  }
+
+  auto fd = socket(req->ai_family, req->ai_socktype, req->ai_protocol);
+  if (fd == -1) {
+    throw std::runtime_error{"socket() failed"};
+  }
+
+  int yes = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1 ||
+      bind(fd, req->ai_addr, req->ai_addrlen) == -1 || listen(fd, 16) == -1) {
+    freeaddrinfo(req);
+    close(fd);
+    throw std::runtime_error{
+        fmt::format("could not serve metrics on {}", address)};
+  }
+  freeaddrinfo(req);
+
+  return std::thread([fd]() {
+    while (true) {
+      auto client = accept(fd, nullptr, nullptr);
+      if (client == -1) {
+        if (errno == EINTR || errno == ECONNABORTED) continue;
+        break;
+      }
+
+      timeval timeout{scrape_timeout_ms / 1000, scrape_timeout_ms % 1000 * 1000};
+      setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+      if (read_request(client)) {
+        auto body = metrics().prometheus();
+        write_fully(client,
+                    fmt::format("HTTP/1.1 200 OK\r\n"
+                                "Content-Type: text/plain; version=0.0.4\r\n"
+                                "Content-Length: {}\r\n"
+                                "Connection: close\r\n\r\n",
+                                body.size()));
+        write_fully(client, body);
+      }
+      close(client);
+    }
+    close(fd);
+  });
+}
+
+}  // namespace cloudlab
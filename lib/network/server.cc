@@ -1,6 +1,12 @@
 #include "cloudlab/network/server.hh"
+#include "cloudlab/arena.hh"
 #include "cloudlab/network/address.hh"
+#include "cloudlab/network/event_loop.hh"
 #include "cloudlab/spmc.hh"
+#include "cloudlab/tracing.hh"
+
+#include "cloud.pb.h"
+#include "fmt/core.h"
 
 #include <cstring>
 #include <thread>
@@ -9,32 +15,117 @@
 #include <event2/bufferevent.h>
 #include <event2/event.h>
 #include <event2/listener.h>
+#include <event2/thread.h>
 #include <netdb.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 namespace cloudlab {
 
+auto Server::shed(Connection &con) -> bool {
+  cloud::CloudMessage request{}, response{};
+  if (!con.peek(request)) return false;
+
+  switch (request.operation()) {
+    case cloud::CloudMessage_Operation_PUT:
+    case cloud::CloudMessage_Operation_GET:
+    case cloud::CloudMessage_Operation_DELETE:
+    case cloud::CloudMessage_Operation_COMPARE_AND_SWAP:
+    case cloud::CloudMessage_Operation_INCREMENT:
+    case cloud::CloudMessage_Operation_APPEND:
+    case cloud::CloudMessage_Operation_TRANSACTION:
+      break;
+    default:
+      return false;
+  }
+
+  con.receive(request);
+  response.set_type(cloud::CloudMessage_Type_RESPONSE);
+  response.set_operation(request.operation());
+  response.set_success(false);
+  response.set_message("BUSY");
+  con.send(response);
+  return true;
+}
+
+auto parse_server_backend(const std::string &name) -> ServerBackend {
+  if (name == "libevent") return ServerBackend::LIBEVENT;
+  if (name == "io_uring") return ServerBackend::IO_URING;
+  throw std::invalid_argument(fmt::format("unknown server backend {}", name));
+}
+
 auto Server::run() -> std::thread {
+  // set up the ring before starting any thread s.t. an unsupported kernel
+  // fails the caller
+  if (backend == ServerBackend::IO_URING) {
+    auto thread = uring_server(address, bev_queue, admission);
+    for (auto i = 0; i < num_workers; i++) {
+      workers[i] = std::thread(worker, std::ref(handler), std::ref(bev_queue),
+                               std::ref(admission));
+    }
+    return thread;
+  }
+
   // spawn workers
   for (auto i = 0; i < num_workers; i++) {
-    workers[i] = std::thread(worker, std::ref(handler), std::ref(bev_queue));
+    workers[i] = std::thread(worker, std::ref(handler), std::ref(bev_queue),
+                             std::ref(admission));
   }
 
   // spawn server thread that handles incoming connections
-  auto thread = std::thread(server, address, std::ref(bev_queue));
+  auto thread =
+      std::thread(server, address, std::ref(bev_queue), std::ref(admission),
+                  std::ref(handler));
 
   // return thread handle
   return thread;
 }
 
-auto Server::server(const std::string &address, SPMCQueue<void *> &bev_queue)
-    -> void {
+/**
+ * Gives a connection whose request was handled back to the event loop and
+ * drops the reference that the handler held (see read_handler). The event
+ * loop frees a connection that fails while a handler owns it, e.g., on a
+ * write error of a response that it sends in the background. Such a
+ * connection is only kept alive until here and not read from anymore.
+ */
+static auto hand_back(struct bufferevent *bev) -> void {
+  bufferevent_lock(bev);
+  // bufferevent_free removes the callbacks
+  bufferevent_data_cb read_cb{};
+  bufferevent_getcb(bev, &read_cb, nullptr, nullptr, nullptr);
+  if (read_cb) bufferevent_enable(bev, EV_READ);
+  bufferevent_unlock(bev);
+  bufferevent_decref(bev);
+}
+
+/**
+ * Handles a request with a coroutine handler on the event loop of the server
+ * thread and re-enables reading once the handler is done.
+ */
+static auto serve(ServerHandler &handler, struct bufferevent *bev,
+                  ServerMetrics &metrics) -> Detached {
+  Connection con{static_cast<void *>(bev)};
+  co_await handler.handle_connection_async(con);
+  metrics.in_flight--;
+  hand_back(bev);
+}
+
+auto Server::server(const std::string &address, SPMCQueue<Request> &bev_queue,
+                    Admission &admission, ServerHandler &handler) -> void {
   auto socket_address = SocketAddress{address};
 
   addrinfo hints{}, *req = nullptr;
   memset(&hints, 0, sizeof(addrinfo));
 
-  if (socket_address.is_ipv4()) {
+  // Unix domain sockets are bound to their path, a socket file left behind
+  // by a previous run is replaced
+  sockaddr_un un{};
+  socklen_t un_length{};
+  if (socket_address.is_unix()) {
+    un_length = socket_address.unix_address(un);
+    unlink(socket_address.get_path().c_str());
+  } else if (socket_address.is_ipv4()) {
     hints.ai_family = AF_INET;
     hints.ai_addrlen = sizeof(struct sockaddr_in);
   } else {
@@ -45,7 +136,8 @@ auto Server::server(const std::string &address, SPMCQueue<void *> &bev_queue)
   hints.ai_socktype = SOCK_STREAM;
   hints.ai_flags = IPPROTO_TCP;
 
-  if (getaddrinfo(socket_address.get_ip_address().c_str(),
+  if (!socket_address.is_unix() &&
+      getaddrinfo(socket_address.get_ip_address().c_str(),
                   std::to_string(socket_address.get_port()).c_str(), &hints,
                   &req) != 0) {
     throw std::runtime_error{"getaddrinfo() failed"};
@@ -55,54 +147,116 @@ auto Server::server(const std::string &address, SPMCQueue<void *> &bev_queue)
   struct evconnlistener *listener{};
   struct event *signal_event{};
 
+  // workers queue responses in the output buffers of bufferevents that the
+  // event loop writes, which needs locking
+  static auto threads = evthread_use_pthreads();
+  if (threads != 0) {
+    throw std::runtime_error{"could not enable libevent threading"};
+  }
+
   base = event_base_new();
   if (!base) {
     throw std::runtime_error{"could not initialize libevent\n"};
   }
 
-  auto base_and_bev_queue = std::pair{base, &bev_queue};
+  // coroutine handlers wait for sockets on this loop
+  EventLoop loop{base};
+
+  struct Context {
+    struct event_base *base;
+    SPMCQueue<Request> *bev_queue;
+    Admission *admission;
+    ServerHandler *handler;
+  };
+  auto context = Context{base, &bev_queue, &admission, &handler};
 
   auto listen_handler = [](struct evconnlistener *, evutil_socket_t fd,
                            struct sockaddr *, int, void *user_data) {
     auto read_handler = [](struct bufferevent *bev, void *user_data) {
-      auto *bev_queue = static_cast<SPMCQueue<void *> *>(user_data);
+      auto *context = static_cast<Context *>(user_data);
+      auto &metrics = *context->admission->metrics;
+
+      // wait for the rest of a large message, a worker must not block on a
+      // partially received one
+      Connection con{static_cast<void *>(bev)};
+      if (!con.has_message()) return;
 
       // disable read event handler before passing event to worker thread s.t.
       // no more events are triggered before and during connection handling
       bufferevent_disable(bev, EV_READ);
-      bev_queue->produce(bev);
+
+      // the handler holds a reference until it hands the connection back,
+      // event_handler may free it meanwhile (see hand_back)
+      bufferevent_incref(bev);
+
+      // coroutine handlers run right here, there is no queue to wait in. The
+      // queue capacity bounds the requests they handle concurrently.
+      if (context->handler->is_async(con)) {
+        if (metrics.in_flight >= context->admission->config.queue_capacity &&
+            shed(con)) {
+          metrics.shed_queue_full++;
+          bufferevent_decref(bev);
+          bufferevent_enable(bev, EV_READ);
+          return;
+        }
+        metrics.in_flight++;
+        serve(*context->handler, bev, metrics);
+        return;
+      }
+
+      // fail fast if the workers fall behind too far
+      Request request{bev, std::chrono::steady_clock::now()};
+      metrics.queue_depth++;
+      if (!context->bev_queue->try_produce(request)) {
+        if (shed(con)) {
+          metrics.queue_depth--;
+          metrics.shed_queue_full++;
+          bufferevent_decref(bev);
+          bufferevent_enable(bev, EV_READ);
+          return;
+        }
+        context->bev_queue->produce(request);
+      }
     };
 
-    auto event_handler = [](struct bufferevent *bev, short events, void *) {
+    auto event_handler = [](struct bufferevent *bev, short events,
+                            void *user_data) {
       if (events & BEV_EVENT_EOF) {
         // fmt::print("connection closed.\n");
       } else if (events & BEV_EVENT_ERROR) {
         // fmt::print("got an error on the connection: {}\n", strerror(errno));
       }
 
+      static_cast<Context *>(user_data)->admission->metrics->connections--;
       bufferevent_free(bev);
     };
 
-    auto *base_and_bev_queue =
-        static_cast<std::pair<struct event_base *, SPMCQueue<void *> *> *>(
-            user_data);
+    auto *context = static_cast<Context *>(user_data);
+    auto &metrics = *context->admission->metrics;
 
-    auto *base = base_and_bev_queue->first;
-    auto *bev_queue = base_and_bev_queue->second;
+    if (metrics.connections >= context->admission->config.max_connections) {
+      metrics.rejected_connections++;
+      evutil_closesocket(fd);
+      return;
+    }
 
-    auto *bev = bufferevent_socket_new(base, fd, BEV_OPT_CLOSE_ON_FREE);
+    auto *bev =
+        bufferevent_socket_new(context->base, fd,
+                               BEV_OPT_CLOSE_ON_FREE | BEV_OPT_THREADSAFE);
     if (!bev) {
       throw std::runtime_error{"could not construct bufferevent"};
     }
+    metrics.connections++;
 
-    bufferevent_setcb(bev, read_handler, nullptr, event_handler, bev_queue);
+    bufferevent_setcb(bev, read_handler, nullptr, event_handler, context);
     bufferevent_enable(bev, EV_READ);
   };
 
   listener = evconnlistener_new_bind(
-      base, listen_handler, &base_and_bev_queue,
+      base, listen_handler, &context,
       LEV_OPT_REUSEABLE | LEV_OPT_CLOSE_ON_FREE | LEV_OPT_THREADSAFE, -1,
-      req->ai_addr, req->ai_addrlen);
+      req ? req->ai_addr : reinterpret_cast<sockaddr *>(&un),
+      req ? static_cast<int>(req->ai_addrlen) : static_cast<int>(un_length));
 
   if (!listener) {
     throw std::runtime_error{"could not create a listener\n"};
@@ -114,19 +268,43 @@ auto Server::server(const std::string &address, SPMCQueue<void *> &bev_queue)
   event_base_free(base);
 }
 
-auto Server::worker(ServerHandler &handler, SPMCQueue<void *> &bev_queue)
-    -> void {
+auto Server::worker(ServerHandler &handler, SPMCQueue<Request> &bev_queue,
+                    Admission &admission) -> void {
+  auto &metrics = *admission.metrics;
   while (true) {
-    auto *bev = bev_queue.consume();
+    auto request = bev_queue.consume();
+    auto *bev = request.bev;
 
     // exit worker thread on nullptr
-    if (!bev) return;
+    if (!bev && !request.buffered) return;
+    metrics.queue_depth--;
 
-    Connection con{static_cast<void *>(bev)};
-    handler.handle_connection(con);
+    // requests that queued for too long are answered with BUSY right away,
+    // their clients have likely given up or will retry
+    auto now = std::chrono::steady_clock::now();
+    admission.queue_wait.record(now - request.enqueued_at);
+    Tracer::set_dequeued(request.enqueued_at, now);
+    auto con = request.buffered ? Connection{request.buffered}
+                                : Connection{static_cast<void *>(bev)};
+    if (admission.shedder.should_shed(now - request.enqueued_at, now) &&
+        shed(con)) {
+      metrics.shed_queue_time++;
+    } else {
+      metrics.in_flight++;
+      handler.handle_connection(con);
+      metrics.in_flight--;
+    }
+
+    // the messages of the request are gone, keep the arena's first block
+    reset_request_arena();
 
-    // re-enable event handler after connection handling
-    bufferevent_enable(static_cast<struct bufferevent *>(bev), EV_READ);
+    if (request.buffered) {
+      // hand the responses back to the ring
+      request.buffered->complete(request.buffered, request.buffered->context);
+    } else {
+      // re-enable event handler after connection handling
+      hand_back(static_cast<struct bufferevent *>(bev));
+    }
   }
 }
 
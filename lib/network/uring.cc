@@ -0,0 +1,579 @@
+#include "cloudlab/network/address.hh"
+#include "cloudlab/network/compression.hh"
+#include "cloudlab/network/connection.hh"
+#include "cloudlab/network/server.hh"
+#include "cloudlab/network/wire.hh"
+
+#include "fmt/core.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#ifdef CLOUDLAB_HAVE_IO_URING
+#include <arpa/inet.h>
+#include <atomic>
+#include <linux/io_uring.h>
+#include <mutex>
+#include <netdb.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#endif
+
+namespace cloudlab {
+
+#ifndef CLOUDLAB_HAVE_IO_URING
+
+auto Server::uring_server(const std::string&, SPMCQueue<Request>&, Admission&)
+    -> std::thread {
+  throw std::runtime_error{"built without io_uring support"};
+}
+
+#else
+
+// the ring is shared by all connections of a server, a submission is queued
+// per connection at most for its receive and its send
+const unsigned ring_entries = 1024;
+
+// buffers of the provided buffer ring, received bytes are copied out of them
+// right away s.t. they are returned to the kernel quickly
+const unsigned buffer_count = 256;
+const unsigned buffer_size = 16 * 1024;
+const uint16_t buffer_group = 0;
+
+// operation of a completion, stored in the upper bits of its user data
+enum : uint64_t { ACCEPT = 1, RECEIVE, SEND, WAKE };
+const auto operation_shift = 56;
+
+static auto user_data(uint64_t operation, uint64_t connection) -> uint64_t {
+  return (operation << operation_shift) | connection;
+}
+
+static auto system_error(const std::string& what) -> std::runtime_error {
+  return std::runtime_error{fmt::format("{}: {}", what, strerror(errno))};
+}
+
+/**
+ * An io_uring set up with raw system calls, liburing is not available
+ * everywhere.
+ */
+class Ring {
+ public:
+  explicit Ring(unsigned entries) {
+    io_uring_params params{};
+    fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0) throw system_error("io_uring_setup() failed");
+
+    sq_length = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_length = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) sq_length = cq_length = std::max(sq_length, cq_length);
+
+    sq = map(sq_length, IORING_OFF_SQ_RING);
+    cq = single_mmap ? sq : map(cq_length, IORING_OFF_CQ_RING);
+    sqes_length = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe*>(map(sqes_length, IORING_OFF_SQES));
+
+    sq_head = at<unsigned>(sq, params.sq_off.head);
+    sq_tail = at<unsigned>(sq, params.sq_off.tail);
+    sq_mask = *at<unsigned>(sq, params.sq_off.ring_mask);
+    sq_array = at<unsigned>(sq, params.sq_off.array);
+    sq_entries = params.sq_entries;
+    cq_head = at<unsigned>(cq, params.cq_off.head);
+    cq_tail = at<unsigned>(cq, params.cq_off.tail);
+    cq_mask = *at<unsigned>(cq, params.cq_off.ring_mask);
+    cqes = at<io_uring_cqe>(cq, params.cq_off.cqes);
+    tail = *sq_tail;
+  }
+
+  Ring(const Ring&) = delete;
+  Ring& operator=(const Ring&) = delete;
+
+  ~Ring() {
+    if (buffers) munmap(buffers, buffers_length);
+    munmap(sqes, sqes_length);
+    if (!single_mmap) munmap(cq, cq_length);
+    munmap(sq, sq_length);
+    close(fd);
+  }
+
+  /**
+   * Registers a provided buffer ring of count buffers of size bytes, from
+   * which multishot receives pick their buffers.
+   */
+  auto register_buffers(uint16_t group, unsigned count, unsigned size)
+      -> void {
+    buffers_length = count * sizeof(io_uring_buf);
+    auto* memory = mmap(nullptr, buffers_length, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) throw system_error("mmap() failed");
+    // io_uring_buf_ring declares its entries as a flexible array, which C++
+    // compilers place behind an empty struct, so index the entries directly.
+    // The tail overlays the reserved field of the first entry.
+    buffers = static_cast<io_uring_buf*>(memory);
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(buffers);
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg,
+                1) < 0) {
+      throw system_error("registering the buffer ring failed");
+    }
+
+    buffer_memory.resize(static_cast<size_t>(count) * size);
+    buffer_mask = count - 1;
+    buffer_size = size;
+    for (unsigned i = 0; i < count; i++) {
+      provide_buffer(static_cast<uint16_t>(i));
+    }
+  }
+
+  [[nodiscard]] auto buffer(uint16_t id) -> const char* {
+    return buffer_memory.data() + static_cast<size_t>(id) * buffer_size;
+  }
+
+  /**
+   * Returns a buffer to the kernel once its contents were consumed.
+   */
+  auto provide_buffer(uint16_t id) -> void {
+    auto& entry = buffers[buffer_tail & buffer_mask];
+    entry.addr = reinterpret_cast<uint64_t>(buffer(id));
+    entry.len = buffer_size;
+    entry.bid = id;
+    buffer_tail++;
+    std::atomic_ref{buffers[0].resv}.store(buffer_tail,
+                                           std::memory_order_release);
+  }
+
+  /**
+   * @return  a cleared submission queue entry, submits the queued ones first
+   *          if the queue is full
+   */
+  auto get_sqe() -> io_uring_sqe* {
+    auto head = std::atomic_ref{*sq_head}.load(std::memory_order_acquire);
+    if (tail - head >= sq_entries) {
+      submit(0);
+      head = std::atomic_ref{*sq_head}.load(std::memory_order_acquire);
+      if (tail - head >= sq_entries) {
+        throw std::runtime_error{"io_uring submission queue overflow"};
+      }
+    }
+    auto index = tail & sq_mask;
+    auto* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    tail++;
+    queued++;
+    return sqe;
+  }
+
+  /**
+   * Submits all queued entries in a single system call and waits for at
+   * least wait completions.
+   */
+  auto submit(unsigned wait) -> void {
+    std::atomic_ref{*sq_tail}.store(tail, std::memory_order_release);
+    auto flags = wait ? IORING_ENTER_GETEVENTS : 0u;
+    while (syscall(__NR_io_uring_enter, fd, queued, wait, flags, nullptr, 0) <
+           0) {
+      if (errno != EINTR) throw system_error("io_uring_enter() failed");
+    }
+    queued = 0;
+  }
+
+  template <typename F>
+  auto for_each_completion(F&& f) -> void {
+    auto head = *cq_head;
+    auto end = std::atomic_ref{*cq_tail}.load(std::memory_order_acquire);
+    for (; head != end; head++) {
+      // copy s.t. the slot can be reused once head advanced
+      auto cqe = cqes[head & cq_mask];
+      std::atomic_ref{*cq_head}.store(head + 1, std::memory_order_release);
+      f(cqe);
+    }
+  }
+
+ private:
+  auto map(size_t length, off_t offset) -> void* {
+    auto* memory = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, offset);
+    if (memory == MAP_FAILED) throw system_error("mmap() failed");
+    return memory;
+  }
+
+  template <typename T>
+  static auto at(void* base, uint32_t offset) -> T* {
+    return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+  }
+
+  int fd{-1};
+  bool single_mmap{};
+  void* sq{};
+  void* cq{};
+  io_uring_sqe* sqes{};
+  size_t sq_length{}, cq_length{}, sqes_length{};
+
+  unsigned* sq_head{};
+  unsigned* sq_tail{};
+  unsigned* sq_array{};
+  unsigned sq_mask{}, sq_entries{};
+  unsigned tail{}, queued{};
+
+  unsigned* cq_head{};
+  unsigned* cq_tail{};
+  unsigned cq_mask{};
+  io_uring_cqe* cqes{};
+
+  io_uring_buf* buffers{};
+  size_t buffers_length{};
+  std::vector<char> buffer_memory;
+  uint16_t buffer_tail{}, buffer_mask{};
+  unsigned buffer_size{};
+};
+
+/**
+ * Creates a listening socket for a TCP or Unix domain socket address.
+ */
+static auto listen_on(const SocketAddress& address) -> int {
+  sockaddr_storage storage{};
+  socklen_t length{};
+  if (address.is_unix()) {
+    // a socket file left behind by a previous run is replaced
+    length = address.unix_address(reinterpret_cast<sockaddr_un&>(storage));
+    unlink(address.get_path().c_str());
+  } else {
+    addrinfo hints{}, *req = nullptr;
+    hints.ai_family = address.is_ipv4() ? AF_INET : AF_INET6;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(address.get_ip_address().c_str(),
+                    std::to_string(address.get_port()).c_str(), &hints,
+                    &req) != 0) {
+      throw std::runtime_error{"getaddrinfo() failed"};
+    }
+    length = req->ai_addrlen;
+    memcpy(&storage, req->ai_addr, length);
+    freeaddrinfo(req);
+  }
+
+  auto fd = socket(storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) throw system_error("socket() failed");
+  auto reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  if (bind(fd, reinterpret_cast<sockaddr*>(&storage), length) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    close(fd);
+    throw system_error(fmt::format("could not listen on {}", address.string()));
+  }
+  return fd;
+}
+
+/**
+ * Event loop of the io_uring backend. A single thread owns the ring and all
+ * connections. It accepts connections and receives requests with multishot
+ * operations, extracts complete frames and hands them to the workers. Workers
+ * buffer the responses, which the loop sends in the next batch of
+ * submissions. Like with libevent, a connection has at most one request in
+ * flight, further requests stay in its input until the response was
+ * buffered.
+ */
+class Server::UringLoop {
+ public:
+  UringLoop(const std::string& address, SPMCQueue<Request>& queue,
+            Admission& admission)
+      : queue{queue}, admission{admission}, ring{ring_entries} {
+    ring.register_buffers(buffer_group, buffer_count, buffer_size);
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd == -1) throw system_error("eventfd() failed");
+    listen_fd = listen_on(SocketAddress{address});
+  }
+
+  UringLoop(const UringLoop&) = delete;
+  UringLoop& operator=(const UringLoop&) = delete;
+
+  ~UringLoop() {
+    close(listen_fd);
+    close(wake_fd);
+  }
+
+  auto run() -> void {
+    accept();
+    wait_for_workers();
+    while (true) {
+      ring.submit(1);
+      ring.for_each_completion([this](const io_uring_cqe& cqe) {
+        auto id = cqe.user_data & ((1ull << operation_shift) - 1);
+        switch (cqe.user_data >> operation_shift) {
+          case ACCEPT:
+            accepted(cqe);
+            break;
+          case RECEIVE:
+            received(id, cqe);
+            break;
+          case SEND:
+            sent(id, cqe);
+            break;
+          case WAKE:
+            completed();
+            break;
+        }
+      });
+    }
+  }
+
+ private:
+  struct UringConnection {
+    int fd;
+
+    // received bytes that do not form a handled request yet
+    std::string input{};
+
+    // the request a worker handles, if busy
+    BufferedRequest request{};
+    bool busy{false};
+
+    // responses in flight and responses that are sent after them, the
+    // buffer of a pending send must not move
+    std::string sending{};
+    size_t sent{};
+    std::string output{};
+
+    // receiving stopped, the connection is closed once idle
+    bool closing{false};
+  };
+
+  static auto complete(BufferedRequest* request, void* context) -> void {
+    auto* loop = static_cast<UringLoop*>(context);
+    {
+      std::lock_guard lock{loop->outbox_mutex};
+      loop->outbox.push_back(request->connection);
+    }
+    uint64_t one = 1;
+    if (write(loop->wake_fd, &one, sizeof(one)) < 0) {
+      // the counter is non-zero already, the loop wakes up anyway
+    }
+  }
+
+  auto accept() -> void {
+    auto* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = user_data(ACCEPT, 0);
+  }
+
+  auto receive(uint64_t id, const UringConnection& con) -> void {
+    auto* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = con.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = buffer_group;
+    sqe->user_data = user_data(RECEIVE, id);
+  }
+
+  auto wait_for_workers() -> void {
+    auto* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wake_fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&wake_counter);
+    sqe->len = sizeof(wake_counter);
+    sqe->user_data = user_data(WAKE, 0);
+  }
+
+  auto accepted(const io_uring_cqe& cqe) -> void {
+    if (!(cqe.flags & IORING_CQE_F_MORE)) accept();
+    if (cqe.res < 0) return;
+
+    auto& metrics = *admission.metrics;
+    if (metrics.connections >= admission.config.max_connections) {
+      metrics.rejected_connections++;
+      close(cqe.res);
+      return;
+    }
+    metrics.connections++;
+
+    auto id = next_id++;
+    auto& con = connections[id];
+    con = std::make_unique<UringConnection>();
+    con->fd = cqe.res;
+    con->request.connection = id;
+    con->request.complete = complete;
+    con->request.context = this;
+    receive(id, *con);
+  }
+
+  auto received(uint64_t id, const io_uring_cqe& cqe) -> void {
+    auto it = connections.find(id);
+    if (it == connections.end()) return;
+    auto& con = *it->second;
+
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+      auto buffer = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+      if (cqe.res > 0) con.input.append(ring.buffer(buffer), cqe.res);
+      ring.provide_buffer(buffer);
+    }
+
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+      // out of buffers for a moment, the connection itself is fine
+      if (cqe.res == -ENOBUFS && !con.closing) {
+        receive(id, con);
+      } else {
+        con.closing = true;
+      }
+    }
+
+    dispatch(id, con);
+    close_if_idle(id, con);
+  }
+
+  /**
+   * Hands the next complete request of a connection to the workers.
+   */
+  auto dispatch(uint64_t id, UringConnection& con) -> void {
+    if (con.busy || con.input.size() < 4) return;
+    uint32_t size{};
+    memcpy(&size, con.input.data(), 4);
+    size = ntohl(size) & ~(compact_frame | compressed_frame |
+                           accepts_compression);
+    if (size > max_message_size) {
+      // the stream cannot be resynchronized, the peer sees the connection
+      // close
+      con.input.clear();
+      shutdown(con.fd, SHUT_RDWR);
+      return;
+    }
+    if (con.input.size() < size + 4) return;
+
+    con.request.frame.assign(con.input, 0, size + 4);
+    con.input.erase(0, size + 4);
+    con.request.received = false;
+    con.request.responses.clear();
+    con.busy = true;
+
+    // fail fast if the workers fall behind too far
+    auto& metrics = *admission.metrics;
+    Request request{nullptr, std::chrono::steady_clock::now(), &con.request};
+    metrics.queue_depth++;
+    if (!queue.try_produce(request)) {
+      Connection shed_con{&con.request};
+      if (shed(shed_con)) {
+        metrics.queue_depth--;
+        metrics.shed_queue_full++;
+        finish(id, con);
+        return;
+      }
+      queue.produce(request);
+    }
+  }
+
+  auto completed() -> void {
+    std::vector<uint64_t> done;
+    {
+      std::lock_guard lock{outbox_mutex};
+      done.swap(outbox);
+    }
+    wait_for_workers();
+
+    for (auto id : done) {
+      auto it = connections.find(id);
+      if (it == connections.end()) continue;
+      finish(id, *it->second);
+      close_if_idle(id, *it->second);
+    }
+  }
+
+  /**
+   * Queues the responses of the handled request and moves on to the next
+   * request of the connection.
+   */
+  auto finish(uint64_t id, UringConnection& con) -> void {
+    con.busy = false;
+    for (auto& response : con.request.responses) con.output += response;
+    con.request.responses.clear();
+    flush(id, con);
+    dispatch(id, con);
+  }
+
+  auto flush(uint64_t id, UringConnection& con) -> void {
+    if (!con.sending.empty() || con.output.empty()) return;
+    con.sending.swap(con.output);
+    con.sent = 0;
+    send(id, con);
+  }
+
+  auto send(uint64_t id, UringConnection& con) -> void {
+    auto* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = con.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(con.sending.data() + con.sent);
+    sqe->len = static_cast<uint32_t>(con.sending.size() - con.sent);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data(SEND, id);
+  }
+
+  auto sent(uint64_t id, const io_uring_cqe& cqe) -> void {
+    auto it = connections.find(id);
+    if (it == connections.end()) return;
+    auto& con = *it->second;
+
+    if (cqe.res < 0) {
+      // the peer is gone, stop receiving as well
+      con.sending.clear();
+      con.output.clear();
+      shutdown(con.fd, SHUT_RDWR);
+    } else {
+      con.sent += cqe.res;
+      if (con.sent < con.sending.size()) {
+        send(id, con);
+        return;
+      }
+      con.sending.clear();
+      flush(id, con);
+    }
+    close_if_idle(id, con);
+  }
+
+  /**
+   * Closes a connection that stopped receiving once its request was handled
+   * and its responses were sent. Must be called last, it frees con.
+   */
+  auto close_if_idle(uint64_t id, UringConnection& con) -> void {
+    if (!con.closing || con.busy || !con.sending.empty()) return;
+    close(con.fd);
+    admission.metrics->connections--;
+    connections.erase(id);
+  }
+
+  SPMCQueue<Request>& queue;
+  Admission& admission;
+  Ring ring;
+  int listen_fd{-1};
+
+  std::unordered_map<uint64_t, std::unique_ptr<UringConnection>> connections;
+  uint64_t next_id{1};
+
+  // connections whose requests the workers completed
+  int wake_fd{-1};
+  uint64_t wake_counter{};
+  std::mutex outbox_mutex;
+  std::vector<uint64_t> outbox;
+};
+
+auto Server::uring_server(const std::string& address,
+                          SPMCQueue<Request>& bev_queue, Admission& admission)
+    -> std::thread {
+  auto loop = std::make_unique<UringLoop>(address, bev_queue, admission);
+  return std::thread([loop = std::move(loop)] { loop->run(); });
+}
+
+#endif
+
+}  // namespace cloudlab
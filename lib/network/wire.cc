@@ -0,0 +1,266 @@
+#include "cloudlab/network/wire.hh"
+
+#include "cloud.pb.h"
+
+#include <array>
+#include <cstring>
+
+namespace cloudlab {
+
+// messages of responses that are sent as a single status byte
+static const std::array<std::string_view, 7> well_known_messages{
+    "",     "OK",       "ERROR", "CONFLICT", "BUSY", "SNAPSHOT_TOO_OLD",
+    "DEADLINE_EXCEEDED"};
+
+// present fields of the header
+const uint8_t has_timestamp = 1 << 0;
+const uint8_t has_deadline = 1 << 1;
+const uint8_t has_trace = 1 << 2;
+
+// present fields of a key-value pair
+const uint8_t has_ttl = 1 << 0;
+const uint8_t has_version = 1 << 1;
+const uint8_t has_expected = 1 << 2;
+
+static auto status_of(const std::string& message) -> uint8_t {
+  for (size_t i = 0; i < well_known_messages.size(); i++) {
+    if (well_known_messages[i] == message) return static_cast<uint8_t>(i);
+  }
+  return compact_custom_status;
+}
+
+static auto varint_size(uint64_t value) -> size_t {
+  size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
+  }
+  return size;
+}
+
+static auto put_varint(uint8_t* buffer, uint64_t value) -> size_t {
+  size_t i = 0;
+  while (value >= 0x80) {
+    buffer[i++] = static_cast<uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  buffer[i++] = static_cast<uint8_t>(value);
+  return i;
+}
+
+static auto put_string(uint8_t* buffer, const std::string& value) -> size_t {
+  auto n = put_varint(buffer, value.size());
+  memcpy(buffer + n, value.data(), value.size());
+  return n + value.size();
+}
+
+static auto string_size(const std::string& value) -> size_t {
+  return varint_size(value.size()) + value.size();
+}
+
+/**
+ * Reads a varint at position, which is advanced past it.
+ *
+ * @return  false if the varint is truncated or longer than 64 bits
+ */
+static auto get_varint(std::string_view frame, size_t& position,
+                       uint64_t& value) -> bool {
+  value = 0;
+  for (auto shift = 0; shift < 64; shift += 7) {
+    if (position >= frame.size()) return false;
+    auto byte = static_cast<uint8_t>(frame[position++]);
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+static auto get_string(std::string_view frame, size_t& position,
+                       std::string_view& value) -> bool {
+  uint64_t size{};
+  if (!get_varint(frame, position, size)) return false;
+  if (size > frame.size() - position) return false;
+  value = frame.substr(position, size);
+  position += size;
+  return true;
+}
+
+auto CompactMessage::parse(std::string_view buffer) -> bool {
+  frame = buffer;
+  if (frame.size() < compact_header_size) return false;
+  const auto* header = reinterpret_cast<const uint8_t*>(frame.data());
+  if (header[0] != compact_version) return false;
+
+  type = header[1] & 0x03;
+  success = (header[1] & 0x04) != 0;
+  operation = header[2];
+  durability = header[3];
+  auto status = header[4];
+  auto present = header[5];
+  kvp_count = static_cast<uint16_t>(header[6] | (header[7] << 8));
+
+  if (!cloud::CloudMessage_Type_IsValid(type) ||
+      !cloud::CloudMessage_Operation_IsValid(operation) ||
+      !cloud::CloudMessage_Durability_IsValid(durability)) {
+    return false;
+  }
+
+  size_t pos = compact_header_size;
+  timestamp = deadline = trace_id = span_id = 0;
+  if ((present & has_timestamp) && !get_varint(frame, pos, timestamp)) {
+    return false;
+  }
+  if ((present & has_deadline) && !get_varint(frame, pos, deadline)) {
+    return false;
+  }
+  if ((present & has_trace) && (!get_varint(frame, pos, trace_id) ||
+                                !get_varint(frame, pos, span_id))) {
+    return false;
+  }
+  if (status == compact_custom_status) {
+    if (!get_string(frame, pos, message)) return false;
+  } else if (status < well_known_messages.size()) {
+    message = well_known_messages[status];
+  } else {
+    return false;
+  }
+
+  // validate the pairs once s.t. next() cannot fail halfway
+  pairs_begin = pos;
+  rewind();
+  CompactKeyValue kvp{};
+  while (remaining > 0) {
+    if (!next(kvp)) return false;
+  }
+  if (position != frame.size()) return false;
+  rewind();
+  return true;
+}
+
+auto CompactMessage::next(CompactKeyValue& kvp) -> bool {
+  if (remaining == 0 || position >= frame.size()) return false;
+  auto pos = position;
+  auto present = static_cast<uint8_t>(frame[pos++]);
+  kvp = {};
+  if (!get_string(frame, pos, kvp.key) || !get_string(frame, pos, kvp.value)) {
+    return false;
+  }
+  if ((present & has_ttl) && !get_varint(frame, pos, kvp.ttl)) return false;
+  if ((present & has_version) && !get_varint(frame, pos, kvp.version)) {
+    return false;
+  }
+  if (present & has_expected) {
+    std::string_view expected;
+    if (!get_string(frame, pos, expected)) return false;
+    kvp.expected = expected;
+  }
+  position = pos;
+  remaining--;
+  return true;
+}
+
+auto CompactMessage::to_cloud_message(cloud::CloudMessage& msg) -> void {
+  msg.Clear();
+  msg.set_type(static_cast<cloud::CloudMessage_Type>(type));
+  msg.set_operation(static_cast<cloud::CloudMessage_Operation>(operation));
+  msg.set_success(success);
+  msg.set_message(std::string{message});
+  msg.set_durability(static_cast<cloud::CloudMessage_Durability>(durability));
+  msg.set_timestamp(timestamp);
+  msg.set_deadline(deadline);
+  msg.set_trace_id(trace_id);
+  msg.set_span_id(span_id);
+
+  msg.mutable_kvp()->Reserve(kvp_count);
+  rewind();
+  CompactKeyValue kvp{};
+  while (next(kvp)) {
+    auto* tmp = msg.add_kvp();
+    tmp->set_key(std::string{kvp.key});
+    tmp->set_value(std::string{kvp.value});
+    tmp->set_ttl(kvp.ttl);
+    tmp->set_version(kvp.version);
+    if (kvp.expected) tmp->set_expected(std::string{*kvp.expected});
+  }
+  rewind();
+}
+
+auto compact_encodable(const cloud::CloudMessage& msg) -> bool {
+  switch (msg.operation()) {
+    case cloud::CloudMessage_Operation_PUT:
+    case cloud::CloudMessage_Operation_GET:
+    case cloud::CloudMessage_Operation_DELETE:
+    case cloud::CloudMessage_Operation_COMPARE_AND_SWAP:
+    case cloud::CloudMessage_Operation_INCREMENT:
+    case cloud::CloudMessage_Operation_APPEND:
+      break;
+    default:
+      return false;
+  }
+  return !msg.has_address() && msg.partition_size() == 0 &&
+         msg.transaction_id() == 0 && msg.kvp_size() <= UINT16_MAX;
+}
+
+auto compact_size(const cloud::CloudMessage& msg) -> size_t {
+  size_t size = compact_header_size;
+  if (msg.timestamp()) size += varint_size(msg.timestamp());
+  if (msg.deadline()) size += varint_size(msg.deadline());
+  if (msg.trace_id()) {
+    size += varint_size(msg.trace_id()) + varint_size(msg.span_id());
+  }
+  if (status_of(msg.message()) == compact_custom_status) {
+    size += string_size(msg.message());
+  }
+  for (const auto& kvp : msg.kvp()) {
+    size += 1 + string_size(kvp.key()) + string_size(kvp.value());
+    if (kvp.ttl()) size += varint_size(kvp.ttl());
+    if (kvp.version()) size += varint_size(kvp.version());
+    if (kvp.has_expected()) size += string_size(kvp.expected());
+  }
+  return size;
+}
+
+auto encode_compact(const cloud::CloudMessage& msg, uint8_t* buffer)
+    -> size_t {
+  auto status = status_of(msg.message());
+  uint8_t present = 0;
+  if (msg.timestamp()) present |= has_timestamp;
+  if (msg.deadline()) present |= has_deadline;
+  if (msg.trace_id()) present |= has_trace;
+
+  buffer[0] = compact_version;
+  buffer[1] = static_cast<uint8_t>(msg.type() | (msg.success() ? 0x04 : 0));
+  buffer[2] = static_cast<uint8_t>(msg.operation());
+  buffer[3] = static_cast<uint8_t>(msg.durability());
+  buffer[4] = status;
+  buffer[5] = present;
+  buffer[6] = static_cast<uint8_t>(msg.kvp_size() & 0xff);
+  buffer[7] = static_cast<uint8_t>(msg.kvp_size() >> 8);
+
+  size_t pos = compact_header_size;
+  if (present & has_timestamp) pos += put_varint(buffer + pos, msg.timestamp());
+  if (present & has_deadline) pos += put_varint(buffer + pos, msg.deadline());
+  if (present & has_trace) {
+    pos += put_varint(buffer + pos, msg.trace_id());
+    pos += put_varint(buffer + pos, msg.span_id());
+  }
+  if (status == compact_custom_status) {
+    pos += put_string(buffer + pos, msg.message());
+  }
+
+  for (const auto& kvp : msg.kvp()) {
+    uint8_t fields = 0;
+    if (kvp.ttl()) fields |= has_ttl;
+    if (kvp.version()) fields |= has_version;
+    if (kvp.has_expected()) fields |= has_expected;
+    buffer[pos++] = fields;
+    pos += put_string(buffer + pos, kvp.key());
+    pos += put_string(buffer + pos, kvp.value());
+    if (fields & has_ttl) pos += put_varint(buffer + pos, kvp.ttl());
+    if (fields & has_version) pos += put_varint(buffer + pos, kvp.version());
+    if (fields & has_expected) pos += put_string(buffer + pos, kvp.expected());
+  }
+  return pos;
+}
+
+}  // namespace cloudlab
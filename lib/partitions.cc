@@ -0,0 +1,119 @@
+#include "cloudlab/partitions.hh"
+
+#include <thread>
+
+namespace cloudlab {
+
+auto to_string(PartitionState state) -> const char* {
+  switch (state) {
+    case PartitionState::DROPPED:
+      return "DROPPED";
+    case PartitionState::ACTIVE:
+      return "ACTIVE";
+    case PartitionState::MIGRATING_IN:
+      return "MIGRATING_IN";
+    case PartitionState::MIGRATING_OUT:
+      return "MIGRATING_OUT";
+  }
+  return "UNKNOWN";
+}
+
+auto PartitionRegistry::get(uint32_t id) const -> Handle {
+  if (id >= slots.size()) return nullptr;
+  return slots[id].kvs.load();
+}
+
+auto PartitionRegistry::get_writable(uint32_t id) -> WriteHandle {
+  if (id >= slots.size()) return {};
+  auto& slot = slots[id];
+  // announce the write before checking the state, migrate_out changes the
+  // state before it waits for the writers (both sequentially consistent)
+  slot.writers.fetch_add(1);
+  auto state = slot.state.load();
+  auto kvs = slot.kvs.load();
+  if (!kvs ||
+      (state != PartitionState::ACTIVE &&
+       state != PartitionState::MIGRATING_IN)) {
+    slot.writers.fetch_sub(1);
+    return {};
+  }
+  return {&slot.writers, std::move(kvs)};
+}
+
+auto PartitionRegistry::get_state(uint32_t id) const -> PartitionState {
+  if (id >= slots.size()) return PartitionState::DROPPED;
+  return slots[id].state.load();
+}
+
+auto PartitionRegistry::install(uint32_t id, Handle kvs, PartitionState state)
+    -> bool {
+  if (id >= slots.size() || !kvs) return false;
+  {
+    std::lock_guard<std::mutex> lck(owners_mtx);
+    owners[id].clear();
+  }
+  // the previous KVS is closed once requests that still use it are done
+  slots[id].kvs.store(std::move(kvs));
+  slots[id].state.store(state);
+  epoch++;
+  return true;
+}
+
+auto PartitionRegistry::set_state(uint32_t id, PartitionState state) -> void {
+  if (id >= slots.size() || !slots[id].kvs.load()) return;
+  slots[id].state.store(state);
+  epoch++;
+}
+
+auto PartitionRegistry::migrate_out(uint32_t id, const std::string& owner)
+    -> void {
+  if (id >= slots.size() || !slots[id].kvs.load()) return;
+  {
+    std::lock_guard<std::mutex> lck(owners_mtx);
+    owners[id] = owner;
+  }
+  slots[id].state.store(PartitionState::MIGRATING_OUT);
+  epoch++;
+  while (slots[id].writers.load() != 0) std::this_thread::yield();
+}
+
+auto PartitionRegistry::remove(uint32_t id, const std::string& owner)
+    -> Handle {
+  if (id >= slots.size()) return nullptr;
+  {
+    std::lock_guard<std::mutex> lck(owners_mtx);
+    owners[id] = owner;
+  }
+  slots[id].state.store(PartitionState::DROPPED);
+  epoch++;
+  return slots[id].kvs.exchange(nullptr);
+}
+
+auto PartitionRegistry::get_owner(uint32_t id) const -> std::string {
+  if (id >= slots.size()) return {};
+  std::lock_guard<std::mutex> lck(owners_mtx);
+  return owners[id];
+}
+
+auto PartitionRegistry::for_each(
+    const std::function<void(uint32_t, KVS&)>& fn) const -> void {
+  for (uint32_t id = 0; id < slots.size(); id++) {
+    if (auto kvs = slots[id].kvs.load()) fn(id, *kvs);
+  }
+}
+
+auto PartitionRegistry::ids() const -> std::vector<uint32_t> {
+  std::vector<uint32_t> result;
+  for_each([&result](uint32_t id, KVS&) { result.push_back(id); });
+  return result;
+}
+
+auto PartitionRegistry::size() const -> size_t {
+  size_t count = 0;
+  for (auto& slot : slots) {
+    if (slot.state.load() != PartitionState::DROPPED) count++;
+  }
+  return count;
+}
+
+}  // namespace cloudlab
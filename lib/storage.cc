@@ -0,0 +1,183 @@
+#include "cloudlab/storage.hh"
+
+#include "fmt/core.h"
+
+#include "rocksdb/cache.h"
+#include "rocksdb/filter_policy.h"
+#include "rocksdb/options.h"
+#include "rocksdb/table.h"
+
+#include <fstream>
+#include <sstream>
+
+namespace cloudlab {
+
+static auto parse_compression(const std::string& name)
+    -> rocksdb::CompressionType {
+  if (name == "none") return rocksdb::kNoCompression;
+  if (name == "snappy") return rocksdb::kSnappyCompression;
+  if (name == "zlib") return rocksdb::kZlibCompression;
+  if (name == "lz4") return rocksdb::kLZ4Compression;
+  if (name == "lz4hc") return rocksdb::kLZ4HCCompression;
+  if (name == "zstd") return rocksdb::kZSTD;
+  throw std::invalid_argument(
+      fmt::format("{} is not a supported compression type", name));
+}
+
+static auto trim(const std::string& str) -> std::string {
+  auto begin = str.find_first_not_of(" \t");
+  if (begin == std::string::npos) return {};
+  auto end = str.find_last_not_of(" \t");
+  return str.substr(begin, end - begin + 1);
+}
+
+static auto split(const std::string& str) -> std::vector<std::string> {
+  std::vector<std::string> result;
+  std::stringstream stream{str};
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    result.emplace_back(trim(item));
+  }
+  return result;
+}
+
+auto parse_durability(const std::string& name) -> Durability {
+  if (name == "sync") return Durability::SYNC;
+  if (name == "group-commit") return Durability::GROUP_COMMIT;
+  if (name == "buffered") return Durability::BUFFERED;
+  if (name == "async") return Durability::ASYNC;
+  throw std::invalid_argument(
+      fmt::format("{} is not a known durability level", name));
+}
+
+auto durability_name(Durability durability) -> std::string {
+  switch (durability) {
+    case Durability::SYNC:
+      return "sync";
+    case Durability::GROUP_COMMIT:
+      return "group-commit";
+    case Durability::BUFFERED:
+      return "buffered";
+    case Durability::ASYNC:
+      return "async";
+  }
+  return "unknown";
+}
+
+auto StorageConfig::preset(const std::string& name) -> StorageConfig {
+  StorageConfig config{};
+
+  if (name == "default") return config;
+
+  if (name == "read-heavy") {
+    // large block cache and bloom filters s.t. point lookups rarely touch
+    // disk, cheap decompression on the upper levels
+    config.block_cache_size = 512 << 20;
+    config.bloom_bits_per_key = 10;
+    config.compression_per_level = {"none", "none", "lz4", "lz4",
+                                    "lz4",  "lz4",  "zstd"};
+    config.write_buffer_size = 32 << 20;
+    config.max_background_jobs = 2;
+    config.value_cache_size = 16 << 20;
+    return config;
+  }
+
+  if (name == "write-heavy") {
+    // large memtables and many background jobs to absorb write bursts, no
+    // compression where data is rewritten most often
+    config.block_cache_size = 64 << 20;
+    config.bloom_bits_per_key = 10;
+    config.compression_per_level = {"none", "none", "none", "lz4",
+                                    "lz4",  "zstd", "zstd"};
+    config.write_buffer_size = 256 << 20;
+    config.max_background_jobs = 8;
+    return config;
+  }
+
+  throw std::invalid_argument(
+      fmt::format("{} is not a known storage preset", name));
+}
+
+auto StorageConfig::from_file(const std::string& path, StorageConfig base)
+    -> StorageConfig {
+  std::ifstream file{path};
+  if (!file) {
+    throw std::runtime_error(fmt::format("could not open {}", path));
+  }
+
+  std::string line;
+  while (std::getline(file, line)) {
+    line = trim(line.substr(0, line.find('#')));
+    if (line.empty()) continue;
+
+    auto cut = line.find('=');
+    if (cut == std::string::npos) {
+      throw std::invalid_argument(
+          fmt::format("{}: expected <option> = <value>, got {}", path, line));
+    }
+
+    auto option = trim(line.substr(0, cut));
+    auto value = trim(line.substr(cut + 1));
+
+    if (option == "block_cache_size") {
+      base.block_cache_size = std::stoull(value);
+    } else if (option == "bloom_bits_per_key") {
+      base.bloom_bits_per_key = std::stoi(value);
+    } else if (option == "compression_per_level") {
+      base.compression_per_level = split(value);
+    } else if (option == "write_buffer_size") {
+      base.write_buffer_size = std::stoull(value);
+    } else if (option == "max_background_jobs") {
+      base.max_background_jobs = std::stoi(value);
+    } else if (option == "use_direct_io") {
+      base.use_direct_io = value == "true" || value == "1";
+    } else if (option == "value_cache_size") {
+      base.value_cache_size = std::stoull(value);
+    } else if (option == "durability") {
+      base.durability = parse_durability(value);
+    } else if (option == "group_commit_delay_us") {
+      base.group_commit_delay_us = std::stoull(value);
+    } else if (option == "async_flush_interval_ms") {
+      base.async_flush_interval_ms = std::stoull(value);
+    } else if (option == "snapshot_retention_ms") {
+      base.snapshot_retention_ms = std::stoull(value);
+    } else {
+      throw std::invalid_argument(
+          fmt::format("{}: unknown storage option {}", path, option));
+    }
+  }
+
+  return base;
+}
+
+StorageProfile::StorageProfile(StorageConfig config)
+    : config{std::move(config)},
+      block_cache{rocksdb::NewLRUCache(this->config.block_cache_size)} {
+  // fail early on typos instead of when the first partition is opened
+  for (const auto& name : this->config.compression_per_level) {
+    parse_compression(name);
+  }
+}
+
+auto StorageProfile::apply(rocksdb::Options& options) const -> void {
+  rocksdb::BlockBasedTableOptions table_options;
+  table_options.block_cache = block_cache;
+  if (config.bloom_bits_per_key > 0) {
+    table_options.filter_policy.reset(
+        rocksdb::NewBloomFilterPolicy(config.bloom_bits_per_key, false));
+  }
+  options.table_factory.reset(
+      rocksdb::NewBlockBasedTableFactory(table_options));
+
+  options.compression_per_level.clear();
+  for (const auto& name : config.compression_per_level) {
+    options.compression_per_level.push_back(parse_compression(name));
+  }
+
+  options.write_buffer_size = config.write_buffer_size;
+  options.max_background_jobs = config.max_background_jobs;
+  options.use_direct_reads = config.use_direct_io;
+  options.use_direct_io_for_flush_and_compaction = config.use_direct_io;
+}
+
+}  // namespace cloudlab
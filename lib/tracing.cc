@@ -0,0 +1,180 @@
+#include "cloudlab/tracing.hh"
+
+#include "fmt/core.h"
+
+#include <random>
+#include <unistd.h>
+
+namespace cloudlab {
+
+// interval in which recorded spans are written to the file
+const auto trace_flush_interval = std::chrono::milliseconds(100);
+
+static thread_local TraceContext current_span{};
+
+// queueing of the request handled by the calling worker
+static thread_local std::chrono::steady_clock::time_point request_enqueued_at{};
+static thread_local std::chrono::steady_clock::time_point request_dequeued_at{};
+
+static auto random_engine() -> std::mt19937_64& {
+  thread_local std::mt19937_64 engine{std::random_device{}()};
+  return engine;
+}
+
+/**
+ * Small ID of the calling thread for the trace viewer.
+ */
+static auto thread_id() -> uint64_t {
+  static std::atomic<uint64_t> next_thread_id{1};
+  thread_local auto id = next_thread_id++;
+  return id;
+}
+
+/**
+ * Microseconds since epoch of a steady clock time point, s.t. spans of
+ * different processes line up.
+ */
+static auto to_epoch_us(std::chrono::steady_clock::time_point time)
+    -> int64_t {
+  using namespace std::chrono;
+  auto now = system_clock::now() - (steady_clock::now() - time);
+  return duration_cast<microseconds>(now.time_since_epoch()).count();
+}
+
+Tracer::~Tracer() {
+  if (!is_open) return;
+  {
+    std::lock_guard<std::mutex> lck(mtx);
+    stopped = true;
+  }
+  cond.notify_one();
+  flusher.join();
+  flush();
+  std::fputs("\n]\n", file);
+  std::fclose(file);
+}
+
+auto Tracer::open(const std::string& path, double sample_rate,
+                  const std::string& process) -> void {
+  if (is_open) {
+    throw std::runtime_error("the tracer was opened already");
+  }
+  file = std::fopen(path.c_str(), "w");
+  if (!file) {
+    throw std::runtime_error(fmt::format("could not open {}", path));
+  }
+
+  this->sample_rate = sample_rate;
+  std::fputs(fmt::format("[\n{{\"name\":\"process_name\",\"ph\":\"M\","
+                         "\"pid\":{},\"args\":{{\"name\":\"{}\"}}}}",
+                         getpid(), process)
+                 .c_str(),
+             file);
+
+  flusher = std::thread([this]() {
+    std::unique_lock<std::mutex> lck(mtx);
+    while (!stopped) {
+      cond.wait_for(lck, trace_flush_interval);
+      lck.unlock();
+      flush();
+      lck.lock();
+    }
+  });
+  is_open = true;
+}
+
+auto Tracer::flush() -> void {
+  std::string pending;
+  {
+    std::lock_guard<std::mutex> lck(mtx);
+    pending.swap(buffer);
+  }
+  if (pending.empty()) return;
+  std::fwrite(pending.data(), 1, pending.size(), file);
+  std::fflush(file);
+}
+
+auto Tracer::start_trace() -> TraceContext {
+  if (!enabled()) return {};
+  std::uniform_real_distribution<double> coin{0.0, 1.0};
+  if (coin(random_engine()) >= sample_rate) return {};
+  return {new_id(), 0};
+}
+
+auto Tracer::record(std::string_view name, TraceContext span,
+                    uint64_t parent_id,
+                    std::chrono::steady_clock::time_point start,
+                    std::chrono::steady_clock::time_point end) -> void {
+  if (!span.sampled() || !enabled()) return;
+  auto event = fmt::format(
+      ",\n{{\"name\":\"{}\",\"cat\":\"cloudlab\",\"ph\":\"X\",\"ts\":{},"
+      "\"dur\":{},\"pid\":{},\"tid\":{},\"args\":{{\"trace_id\":\"{:016x}\","
+      "\"span_id\":\"{:016x}\",\"parent_id\":\"{:016x}\"}}}}",
+      name, to_epoch_us(start),
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+          .count(),
+      getpid(), thread_id(), span.trace_id, span.span_id, parent_id);
+  std::lock_guard<std::mutex> lck(mtx);
+  buffer.append(event);
+}
+
+auto Tracer::record_arrival(TraceContext span) -> void {
+  if (!span.sampled() || !enabled()) return;
+  if (request_enqueued_at == std::chrono::steady_clock::time_point{}) return;
+  record("queue", {span.trace_id, new_id()}, span.span_id,
+         request_enqueued_at, request_dequeued_at);
+  record("receive", {span.trace_id, new_id()}, span.span_id,
+         request_dequeued_at, std::chrono::steady_clock::now());
+}
+
+auto Tracer::new_id() -> uint64_t {
+  uint64_t id = 0;
+  while (id == 0) id = random_engine()();
+  return id;
+}
+
+auto Tracer::current() -> TraceContext {
+  return current_span;
+}
+
+auto Tracer::set_current(TraceContext context) -> void {
+  current_span = context;
+}
+
+auto Tracer::set_dequeued(std::chrono::steady_clock::time_point enqueued_at,
+                          std::chrono::steady_clock::time_point dequeued_at)
+    -> void {
+  request_enqueued_at = enqueued_at;
+  request_dequeued_at = dequeued_at;
+}
+
+auto Tracer::enqueued_at() -> std::chrono::steady_clock::time_point {
+  if (request_enqueued_at == std::chrono::steady_clock::time_point{}) {
+    return std::chrono::steady_clock::now();
+  }
+  return request_enqueued_at;
+}
+
+auto tracer() -> Tracer& {
+  static Tracer instance{};
+  return instance;
+}
+
+ScopedSpan::ScopedSpan(std::string_view name, TraceContext parent,
+                       std::chrono::steady_clock::time_point start)
+    : name{name}, previous{Tracer::current()} {
+  if (!parent.sampled()) return;
+  parent_id = parent.span_id;
+  own = {parent.trace_id, Tracer::new_id()};
+  this->start = start;
+  Tracer::set_current(own);
+}
+
+ScopedSpan::~ScopedSpan() {
+  if (!own.sampled()) return;
+  tracer().record(name, own, parent_id, start,
+                  std::chrono::steady_clock::now());
+  Tracer::set_current(previous);
+}
+
+}  // namespace cloudlab
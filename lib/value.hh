@@ -0,0 +1,77 @@
+#ifndef CLOUDLAB_VALUE_HH
+#define CLOUDLAB_VALUE_HH
+
+#include "cloudlab/clock.hh"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace cloudlab {
+
+/**
+ * Values are stored in rocksdb with a fixed-size header in front of the
+ * payload: the expiry time in milliseconds since epoch (0 = never expires)
+ * followed by the version, i.e., the hybrid logical timestamp of the write
+ * that stored the value. Both are little endian.
+ */
+const auto value_header_size = 16;
+
+inline auto encode_fixed64(std::string& buffer, size_t offset, uint64_t number)
+    -> void {
+  for (auto i = 0; i < 8; i++) {
+    buffer[offset + i] = static_cast<char>((number >> (8 * i)) & 0xff);
+  }
+}
+
+inline auto decode_fixed64(std::string_view buffer, size_t offset)
+    -> uint64_t {
+  uint64_t number = 0;
+  for (auto i = 0; i < 8; i++) {
+    number |= static_cast<uint64_t>(static_cast<uint8_t>(buffer[offset + i]))
+              << (8 * i);
+  }
+  return number;
+}
+
+inline auto encode_value(std::string_view payload, uint64_t expires_at,
+                         uint64_t version) -> std::string {
+  std::string stored(value_header_size, '\0');
+  encode_fixed64(stored, 0, expires_at);
+  encode_fixed64(stored, 8, version);
+  stored.append(payload);
+  return stored;
+}
+
+inline auto value_expires_at(std::string_view stored) -> uint64_t {
+  if (stored.size() < value_header_size) return 0;
+  return decode_fixed64(stored, 0);
+}
+
+inline auto value_version(std::string_view stored) -> uint64_t {
+  if (stored.size() < value_header_size) return 0;
+  return decode_fixed64(stored, 8);
+}
+
+inline auto value_payload(std::string_view stored) -> std::string_view {
+  if (stored.size() < value_header_size) return stored;
+  return stored.substr(value_header_size);
+}
+
+inline auto value_expired(std::string_view stored, uint64_t now) -> bool {
+  auto expires_at = value_expires_at(stored);
+  return expires_at != 0 && expires_at <= now;
+}
+
+/**
+ * Remaining time to live of a value that did not expire yet in seconds
+ * (rounded up), 0 if it never expires.
+ */
+inline auto remaining_ttl(std::string_view stored, uint64_t now) -> uint64_t {
+  auto expires_at = value_expires_at(stored);
+  return expires_at ? (expires_at - now + 999) / 1000 : 0;
+}
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_VALUE_HH
@@ -0,0 +1,412 @@
+#include "cloudlab/metrics.hh"
+#include "cloudlab/network/connection.hh"
+
+#include "cloud.pb.h"
+#include "workload.hh"
+
+#include "argh.hh"
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <map>
+#include <mutex>
+#include <poll.h>
+#include <thread>
+#include <vector>
+
+using namespace cloudlab;
+using Clock = std::chrono::steady_clock;
+
+/**
+ * Configuration of a benchmark run.
+ */
+struct Options {
+  std::string api_address;
+  size_t threads{1};
+  // connections per thread, each with one request in flight
+  size_t connections{1};
+  uint64_t keys{100000};
+  std::string distribution{"zipfian"};
+  double theta{0.99};
+  size_t value_size{100};
+  double read_ratio{0.95};
+  // requests per second of all threads together, 0 runs closed-loop
+  double rate{0};
+  std::chrono::seconds duration{10};
+  // stop after this many requests, 0 = run for duration
+  uint64_t operations{0};
+  bool load{false};
+  // send requests in the compact binary format instead of protobuf
+  bool compact{false};
+};
+
+enum class Operation { READ, UPDATE, INSERT };
+
+static auto operation_name(Operation op) -> const char* {
+  switch (op) {
+    case Operation::READ:
+      return "READ";
+    case Operation::UPDATE:
+      return "UPDATE";
+    case Operation::INSERT:
+      return "INSERT";
+  }
+  return "UNKNOWN";
+}
+
+/**
+ * Latencies and outcomes of one operation type, shared by all threads.
+ */
+struct OperationStats {
+  // from sending the request to receiving the response
+  Histogram service{};
+  // from the time the request should have been sent (open-loop only), which
+  // includes the time it waited behind slow requests
+  Histogram intended{};
+  std::map<std::string, uint64_t> returns{};
+  std::mutex mtx{};
+
+  auto count(const std::string& result) -> void {
+    std::lock_guard<std::mutex> lck(mtx);
+    returns[result]++;
+  }
+};
+
+/**
+ * Picks the keys of requests: uniformly, Zipfian with the most popular keys
+ * at the start of the key space, or Zipfian with the most recently inserted
+ * keys being the most popular ones (writes insert new keys then).
+ */
+class KeyChooser {
+ public:
+  KeyChooser(const Options& options, std::atomic<uint64_t>& latest,
+             uint64_t seed)
+      : distribution{options.distribution},
+        uniform{0, options.keys - 1},
+        zipf{options.keys, options.theta, seed},
+        rng{seed},
+        latest{latest} {
+  }
+
+  auto read_key() -> uint64_t {
+    if (distribution == "uniform") return uniform(rng);
+    if (distribution == "zipfian") return zipf.next();
+    auto newest = latest.load();
+    auto offset = zipf.next();
+    return offset > newest ? 0 : newest - offset;
+  }
+
+  auto write_key(Operation& op) -> uint64_t {
+    if (distribution != "latest") return read_key();
+    op = Operation::INSERT;
+    return ++latest;
+  }
+
+ private:
+  const std::string distribution;
+  std::uniform_int_distribution<uint64_t> uniform;
+  ZipfianGenerator zipf;
+  std::mt19937_64 rng;
+  std::atomic<uint64_t>& latest;
+};
+
+static auto key_name(uint64_t key) -> std::string {
+  return fmt::format("key{}", key);
+}
+
+static auto result_of(bool received, const cloud::CloudMessage& response)
+    -> std::string {
+  if (!received) return "ERROR";
+  if (!response.success()) {
+    return response.message().empty() ? "ERROR" : response.message();
+  }
+  for (const auto& kvp : response.kvp()) {
+    if (kvp.value() == "ERROR") return "NOT_FOUND";
+  }
+  return "OK";
+}
+
+/**
+ * A connection with at most one request in flight.
+ */
+struct Slot {
+  std::unique_ptr<Connection> con;
+  bool in_flight{false};
+  Operation op{Operation::READ};
+  Clock::time_point intended{};
+  Clock::time_point sent{};
+  // time the next request should be sent (open-loop)
+  Clock::time_point next{};
+};
+
+class Benchmark {
+ public:
+  explicit Benchmark(Options options)
+      : options{std::move(options)}, latest{this->options.keys - 1} {
+  }
+
+  /**
+   * Writes every key once.
+   */
+  auto load() -> void {
+    per_operation = std::make_unique<std::array<OperationStats, 3>>();
+    std::vector<std::thread> workers;
+    auto started_at = Clock::now();
+    for (size_t t = 0; t < options.threads; t++) {
+      workers.emplace_back([this, t]() {
+        auto con = connect();
+        std::string value(options.value_size, 'x');
+        for (auto key = t; key < options.keys; key += options.threads) {
+          auto request = make_request(Operation::INSERT, key, value);
+          auto sent = Clock::now();
+          cloud::CloudMessage response;
+          auto received = con->send(request) && con->receive(response);
+          auto& s = stats(Operation::INSERT);
+          s.service.record(Clock::now() - sent);
+          s.count(result_of(received, response));
+          if (!received) {
+            con = connect();
+          }
+        }
+      });
+    }
+    for (auto& worker : workers) worker.join();
+    report("LOAD", Clock::now() - started_at, {Operation::INSERT});
+  }
+
+  auto run() -> void {
+    per_operation = std::make_unique<std::array<OperationStats, 3>>();
+    std::vector<std::thread> workers;
+    auto started_at = Clock::now();
+    for (size_t t = 0; t < options.threads; t++) {
+      workers.emplace_back([this, t, started_at]() { work(t, started_at); });
+    }
+    for (auto& worker : workers) worker.join();
+    report("OVERALL", Clock::now() - started_at,
+           {Operation::READ, Operation::UPDATE, Operation::INSERT});
+  }
+
+ private:
+  auto connect() -> std::unique_ptr<Connection> {
+    auto con = std::make_unique<Connection>(options.api_address);
+    con->set_compact(options.compact);
+    return con;
+  }
+
+  auto stats(Operation op) -> OperationStats& {
+    return (*per_operation)[static_cast<size_t>(op)];
+  }
+
+  auto make_request(Operation op, uint64_t key, const std::string& value)
+      -> cloud::CloudMessage {
+    cloud::CloudMessage request;
+    request.set_type(cloud::CloudMessage_Type_REQUEST);
+    auto* kvp = request.add_kvp();
+    kvp->set_key(key_name(key));
+    if (op == Operation::READ) {
+      request.set_operation(cloud::CloudMessage_Operation_GET);
+    } else {
+      request.set_operation(cloud::CloudMessage_Operation_PUT);
+      kvp->set_value(value);
+    }
+    return request;
+  }
+
+  auto work(size_t thread, Clock::time_point started_at) -> void {
+    KeyChooser keys{options, latest, thread + 1};
+    std::mt19937_64 rng{thread + 1};
+    std::uniform_real_distribution<double> coin{0.0, 1.0};
+    std::string value(options.value_size, 'x');
+
+    // every connection sends its share of the rate, staggered s.t. the
+    // requests of all connections are spread evenly
+    auto total_connections = options.threads * options.connections;
+    auto interval = options.rate > 0
+                        ? std::chrono::duration_cast<Clock::duration>(
+                              std::chrono::duration<double>(
+                                  static_cast<double>(total_connections) /
+                                  options.rate))
+                        : Clock::duration::zero();
+    std::vector<Slot> slots(options.connections);
+    for (size_t i = 0; i < slots.size(); i++) {
+      slots[i].con = connect();
+      slots[i].next =
+          started_at + interval * (thread * options.connections + i) /
+                           static_cast<int64_t>(total_connections);
+    }
+
+    auto stop_at = started_at + options.duration;
+    auto per_thread_operations =
+        options.operations ? (options.operations + options.threads - 1 - thread) /
+                                 options.threads
+                           : 0;
+    uint64_t issued = 0;
+
+    while (true) {
+      auto now = Clock::now();
+      auto stopping = (per_thread_operations && issued >= per_thread_operations) ||
+                      (!per_thread_operations && now >= stop_at);
+
+      // send the requests that are due
+      auto wake_at = Clock::time_point::max();
+      for (auto& slot : slots) {
+        if (slot.in_flight || stopping) continue;
+        if (slot.next > now) {
+          wake_at = std::min(wake_at, slot.next);
+          continue;
+        }
+        slot.op = coin(rng) < options.read_ratio ? Operation::READ
+                                                 : Operation::UPDATE;
+        auto key = slot.op == Operation::READ ? keys.read_key()
+                                              : keys.write_key(slot.op);
+        auto request = make_request(slot.op, key, value);
+        slot.intended = interval.count() ? slot.next : now;
+        slot.sent = now;
+        slot.next += interval;
+        issued++;
+        if (!slot.con->send(request)) {
+          stats(slot.op).count("ERROR");
+          slot.con = connect();
+          continue;
+        }
+        slot.in_flight = true;
+      }
+
+      std::vector<pollfd> fds;
+      std::vector<Slot*> waiting;
+      for (auto& slot : slots) {
+        if (!slot.in_flight) continue;
+        fds.push_back({slot.con->get_fd(), POLLIN, 0});
+        waiting.push_back(&slot);
+      }
+      if (fds.empty() && stopping) break;
+
+      // wait for responses or until the next request is due
+      auto timeout = std::chrono::microseconds(100000);
+      if (wake_at != Clock::time_point::max()) {
+        timeout = std::clamp(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                wake_at - Clock::now()),
+            std::chrono::microseconds(0), timeout);
+      }
+      if (fds.empty()) {
+        std::this_thread::sleep_for(timeout);
+        continue;
+      }
+      timespec ts{static_cast<time_t>(timeout.count() / 1000000),
+                  static_cast<long>(timeout.count() % 1000000 * 1000)};
+      if (ppoll(fds.data(), fds.size(), &ts, nullptr) <= 0) continue;
+
+      for (size_t i = 0; i < fds.size(); i++) {
+        if (!fds[i].revents) continue;
+        auto& slot = *waiting[i];
+        cloud::CloudMessage response;
+        auto received = slot.con->receive(response);
+        auto done = Clock::now();
+        auto& s = stats(slot.op);
+        s.service.record(done - slot.sent);
+        s.intended.record(done - slot.intended);
+        s.count(result_of(received, response));
+        slot.in_flight = false;
+        if (!interval.count()) slot.next = done;
+        if (!received) {
+          slot.con = connect();
+        }
+      }
+    }
+  }
+
+  auto report(const std::string& phase, Clock::duration runtime,
+              const std::vector<Operation>& ops) -> void {
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(runtime)
+                  .count();
+    uint64_t total = 0;
+    for (auto op : ops) total += stats(op).service.snapshot().count;
+    fmt::print("[{}], RunTime(ms), {}\n", phase, ms);
+    fmt::print("[{}], Throughput(ops/sec), {:.1f}\n", phase,
+               ms ? static_cast<double>(total) * 1000.0 / ms : 0.0);
+
+    for (auto op : ops) {
+      auto& s = stats(op);
+      auto name = std::string{operation_name(op)};
+      if (s.service.snapshot().count == 0) continue;
+      print_latencies(name, s.service.snapshot());
+      if (options.rate > 0 && phase != "LOAD") {
+        print_latencies("Intended-" + name, s.intended.snapshot());
+      }
+      for (const auto& [result, count] : s.returns) {
+        fmt::print("[{}], Return={}, {}\n", name, result, count);
+      }
+    }
+  }
+
+  static auto print_latencies(const std::string& name,
+                              const Histogram::Snapshot& snapshot) -> void {
+    fmt::print("[{}], Operations, {}\n", name, snapshot.count);
+    fmt::print("[{}], AverageLatency(us), {:.2f}\n", name,
+               snapshot.count ? static_cast<double>(snapshot.sum) /
+                                    static_cast<double>(snapshot.count)
+                              : 0.0);
+    fmt::print("[{}], MinLatency(us), {}\n", name, snapshot.percentile(0));
+    fmt::print("[{}], MaxLatency(us), {}\n", name, snapshot.max);
+    for (const auto& [q, label] :
+         std::vector<std::pair<double, std::string>>{{0.5, "50th"},
+                                                     {0.95, "95th"},
+                                                     {0.99, "99th"},
+                                                     {0.999, "99.9th"}}) {
+      fmt::print("[{}], {}PercentileLatency(us), {}\n", name, label,
+                 snapshot.percentile(q));
+    }
+  }
+
+  const Options options;
+
+  // highest key written so far, for the latest distribution
+  std::atomic<uint64_t> latest;
+
+  // statistics of the current phase
+  std::unique_ptr<std::array<OperationStats, 3>> per_operation{};
+};
+
+auto main(int argc, char* argv[]) -> int {
+  argh::parser cmdl({"-a", "--api", "--threads", "--connections", "--keys",
+                     "--distribution", "--theta", "--value-size",
+                     "--read-ratio", "--rate", "--duration", "--operations"});
+  cmdl.parse(argc, argv);
+
+  Options options{};
+  cmdl({"-a", "--api"}, "127.0.0.1:31000") >> options.api_address;
+  cmdl("--threads", options.threads) >> options.threads;
+  cmdl("--connections", options.connections) >> options.connections;
+  cmdl("--keys", options.keys) >> options.keys;
+  cmdl("--distribution", options.distribution) >> options.distribution;
+  cmdl("--theta", options.theta) >> options.theta;
+  cmdl("--value-size", options.value_size) >> options.value_size;
+  cmdl("--read-ratio", options.read_ratio) >> options.read_ratio;
+  cmdl("--rate", options.rate) >> options.rate;
+  uint64_t duration;
+  cmdl("--duration", options.duration.count()) >> duration;
+  options.duration = std::chrono::seconds(duration);
+  cmdl("--operations", options.operations) >> options.operations;
+  options.load = cmdl["--load"];
+  options.compact = cmdl["--compact"];
+
+  if (options.distribution != "uniform" && options.distribution != "zipfian" &&
+      options.distribution != "latest") {
+    fmt::print("Unknown key distribution {}\n", options.distribution);
+    return 1;
+  }
+  if (options.threads == 0 || options.connections == 0 || options.keys < 2) {
+    fmt::print("Need at least one thread, one connection and two keys\n");
+    return 1;
+  }
+
+  // a node that closes a connection must not kill the benchmark
+  signal(SIGPIPE, SIG_IGN);
+
+  Benchmark benchmark{options};
+  if (options.load) benchmark.load();
+  benchmark.run();
+}
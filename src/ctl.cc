@@ -1,21 +1,58 @@
+#include "cloudlab/clock.hh"
 #include "cloudlab/network/connection.hh"
+#include "cloudlab/tracing.hh"
 
 #include "cloud.pb.h"
 
 #include "argh.hh"
 #include <fmt/core.h>
 
+#include <algorithm>
+
 using namespace cloudlab;
 
 auto main(int argc, char *argv[]) -> int {
   cloud::CloudMessage msg{};
 
-  argh::parser cmdl({"-a", "--api"});
+  argh::parser cmdl({"-a", "--api", "-d", "--durability", "-t", "--ttl", "-s",
+                     "--snapshot", "--timeout"});
   cmdl.parse(argc, argv);
 
   std::string api_address;
   cmdl({"-a", "--api"}, "127.0.0.1:31000") >> api_address;
 
+  // durability of PUT / DELETE: sync, group-commit, buffered or async
+  std::string durability;
+  cmdl({"-d", "--durability"}, "") >> durability;
+  if (!durability.empty()) {
+    std::transform(durability.begin(), durability.end(), durability.begin(),
+                   [](char c) { return c == '-' ? '_' : std::toupper(c); });
+    cloud::CloudMessage_Durability level;
+    if (!cloud::CloudMessage_Durability_Parse(durability, &level)) {
+      fmt::print("Unknown durability level {}\n", durability);
+      return 1;
+    }
+    msg.set_durability(level);
+  }
+
+  // time to live of PUT keys in seconds (0 = never expire)
+  uint64_t ttl;
+  cmdl({"-t", "--ttl"}, 0) >> ttl;
+
+  // GET: timestamp to read at, e.g., the one reported by an earlier GET
+  uint64_t timestamp;
+  cmdl({"-s", "--snapshot"}, 0) >> timestamp;
+  msg.set_timestamp(timestamp);
+
+  // milliseconds to wait for the response, 0 = wait forever
+  uint64_t timeout;
+  cmdl("--timeout", 0) >> timeout;
+  if (timeout) msg.set_deadline(now_ms() + timeout);
+
+  // trace the request regardless of the sampling rate of the servers
+  uint64_t trace_id = cmdl["--trace"] ? Tracer::new_id() : 0;
+  msg.set_trace_id(trace_id);
+
   auto num_pos_args = cmdl.pos_args().size();
 
   msg.set_type(cloud::CloudMessage_Type_REQUEST);
@@ -27,6 +64,7 @@ auto main(int argc, char *argv[]) -> int {
       auto *tmp = msg.add_kvp();
       tmp->set_key(cmdl.pos_args().at(i));
       tmp->set_value(cmdl.pos_args().at(i + 1));
+      tmp->set_ttl(ttl);
     }
   } else if (num_pos_args > 2 && cmdl.pos_args().at(1) == "get") {
     msg.set_operation(cloud::CloudMessage_Operation_GET);
@@ -40,22 +78,67 @@ auto main(int argc, char *argv[]) -> int {
       auto *tmp = msg.add_kvp();
       tmp->set_key(cmdl.pos_args().at(i));
     }
+  } else if (num_pos_args == 5 && cmdl.pos_args().at(1) == "cas") {
+    msg.set_operation(cloud::CloudMessage_Operation_COMPARE_AND_SWAP);
+    auto *tmp = msg.add_kvp();
+    tmp->set_key(cmdl.pos_args().at(2));
+    tmp->set_expected(cmdl.pos_args().at(3));
+    tmp->set_value(cmdl.pos_args().at(4));
+    tmp->set_ttl(ttl);
+  } else if ((num_pos_args == 3 || num_pos_args == 4) &&
+             cmdl.pos_args().at(1) == "incr") {
+    msg.set_operation(cloud::CloudMessage_Operation_INCREMENT);
+    auto *tmp = msg.add_kvp();
+    tmp->set_key(cmdl.pos_args().at(2));
+    if (num_pos_args == 4) tmp->set_value(cmdl.pos_args().at(3));
+  } else if (num_pos_args == 4 && cmdl.pos_args().at(1) == "append") {
+    msg.set_operation(cloud::CloudMessage_Operation_APPEND);
+    auto *tmp = msg.add_kvp();
+    tmp->set_key(cmdl.pos_args().at(2));
+    tmp->set_value(cmdl.pos_args().at(3));
+  } else if (num_pos_args > 3 && cmdl.pos_args().at(1) == "txn" &&
+             num_pos_args % 2 == 0) {
+    // all keys are written or none
+    msg.set_operation(cloud::CloudMessage_Operation_TRANSACTION);
+    for (size_t i = 2; i < num_pos_args; i += 2) {
+      auto *tmp = msg.add_kvp();
+      tmp->set_key(cmdl.pos_args().at(i));
+      tmp->set_value(cmdl.pos_args().at(i + 1));
+      tmp->set_ttl(ttl);
+    }
+  } else if (num_pos_args > 4 && cmdl.pos_args().at(1) == "txn-cas" &&
+             (num_pos_args - 2) % 3 == 0) {
+    // like txn, but only if every key still has its expected value
+    msg.set_operation(cloud::CloudMessage_Operation_TRANSACTION);
+    for (size_t i = 2; i < num_pos_args; i += 3) {
+      auto *tmp = msg.add_kvp();
+      tmp->set_key(cmdl.pos_args().at(i));
+      tmp->set_expected(cmdl.pos_args().at(i + 1));
+      tmp->set_value(cmdl.pos_args().at(i + 2));
+      tmp->set_ttl(ttl);
+    }
   } else if (num_pos_args == 3 && cmdl.pos_args().at(1) == "join") {
     msg.set_operation(cloud::CloudMessage_Operation_JOIN_CLUSTER);
     auto *address = msg.mutable_address();
     address->set_address(cmdl.pos_args().at(2));
+  } else if (num_pos_args == 2 && cmdl.pos_args().at(1) == "stats") {
+    msg.set_operation(cloud::CloudMessage_Operation_STATS);
   } else {
     fmt::print("Usage: {} <operation> <args>\n", cmdl.pos_args().at(0));
     return 1;
   }
 
   Connection con{api_address};
+  if (msg.deadline()) con.set_deadline(msg.deadline());
 
   // send request
   con.send(msg);
 
   // receive reply
-  con.receive(msg);
+  if (!con.receive(msg) && msg.deadline() && now_ms() >= msg.deadline()) {
+    fmt::print("DEADLINE_EXCEEDED\n");
+    return 1;
+  }
 
   switch (msg.operation()) {
     case cloud::CloudMessage_Operation_PUT:
@@ -66,11 +149,46 @@ auto main(int argc, char *argv[]) -> int {
       } else {
         for (const auto &kvp : msg.kvp()) {
           fmt::print("Key:\t{}\nValue:\t{}\n", kvp.key(), kvp.value());
+          if (kvp.version()) fmt::print("Version:\t{}\n", kvp.version());
         }
       }
+      if (msg.operation() == cloud::CloudMessage_Operation_GET && msg.timestamp()) {
+        fmt::print("Timestamp:\t{}\n", msg.timestamp());
+      }
+      if (msg.durability() != cloud::CloudMessage_Durability_DEFAULT_DURABILITY) {
+        fmt::print("Durability:\t{}\n",
+                   cloud::CloudMessage_Durability_Name(msg.durability()));
+      }
+      break;
+    case cloud::CloudMessage_Operation_COMPARE_AND_SWAP:
+    case cloud::CloudMessage_Operation_INCREMENT:
+    case cloud::CloudMessage_Operation_APPEND:
+      // the value after the operation is printed even if it failed, e.g., the
+      // current value on a CAS conflict
+      if (!msg.success()) {
+        fmt::print("{}\n", msg.message());
+      }
+      for (const auto &kvp : msg.kvp()) {
+        fmt::print("Key:\t{}\nValue:\t{}\n", kvp.key(), kvp.value());
+      }
+      break;
+    case cloud::CloudMessage_Operation_TRANSACTION:
+      // on failure, the keys that conflicted are printed with their current
+      // value
+      fmt::print("{}\n", msg.message());
+      for (const auto &kvp : msg.kvp()) {
+        fmt::print("Key:\t{}\nValue:\t{}\n", kvp.key(), kvp.value());
+      }
+      break;
+    case cloud::CloudMessage_Operation_STATS:
+      for (const auto &kvp : msg.kvp()) {
+        fmt::print("{}\t{}\n", kvp.key(), kvp.value());
+      }
       break;
     default:
       fmt::print("{}\n", msg.message());
       break;
   }
+
+  if (trace_id) fmt::print("Trace:\t{:016x}\n", trace_id);
 }
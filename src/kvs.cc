@@ -1,6 +1,9 @@
 #include "cloudlab/handler/api.hh"
 #include "cloudlab/handler/p2p.hh"
+#include "cloudlab/network/compression.hh"
+#include "cloudlab/network/metrics_endpoint.hh"
 #include "cloudlab/network/server.hh"
+#include "cloudlab/tracing.hh"
 
 #include "argh.hh"
 #include <fmt/core.h>
@@ -8,7 +11,12 @@
 using namespace cloudlab;
 
 auto main(int argc, char* argv[]) -> int {
-  argh::parser cmdl({"-a", "--api", "-p", "--p2p"});
+  argh::parser cmdl({"-a", "--api", "-p", "--p2p", "-c", "--ca", "--cache-size",
+                     "--storage-profile", "--storage-config", "--durability",
+                     "--queue-capacity", "--max-connections", "--metrics",
+                     "--trace-file", "--trace-sample",
+                     "--compression-threshold", "--compression-level",
+                     "--compression-dictionary", "--backend"});
   cmdl.parse(argc, argv);
 
   std::string api_address, p2p_address, clust_address;
@@ -16,21 +24,84 @@ auto main(int argc, char* argv[]) -> int {
   cmdl({"-p", "--p2p"}, "127.0.0.1:32000") >> p2p_address;
   cmdl({"-c", "--ca"}, "127.0.0.1:41000") >> clust_address;
 
+  // storage configuration: a named preset, optionally refined by a config
+  // file and the value cache size
+  std::string storage_preset, storage_file;
+  cmdl("--storage-profile", "default") >> storage_preset;
+  cmdl("--storage-config", "") >> storage_file;
+
+  auto storage_config = StorageConfig::preset(storage_preset);
+  if (!storage_file.empty()) {
+    storage_config = StorageConfig::from_file(storage_file, storage_config);
+  }
+  cmdl("--cache-size", storage_config.value_cache_size) >>
+      storage_config.value_cache_size;
+
+  // durability of writes that do not request a specific level
+  std::string durability;
+  cmdl("--durability", "") >> durability;
+  if (!durability.empty()) {
+    storage_config.durability = parse_durability(durability);
+  }
+
+  auto storage = std::make_shared<StorageProfile>(storage_config);
+
+  // admission control of both servers
+  AdmissionConfig admission{};
+  cmdl("--queue-capacity", admission.queue_capacity) >>
+      admission.queue_capacity;
+  cmdl("--max-connections", admission.max_connections) >>
+      admission.max_connections;
+
+  // event loop of both servers
+  std::string backend_name;
+  cmdl("--backend", "libevent") >> backend_name;
+  auto backend = parse_server_backend(backend_name);
+
+  // compression of large messages, e.g., partition data
+  CompressionConfig compression{};
+  cmdl("--compression-threshold", compression.threshold) >>
+      compression.threshold;
+  cmdl("--compression-level", compression.level) >> compression.level;
+  std::string dictionary;
+  cmdl("--compression-dictionary", "") >> dictionary;
+  if (!dictionary.empty()) compression.load_dictionary(dictionary);
+  set_compression_config(std::move(compression));
+
+  // tracing of sampled requests, disabled unless a file is given
+  std::string trace_file;
+  double trace_sample;
+  cmdl("--trace-file", "") >> trace_file;
+  cmdl("--trace-sample", 0.01) >> trace_sample;
+  if (!trace_file.empty()) {
+    tracer().open(trace_file, trace_sample,
+                  fmt::format("kvs {}", p2p_address));
+  }
+
   auto routing = Routing(p2p_address);
 
   // cluster address is the router address
   routing.set_cluster_address(SocketAddress{clust_address});
 
   auto api_handler = APIHandler(routing);
-  auto api_server = Server(api_address, api_handler);
+  auto api_server = Server(api_address, api_handler, admission, backend);
   auto api_thread = api_server.run();
 
-  auto p2p_handler = P2PHandler(routing);
-  auto p2p_server = Server(p2p_address, p2p_handler);
+  auto p2p_handler = P2PHandler(routing, storage);
+  auto p2p_server = Server(p2p_address, p2p_handler, admission, backend);
   auto p2p_thread = p2p_server.run();
 
+  // Prometheus endpoint, disabled unless an address is given
+  std::string metrics_address;
+  cmdl("--metrics", "") >> metrics_address;
+  std::thread metrics_thread;
+  if (!metrics_address.empty()) {
+    metrics_thread = serve_metrics(metrics_address);
+  }
+
   fmt::print("KVS up and running ...\n");
 
   api_thread.join();
   p2p_thread.join();
+  if (metrics_thread.joinable()) metrics_thread.join();
 }
\ No newline at end of file
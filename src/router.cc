@@ -1,6 +1,9 @@
 #include "cloudlab/handler/router.hh"
 #include "cloudlab/handler/api.hh"
+#include "cloudlab/network/compression.hh"
+#include "cloudlab/network/metrics_endpoint.hh"
 #include "cloudlab/network/server.hh"
+#include "cloudlab/tracing.hh"
 
 #include "argh.hh"
 #include <fmt/core.h>
@@ -8,25 +11,78 @@
 using namespace cloudlab;
 
 auto main(int argc, char* argv[]) -> int {
-  argh::parser cmdl({"-a", "--api", "-r", "--router"});
+  argh::parser cmdl({"-a", "--api", "-r", "--router", "--queue-capacity",
+                     "--max-connections", "--hedge-percentile",
+                     "--hedge-budget", "--metrics", "--trace-file",
+                     "--trace-sample", "--compression-threshold",
+                     "--compression-level", "--compression-dictionary",
+                     "--backend"});
   cmdl.parse(argc, argv);
 
   std::string api_address, router_address;
   cmdl({"-a", "--api"}, "127.0.0.1:31000") >> api_address;
   cmdl({"-r", "--router"}, "127.0.0.1:33000") >> router_address;
 
+  // admission control of both servers
+  AdmissionConfig admission{};
+  cmdl("--queue-capacity", admission.queue_capacity) >>
+      admission.queue_capacity;
+  cmdl("--max-connections", admission.max_connections) >>
+      admission.max_connections;
+
+  // hedged GETs
+  HedgingConfig hedging{};
+  hedging.enabled = cmdl["--hedge"];
+  cmdl("--hedge-percentile", hedging.percentile) >> hedging.percentile;
+  cmdl("--hedge-budget", hedging.budget) >> hedging.budget;
+
+  // event loop of both servers
+  std::string backend_name;
+  cmdl("--backend", "libevent") >> backend_name;
+  auto backend = parse_server_backend(backend_name);
+
+  // compression of large messages, e.g., partition data
+  CompressionConfig compression{};
+  cmdl("--compression-threshold", compression.threshold) >>
+      compression.threshold;
+  cmdl("--compression-level", compression.level) >> compression.level;
+  std::string dictionary;
+  cmdl("--compression-dictionary", "") >> dictionary;
+  if (!dictionary.empty()) compression.load_dictionary(dictionary);
+  set_compression_config(std::move(compression));
+
+  // tracing of sampled requests, disabled unless a file is given
+  std::string trace_file;
+  double trace_sample;
+  cmdl("--trace-file", "") >> trace_file;
+  cmdl("--trace-sample", 0.01) >> trace_sample;
+  if (!trace_file.empty()) {
+    tracer().open(trace_file, trace_sample,
+                  fmt::format("router {}", router_address));
+  }
+
   auto routing = Routing(router_address);
 
   auto api_handler = APIHandler(routing);
-  auto api_server = Server(api_address, api_handler);
+  auto api_server = Server(api_address, api_handler, admission, backend);
   auto api_thread = api_server.run();
 
-  auto router_handler = RouterHandler(routing);
-  auto router_server = Server(router_address, router_handler);
+  auto router_handler = RouterHandler(routing, hedging);
+  auto router_server =
+      Server(router_address, router_handler, admission, backend);
   auto router_thread = router_server.run();
 
+  // Prometheus endpoint, disabled unless an address is given
+  std::string metrics_address;
+  cmdl("--metrics", "") >> metrics_address;
+  std::thread metrics_thread;
+  if (!metrics_address.empty()) {
+    metrics_thread = serve_metrics(metrics_address);
+  }
+
   fmt::print("Router up and running ...\n");
 
   api_thread.join();
   router_thread.join();
+  if (metrics_thread.joinable()) metrics_thread.join();
 }
\ No newline at end of file
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+
+import sys
+from time import sleep
+from testsupport import subtest, run
+from socketsupport import run_router, run_kvs, run_ctl
+
+def main() -> None:
+    with subtest("Testing atomic read-modify-write operations"):
+        router = run_router("127.0.0.1:40000", "127.0.0.1:41000")
+        kvs    = run_kvs("127.0.0.1:42000", "127.0.0.1:43000", "127.0.0.1:41000")
+
+        sleep(5)
+
+        def stop(code: int) -> None:
+            run(["kill", "-9", str(router.pid)])
+            run(["kill", "-9", str(kvs.pid)])
+            sys.exit(code)
+
+        ctl    = run_ctl("127.0.0.1:40000", "join", "127.0.0.1:43000")
+        if "OK" not in ctl:
+            stop(1)
+
+        sleep(5)
+
+        for i in range(1, 11):
+            ctl = run_ctl("127.0.0.1:40000", "incr", "counter")
+            if f"Value:\t{i}" not in ctl:
+                stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "incr", "counter -4")
+        if "Value:\t6" not in ctl:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "cas", "counter 5 7")
+        if "CONFLICT" not in ctl or "Value:\t6" not in ctl:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "cas", "counter 6 7")
+        if "CONFLICT" in ctl or "Value:\t7" not in ctl:
+            stop(1)
+
+        run_ctl("127.0.0.1:40000", "append", "log a")
+        ctl = run_ctl("127.0.0.1:40000", "append", "log b")
+        if "Value:\tab" not in ctl:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "incr", "log")
+        if "ERROR" not in ctl:
+            stop(1)
+
+        # deltas must be integers as a whole
+        ctl = run_ctl("127.0.0.1:40000", "incr", "counter 12abc")
+        if "ERROR" not in ctl:
+            stop(1)
+
+        # sums that do not fit into 64 bit fail and keep the value
+        run_ctl("127.0.0.1:40000", "put", "max 9223372036854775807")
+        ctl = run_ctl("127.0.0.1:40000", "incr", "max")
+        if "ERROR" not in ctl:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "get", "max")
+        if "Value:\t9223372036854775807" not in ctl:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "get", "counter")
+        if "Value:\t7" not in ctl:
+            stop(1)
+
+        stop(0)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+
+import sys
+from time import sleep
+from testsupport import subtest, run, run_project_executable
+from socketsupport import run_router, run_kvs, run_ctl
+
+def metric(ctl: str, name: str) -> float:
+    total = 0.0
+    for line in ctl.splitlines():
+        if line.startswith(name):
+            total += float(line.split()[-1])
+    return total
+
+def main() -> None:
+    with subtest("Testing the compact format and compression to the nodes"):
+        router = run_router("127.0.0.1:40000", "127.0.0.1:41000")
+        kvs    = run_kvs("127.0.0.1:42000", "127.0.0.1:43000", "127.0.0.1:41000")
+
+        sleep(5)
+
+        def stop(code: int) -> None:
+            run(["kill", "-9", str(router.pid)])
+            run(["kill", "-9", str(kvs.pid)])
+            sys.exit(code)
+
+        ctl = run_ctl("127.0.0.1:40000", "join", "127.0.0.1:43000")
+        if "OK" not in ctl:
+            stop(1)
+
+        sleep(5)
+
+        # small key operations, the router sends them in the compact format
+        ctl = run_ctl("127.0.0.1:40000", "put", "small 1")
+        if "OK" not in ctl:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "incr", "small 41")
+        if "Value:\t42" not in ctl:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "append", "small x")
+        if "Value:\t42x" not in ctl:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "del", "small")
+        if "OK" not in ctl:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "get", "small")
+        if "Value:\t42x" in ctl or "ERROR" not in ctl:
+            stop(1)
+
+        # values above the compression threshold are compressed on the way to
+        # the node and back and must arrive unchanged
+        large = "".join(f"{i:08d}-abcdefghijklmnop;" for i in range(2000))
+        ctl = run_ctl("127.0.0.1:40000", "put", f"large {large}")
+        if "OK" not in ctl:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "get", "large")
+        if f"Key:\tlarge\nValue:\t{large}\n" not in ctl:
+            stop(1)
+
+        # a batch whose keys are small, but that exceeds the threshold as a
+        # whole
+        pairs = " ".join(f"batch{k} value-{k:04d}-{'z' * 64}" for k in range(200))
+        ctl = run_ctl("127.0.0.1:40000", "put", pairs)
+        if "OK" not in ctl:
+            stop(1)
+
+        keys = " ".join(f"batch{k}" for k in range(200))
+        ctl = run_ctl("127.0.0.1:40000", "get", keys)
+        for k in range(200):
+            if f"Key:\tbatch{k}\nValue:\tvalue-{k:04d}-{'z' * 64}\n" not in ctl:
+                stop(1)
+
+        # the node compressed the large responses
+        ctl = run_project_executable(
+            "ctl-test", ["-a", "127.0.0.1:43000", "stats"], check=False).stdout
+        if metric(ctl, "cloudlab_connection_compression_saved_bytes_total") <= 0:
+            stop(1)
+
+        stop(0)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+
+import socket
+import struct
+import sys
+from time import sleep
+from testsupport import subtest, run, run_project_executable
+from socketsupport import run_router, run_kvs, run_ctl
+
+# see cluster_partitions in include/cloudlab/network/routing.hh
+partitions = 5
+
+def metric(ctl: str, name: str) -> float:
+    total = 0.0
+    for line in ctl.splitlines():
+        if line.startswith(name):
+            total += float(line.split()[-1])
+    return total
+
+def varint(n: int) -> bytes:
+    out = b""
+    while n >= 0x80:
+        out += bytes([n & 0x7f | 0x80])
+        n >>= 7
+    return out + bytes([n])
+
+def field(tag: int, data: bytes) -> bytes:
+    return bytes([tag]) + varint(len(data)) + data
+
+def partitions_changed(sender: str, sequence: int, changes: list) -> bytes:
+    # CloudMessage{operation: PARTITIONS_CHANGED, success: true,
+    #              address: {address: sender}, sequence: sequence,
+    #              partition: [{id, peer, removed} for (id, peer, removed)]}
+    msg = b"\x10\x12\x18\x01"
+    msg += field(0x32, field(0x0a, sender.encode()))
+    msg += b"\x70" + varint(sequence)
+    for (id, peer, removed) in changes:
+        partition = b"\x08" + varint(id) + field(0x12, peer.encode())
+        if removed:
+            partition += b"\x18\x01"
+        msg += field(0x3a, partition)
+    return struct.pack("!I", len(msg)) + msg
+
+def send_to_router(address: tuple, frame: bytes) -> bool:
+    with socket.create_connection(address) as sock:
+        sock.sendall(frame)
+        return len(sock.recv(4)) == 4
+
+def main() -> None:
+    with subtest("Testing requests for keys that moved to another node"):
+        router = run_router("127.0.0.1:40000", "127.0.0.1:41000")
+        kvs1   = run_kvs("127.0.0.1:42000", "127.0.0.1:43000", "127.0.0.1:41000")
+        kvs2   = run_kvs("127.0.0.1:44000", "127.0.0.1:45000", "127.0.0.1:41000")
+
+        sleep(5)
+
+        def stop(code: int) -> None:
+            run(["kill", "-9", str(router.pid)])
+            run(["kill", "-9", str(kvs1.pid)])
+            run(["kill", "-9", str(kvs2.pid)])
+            sys.exit(code)
+
+        for address in ["127.0.0.1:43000", "127.0.0.1:45000"]:
+            ctl = run_ctl("127.0.0.1:40000", "join", address)
+            if "OK" not in ctl:
+                stop(1)
+            sleep(5)
+
+        keys = [f"key{k}" for k in range(20)]
+        for key in keys:
+            ctl = run_ctl("127.0.0.1:40000", "put", f"{key} value-{key}")
+            if "OK" not in ctl:
+                stop(1)
+
+        # every key is stored on exactly one node, the other one answers
+        # NOT_OWNER instead of reporting it missing
+        owners = set()
+        for key in keys:
+            owner = None
+            for address in ["127.0.0.1:43000", "127.0.0.1:45000"]:
+                ctl = run_ctl(address, "get", key)
+                if f"Value:\tvalue-{key}" in ctl:
+                    if owner is not None:
+                        stop(1)
+                    owner = address
+                elif "NOT_OWNER" not in ctl:
+                    stop(1)
+            if owner is None:
+                stop(1)
+            owners.add(owner)
+
+        # both nodes store keys, otherwise nothing below is redirected
+        if len(owners) != 2:
+            stop(1)
+
+        # a stale partition map: the router believes that the first node
+        # stores every partition. It learned that the second node stole some
+        # of them, so it names that node as their owner.
+        changes = [(id, "127.0.0.1:43000", False) for id in range(partitions)]
+        changes += [(id, "127.0.0.1:45000", True) for id in range(partitions)]
+        if not send_to_router(("127.0.0.1", 41000),
+                              partitions_changed("test-stale-map", 1, changes)):
+            stop(1)
+
+        for key in keys:
+            ctl = run_ctl("127.0.0.1:40000", "get", key)
+            if f"Value:\tvalue-{key}" not in ctl:
+                stop(1)
+
+        # writes are redirected as well
+        for key in keys:
+            ctl = run_ctl("127.0.0.1:40000", "put", f"{key} new-{key}")
+            if "OK" not in ctl:
+                stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "get", " ".join(keys))
+        for key in keys:
+            if f"Key:\t{key}\nValue:\tnew-{key}\n" not in ctl:
+                stop(1)
+
+        ctl = run_project_executable(
+            "ctl-test", ["-a", "127.0.0.1:40000", "stats"], check=False).stdout
+        if metric(ctl, "cloudlab_router_redirects_total") <= 0:
+            stop(1)
+
+        stop(0)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+
+import os
+import socket
+import struct
+import sys
+from time import sleep
+from testsupport import subtest, run, run_project_executable
+from socketsupport import run_router, run_kvs, run_ctl
+
+def metric(ctl: str, name: str) -> float:
+    total = 0.0
+    for line in ctl.splitlines():
+        if line.startswith(name):
+            total += float(line.split()[-1])
+    return total
+
+def varint(n: int) -> bytes:
+    out = b""
+    while n >= 0x80:
+        out += bytes([n & 0x7f | 0x80])
+        n >>= 7
+    return out + bytes([n])
+
+def get_request(keys: list) -> bytes:
+    # CloudMessage{operation: GET, kvp: [{key: k} for k in keys]}
+    msg = b"\x10\x01"
+    for key in keys:
+        kvp = b"\x0a" + varint(len(key)) + key.encode()
+        msg += b"\x2a" + varint(len(kvp)) + kvp
+    return struct.pack("!I", len(msg)) + msg
+
+def receive_all(sock: socket.socket, size: int) -> bytes:
+    data = b""
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            break
+        data += chunk
+    return data
+
+def value(k: int) -> str:
+    # a command line argument may have at most 128 KB
+    return f"{k:04d}" + "".join(f"{i:07d}-{k:04d};" for i in range(10000))
+
+# the send buffer of a Unix domain socket is much smaller than the one that a
+# loopback TCP connection grows to, so large responses do not fit
+api_path = "/tmp/cloudlab-test-partial-writes.sock"
+api = f"unix:{api_path}"
+
+def main() -> None:
+    with subtest("Testing responses larger than the socket buffers"):
+        if os.path.exists(api_path):
+            os.remove(api_path)
+        router = run_router(api, "127.0.0.1:41000")
+        kvs    = run_kvs("127.0.0.1:42000", "127.0.0.1:43000", "127.0.0.1:41000")
+
+        sleep(5)
+
+        def stop(code: int) -> None:
+            run(["kill", "-9", str(router.pid)])
+            run(["kill", "-9", str(kvs.pid)])
+            sys.exit(code)
+
+        ctl = run_ctl(api, "join", "127.0.0.1:43000")
+        if "OK" not in ctl:
+            stop(1)
+
+        sleep(5)
+
+        for k in range(7):
+            ctl = run_ctl(api, "put", f"big{k} {value(k)}")
+            if "OK" not in ctl:
+                stop(1)
+
+        # responses of almost 1 MB, the largest message size
+        keys = " ".join(f"big{k}" for k in range(7))
+        for address in [api, "127.0.0.1:42000"]:
+            ctl = run_ctl(address, "get", keys)
+            for k in range(7):
+                if f"Key:\tbig{k}\nValue:\t{value(k)}\n" not in ctl:
+                    stop(1)
+
+        # a client that does not read for a while: the router can only write
+        # the beginning of the response, the rest is written once the client
+        # reads it
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.connect(api_path)
+        sock.sendall(get_request([f"big{k}" for k in range(7)]))
+        sleep(2)
+        (size,) = struct.unpack("!I", receive_all(sock, 4))
+        response = receive_all(sock, size)
+        sock.close()
+        if len(response) != size:
+            stop(1)
+        for k in range(7):
+            if value(k).encode() not in response:
+                stop(1)
+
+        # clients that go away in the middle of a response: the router fails
+        # to write the rest in the background and closes the connections
+        for _ in range(20):
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.connect(api_path)
+            sock.sendall(get_request([f"big{k}" for k in range(7)]))
+            receive_all(sock, 4096)
+            sock.close()
+
+        # the router still answers after the large responses
+        ctl = run_ctl(api, "get", "big0")
+        if f"Value:\t{value(0)}\n" not in ctl:
+            stop(1)
+
+        ctl = run_project_executable(
+            "ctl-test", ["-a", api, "stats"], check=False).stdout
+        if metric(ctl, "cloudlab_connection_deferred_sends_total") <= 0:
+            stop(1)
+
+        stop(0)
+
+if __name__ == "__main__":
+    main()
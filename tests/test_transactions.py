@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+
+import sys
+from time import sleep
+from testsupport import subtest, run
+from socketsupport import run_router, run_kvs, run_ctl
+
+def main() -> None:
+    with subtest("Testing transactions across two shards"):
+        router = run_router("127.0.0.1:40000", "127.0.0.1:41000")
+        kvs1   = run_kvs("127.0.0.1:42000", "127.0.0.1:43000", "127.0.0.1:41000")
+        kvs2   = run_kvs("127.0.0.1:44000", "127.0.0.1:45000", "127.0.0.1:41000")
+
+        sleep(5)
+
+        def stop(code: int) -> None:
+            run(["kill", "-9", str(router.pid)])
+            run(["kill", "-9", str(kvs1.pid)])
+            run(["kill", "-9", str(kvs2.pid)])
+            sys.exit(code)
+
+        for address in ["127.0.0.1:43000", "127.0.0.1:45000"]:
+            ctl = run_ctl("127.0.0.1:40000", "join", address)
+            if "OK" not in ctl:
+                stop(1)
+            sleep(5)
+
+        # enough keys s.t. both shards take part
+        pairs = " ".join(f"{k} 1" for k in range(1, 11))
+        ctl = run_ctl("127.0.0.1:40000", "txn", pairs)
+        if "OK" not in ctl:
+            stop(1)
+
+        # one stale expected value aborts the whole transaction
+        ctl = run_ctl("127.0.0.1:40000", "txn-cas", "1 1 2 10 5 2")
+        if "CONFLICT" not in ctl or "Key:\t10\nValue:\t1" not in ctl:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "get", "1 10")
+        if "Value:\t2" in ctl:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "txn-cas", "1 1 2 10 1 2")
+        if "OK" not in ctl:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "get", "1 10")
+        if "Key:\t1\nValue:\t2" not in ctl or "Key:\t10\nValue:\t2" not in ctl:
+            stop(1)
+
+        stop(0)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+
+import re
+import sys
+from time import sleep
+from testsupport import subtest, run
+from socketsupport import run_router, run_kvs, run_ctl
+
+def version(ctl: str) -> int:
+    match = re.search(r"Version:\t(\d+)", ctl)
+    return int(match.group(1)) if match else 0
+
+def main() -> None:
+    with subtest("Testing TTL expiry and versioned values"):
+        router = run_router("127.0.0.1:40000", "127.0.0.1:41000")
+        kvs    = run_kvs("127.0.0.1:42000", "127.0.0.1:43000", "127.0.0.1:41000")
+
+        sleep(5)
+
+        def stop(code: int) -> None:
+            run(["kill", "-9", str(router.pid)])
+            run(["kill", "-9", str(kvs.pid)])
+            sys.exit(code)
+
+        ctl = run_ctl("127.0.0.1:40000", "join", "127.0.0.1:43000")
+        if "OK" not in ctl:
+            stop(1)
+
+        sleep(5)
+
+        # a key with a TTL is readable until it expires, one without stays
+        ctl = run_ctl("127.0.0.1:40000", "put", "-t 2 session abc")
+        if "OK" not in ctl:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "put", "user alice")
+        if "OK" not in ctl:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "get", "session")
+        if "Value:\tabc" not in ctl:
+            stop(1)
+
+        sleep(4)
+
+        ctl = run_ctl("127.0.0.1:40000", "get", "session")
+        if "Value:\tabc" in ctl or "ERROR" not in ctl:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "get", "user")
+        if "Value:\talice" not in ctl:
+            stop(1)
+
+        # every write gets a newer version
+        ctl = run_ctl("127.0.0.1:40000", "get", "user")
+        first = version(ctl)
+        if first == 0:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "put", "user bob")
+        if "OK" not in ctl:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "get", "user")
+        if "Value:\tbob" not in ctl or version(ctl) <= first:
+            stop(1)
+
+        # a multi-key read returns a timestamp that later reads can use to see
+        # the values as they were
+        ctl = run_ctl("127.0.0.1:40000", "get", "user session")
+        match = re.search(r"Timestamp:\t(\d+)", ctl)
+        if "Value:\tbob" not in ctl or not match:
+            stop(1)
+        timestamp = match.group(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "put", "user carol")
+        if "OK" not in ctl:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "get", f"-s {timestamp} user")
+        if "Value:\tbob" not in ctl:
+            stop(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "get", "user")
+        if "Value:\tcarol" not in ctl:
+            stop(1)
+
+        stop(0)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+
+import socket
+import struct
+import sys
+import threading
+from time import sleep
+from testsupport import subtest, run, run_project_executable
+from socketsupport import run_router, run_kvs, run_ctl
+
+def metric(ctl: str, name: str) -> float:
+    total = 0.0
+    for line in ctl.splitlines():
+        if line.startswith(name):
+            total += float(line.split()[-1])
+    return total
+
+def receive_all(sock: socket.socket, size: int) -> bytes:
+    data = b""
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            break
+        data += chunk
+    return data
+
+class DroppingProxy:
+    """
+    Forwards connections from listen to target and drops the first TXN_COMMIT
+    that passes, as if the connection failed before the peer got it.
+    """
+
+    def __init__(self, listen: tuple, target: tuple) -> None:
+        self.target = target
+        self.dropped = 0
+        self.server = socket.create_server(listen)
+        threading.Thread(target=self.accept, daemon=True).start()
+
+    def accept(self) -> None:
+        while True:
+            client, _ = self.server.accept()
+            peer = socket.create_connection(self.target)
+            threading.Thread(target=self.requests, args=(client, peer),
+                             daemon=True).start()
+            threading.Thread(target=self.responses, args=(peer, client),
+                             daemon=True).start()
+
+    def requests(self, client: socket.socket, peer: socket.socket) -> None:
+        try:
+            while True:
+                word = receive_all(client, 4)
+                if len(word) < 4:
+                    break
+                # the highest three bits of the length word are flags
+                (size,) = struct.unpack("!I", word)
+                payload = receive_all(client, size & 0x1fffffff)
+                # CloudMessage{type: REQUEST, operation: TXN_COMMIT, ...}
+                if self.dropped == 0 and payload.startswith(b"\x10\x10"):
+                    self.dropped += 1
+                    break
+                peer.sendall(word + payload)
+        except OSError:
+            pass
+        client.close()
+        peer.close()
+
+    def responses(self, peer: socket.socket, client: socket.socket) -> None:
+        try:
+            while True:
+                data = peer.recv(65536)
+                if not data:
+                    break
+                client.sendall(data)
+        except OSError:
+            pass
+        client.close()
+        peer.close()
+
+def main() -> None:
+    with subtest("Testing commits that do not reach a participant"):
+        router = run_router("127.0.0.1:40000", "127.0.0.1:41000")
+        kvs1   = run_kvs("127.0.0.1:42000", "127.0.0.1:43000", "127.0.0.1:41000")
+        kvs2   = run_kvs("127.0.0.1:44000", "127.0.0.1:45000", "127.0.0.1:41000")
+
+        # the router reaches the second node only through the proxy
+        proxy = DroppingProxy(("127.0.0.1", 46000), ("127.0.0.1", 45000))
+
+        sleep(5)
+
+        def stop(code: int) -> None:
+            run(["kill", "-9", str(router.pid)])
+            run(["kill", "-9", str(kvs1.pid)])
+            run(["kill", "-9", str(kvs2.pid)])
+            sys.exit(code)
+
+        for address in ["127.0.0.1:43000", "127.0.0.1:46000"]:
+            ctl = run_ctl("127.0.0.1:40000", "join", address)
+            if "OK" not in ctl:
+                stop(1)
+            sleep(5)
+
+        # enough keys s.t. both shards take part. The second node misses the
+        # commit, so the outcome is unknown to the client.
+        pairs = " ".join(f"{k} 1" for k in range(1, 11))
+        ctl = run_ctl("127.0.0.1:40000", "txn", pairs)
+        if proxy.dropped != 1 or "ERROR" not in ctl:
+            stop(1)
+
+        # the router sends the commit again, the second node applies it and
+        # releases the locks of its keys
+        sleep(2)
+
+        ctl = run_ctl("127.0.0.1:40000", "get", " ".join(str(k) for k in range(1, 11)))
+        for k in range(1, 11):
+            if f"Key:\t{k}\nValue:\t1\n" not in ctl:
+                stop(1)
+
+        for k in range(1, 11):
+            ctl = run_ctl("127.0.0.1:40000", "put", f"{k} 2")
+            if "OK" not in ctl:
+                stop(1)
+
+        ctl = run_project_executable(
+            "ctl-test", ["-a", "127.0.0.1:40000", "stats"], check=False).stdout
+        if metric(ctl, "cloudlab_router_txn_decision_resends_total") <= 0:
+            stop(1)
+
+        stop(0)
+
+if __name__ == "__main__":
+    main()